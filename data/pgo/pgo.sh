@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+# Profile guided optimization workflow for crew-repl and crew-bench:
+#  1. build an instrumented configuration (CREW_PGO=GENERATE)
+#  2. train it by replaying the recorded session through crew-repl, running a batch of real
+#     commands through filter pipelines (crew-bench batch_fanout) and running crew-bench
+#  3. rebuild using the collected profile (CREW_PGO=USE)
+#  4. report crew-bench results of a plain release build next to the optimized one
+#
+# usage: data/pgo/pgo.sh [build root, default ./build-pgo] [session repetitions, default 2000] [batches, default 10]
+set -euo pipefail
+
+srcDir="$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)"
+root="$(realpath -m "${1:-${srcDir}/build-pgo}")"
+repetitions="${2:-2000}"
+batches="${3:-10}"
+profileDir="${root}/profile"
+jobs="$(nproc 2>/dev/null || echo 4)"
+
+configure()
+{
+	local dir="$1"
+	shift
+	cmake -S "${srcDir}" -B "${dir}" -DCMAKE_BUILD_TYPE=Release -DCREW_PGO_DIR="${profileDir}" "$@" >/dev/null
+	cmake --build "${dir}" -j"${jobs}" --target crew-repl crew-bench
+}
+
+echo "== instrumented build"
+rm -rf "${profileDir}"
+configure "${root}/generate" -DCREW_PGO=GENERATE
+
+echo "== training"
+for ((i = 0; i < repetitions; ++i)); do
+	cat "${srcDir}/data/pgo/session.txt"
+done | "${root}/generate/bin/crew-repl" --cooked >/dev/null
+# batches of commands are what crew mostly runs, weigh them above the single benchmarks
+for ((i = 0; i < batches; ++i)); do
+	"${root}/generate/bin/crew-bench" batch_fanout >/dev/null
+done
+"${root}/generate/bin/crew-bench" >/dev/null
+
+if command -v llvm-profdata >/dev/null && compgen -G "${profileDir}/*.profraw" >/dev/null; then
+	llvm-profdata merge -o "${profileDir}/default.profdata" "${profileDir}"/*.profraw
+fi
+
+echo "== optimized build"
+# profiles are not build dependencies, objects of an earlier run would be kept as they are
+rm -rf "${root}/use"
+configure "${root}/use" -DCREW_PGO=USE
+
+echo "== baseline build"
+configure "${root}/baseline" -DCREW_PGO=OFF
+
+echo "== crew-bench: baseline vs pgo"
+join -t: <("${root}/baseline/bin/crew-bench" | sort) <("${root}/use/bin/crew-bench" | sort) \
+	| awk -F: '{ printf "%-40s baseline%-22s pgo%s\n", $1, $2, $3 }'
@@ -1,6 +1,15 @@
 
+#include <common/allocation_tracker.hpp>
+#include <common/compress.hpp>
+#include <common/file_ops.hpp>
+#include <common/filter.hpp>
 #include <common/interpreter.hpp>
+#include <common/line_buffer.hpp>
+#include <common/process_tree.hpp>
+#include <common/profiler.hpp>
 #include <common/util.hpp>
+#include <common/warmup.hpp>
+#include <terminal/encoder.hpp>
 #include <terminal/terminal.hpp>
 
 #include <functional>
@@ -10,6 +19,7 @@
 #include <fmt/format.h>
 #include <fmt/std.h>
 
+#include <signal.h>
 #include <stdio.h>
 #include <termios.h>
 
@@ -33,21 +43,40 @@ std::vector<std::string> tokenize(std::string in)
 
 class RenderableWrappedText {
 public:
-    RenderableWrappedText(std::string content) :
-        m_content(std::move(content)) {}
+    /** Entries from this size on are compressed, smaller ones gain little and cost a decompression per re-wrap */
+    static constexpr size_t kSealThreshold = 4 * 1024;
 
-    /** Get wrapped content, lazily regenerating if width changes */
-    const std::vector<std::string> rows(int32_t cols) const
+    RenderableWrappedText(std::string content)
+    {
+        // only the final state of progress lines redrawn with \r is kept
+        m_content.append(ProgressStage::compact(content));
+        if (m_content.size() >= kSealThreshold) {
+            m_content.seal(); // scrollback is cold once appended
+        }
+    }
+
+    /** Get wrapped content, lazily decompressing and regenerating if width changes */
+    const std::vector<std::string>& rows(int32_t cols) const
     {
         if (m_cols != cols) {
-            m_rendered = toRows(m_content, cols);
+            Profiler::Region region("wrap");
+            auto content = m_content.str();
+            m_rendered = content ? toRows(*content, cols)
+                                 : std::vector<std::string>{content.error().message};
             m_cols = cols;
         }
         return m_rendered;
     }
 
+    /** Free the wrapped rows, leaving only the compressed content, e.g. once scrolled out of view */
+    void dropRows() const
+    {
+        m_rendered = {};
+        m_cols.reset();
+    }
+
 private:
-    std::string m_content;
+    CompressedBuffer m_content;
 
     // render state
     mutable std::optional<int32_t> m_cols; // validity of m_render
@@ -56,62 +85,114 @@ private:
 
 struct Editor {
 
-    Editor()
+    explicit Editor(Vm& vm) :
+        m_vm(vm)
     {
         auto ws = getWindowSize();
         if (!ws) {
             die("getWindowSize");
         }
         winSize = *ws;
+        m_encoder.reset(winSize);
     }
 
     Position winSize{};
     Position cursor{}; // origin is 1,1, so must be offest when comparing to winsize
 
-    std::string currentCommand;
+    LineBuffer currentCommand;
 
     struct Outputs {
         std::vector<RenderableWrappedText> entries;
 
-        void render(std::string& buffer, int32_t numLines) const
+        /** Redraw the whole output region, showing the newest rows */
+        void render(TerminalEncoder& encoder, int32_t numLines, int32_t cols)
         {
-            // iterate backwards over each entry, line
-            int32_t linesRendered = 0;
-            auto it = entries.begin();
-            while (it != entries.end() && linesRendered != numLines) {
-                const std::vector<std::string>& rows = it->rows(numLines);
-                auto lit = rows.begin();
-                while (lit != rows.end() && linesRendered != numLines) {
-                    buffer.append(*lit);
-                    buffer.append("\x1b[K\r\n"); // clear the current line, newline+cr
-                    ++linesRendered;
-                    ++lit;
+            // walk backwards to find the newest numLines rows, only wrapping what is shown
+            std::vector<const std::string*> shown;
+            size_t first = entries.size();
+            for (auto it = entries.rbegin(); it != entries.rend() && std::ssize(shown) < numLines; ++it, --first) {
+                const auto& rows = it->rows(cols);
+                for (auto lit = rows.rbegin(); lit != rows.rend() && std::ssize(shown) < numLines; ++lit) {
+                    shown.push_back(&*lit);
                 }
-                ++it;
-            };
+            }
+
+            // rows are positioned rather than separated by newlines, at the bottom margin
+            // a newline would scroll the region
+            int32_t linesRendered = 0;
+            for (auto it = shown.rbegin(); it != shown.rend(); ++it, ++linesRendered) {
+                drawRow(encoder, linesRendered, **it);
+            }
+            m_rowsOnScreen = linesRendered;
+            m_drawnEntries = entries.size();
+            dropRowsBefore(first);
 
             for (; linesRendered < numLines; ++linesRendered) {
-                buffer.append("~ " + std::to_string(linesRendered)); // clear the current line, newline+cr
-                buffer.append("\x1b[K\r\n"); // clear the current line, newline+cr
+                drawRow(encoder, linesRendered, "~ " + std::to_string(linesRendered));
+            }
+        }
+
+        /**
+         * Draw only the entries added since the last render. Once the region is full, new
+         * rows are written at its bottom margin so the terminal scrolls the region itself
+         * and the rows above are never retransmitted.
+         */
+        void renderAppended(TerminalEncoder& encoder, int32_t numLines, int32_t cols)
+        {
+            for (; m_drawnEntries < entries.size(); ++m_drawnEntries) {
+                for (const auto& row : entries[m_drawnEntries].rows(cols)) {
+                    if (m_rowsOnScreen < numLines) { // overwrite a filler row
+                        drawRow(encoder, m_rowsOnScreen++, row);
+                        continue;
+                    }
+                    encoder.moveTo(numLines - 1, 0);
+                    encoder.newLine(); // at the bottom margin, scrolls the region up a row
+                    encoder.write(row);
+                }
+            }
+
+            // entries scrolled out of the region are only kept compressed
+            size_t first = entries.size();
+            for (int32_t rows = 0; first > m_cachedFrom && rows < numLines; --first) {
+                rows += static_cast<int32_t>(entries[first - 1].rows(cols).size());
+            }
+            dropRowsBefore(first);
+        }
+
+    private:
+        /** Drop the wrapped rows of the entries before `first`, which are out of view */
+        void dropRowsBefore(size_t first)
+        {
+            for (; m_cachedFrom < first; ++m_cachedFrom) {
+                entries[m_cachedFrom].dropRows();
             }
+            m_cachedFrom = first; // lower after a full redraw showing more of the scrollback
+        }
+
+        static void drawRow(TerminalEncoder& encoder, int32_t row, std::string_view content)
+        {
+            encoder.moveTo(row, 0);
+            encoder.write(content);
+            encoder.clearToEndOfLine();
         }
 
-        // render method that takes # rows
+        size_t m_drawnEntries{}; // entries already on screen
+        size_t m_cachedFrom{}; // entries before this have no wrapped rows
+        int32_t m_rowsOnScreen{}; // output rows on screen, the rest of the region is filler
     } outputs;
 
+    /** Repaint everything on the next refresh, rather than only appending new output */
+    bool fullRedraw = true;
+
     /** input */
     void moveCursor(int key)
     {
         switch (key) {
         case fmt::underlying(EditorKey::ArrowLeft):
-            if (cursor.x > 0) {
-                --cursor.x;
-            }
+            currentCommand.moveLeft();
             break;
         case fmt::underlying(EditorKey::ArrowRight):
-            if (cursor.x < winSize.x - 1) {
-                ++cursor.x;
-            }
+            currentCommand.moveRight();
             break;
         case fmt::underlying(EditorKey::ArrowUp):
             if (cursor.y > 0) {
@@ -127,16 +208,20 @@ struct Editor {
     }
 
     /** input */
-    void processKeypress()
+    Result<> processKeypress()
     {
-        int c = readKey();
+        auto key = readKey();
+        if (!key) {
+            return std::unexpected(key.error());
+        }
+        int c = *key;
         switch (c) {
         case '\r':
-            outputs.entries.emplace_back(std::move(currentCommand));
-            currentCommand = {};
-            cursor.x = 0;
+            outputs.entries.emplace_back(currentCommand.str());
+            currentCommand.reset();
             break;
         case ctrlKey('q'):
+            write(STDOUT_FILENO, "\x1b[r", 3); // reset the scroll region
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
             ::exit(0);
@@ -158,85 +243,146 @@ struct Editor {
             moveCursor(c);
             break;
         case fmt::underlying(EditorKey::HomeKey):
-            cursor.x = 0;
+            currentCommand.moveHome();
             break;
         case fmt::underlying(EditorKey::EndKey):
-            cursor.x = winSize.x - 1;
+            currentCommand.moveEnd();
             break;
         case fmt::underlying(EditorKey::Backspace):
         case ctrlKey('h'):
-            if (!currentCommand.empty()) {
-                currentCommand.resize(currentCommand.size() - 1);
-                cursor.x -= 1;
-            }
+            currentCommand.eraseBefore();
             break;
         case ctrlKey('c'): // clear current
             currentCommand.clear();
-            cursor.x = 1;
+            break;
+        case ctrlKey('z'):
+            currentCommand.undo();
+            break;
+        case ctrlKey('y'):
+            currentCommand.redo();
             break;
         case fmt::underlying(EditorKey::DeleteKey):
-            // TODO:
+            currentCommand.eraseAfter();
             break;
         case ctrlKey('l'):
+            fullRedraw = true;
+            break;
         case '\x1b': // ESC should have been translated by readKey()
             break;
         default:
-            currentCommand.push_back(c);
-            cursor.x += 1;
+            if (c >= 0 && c <= 0xFF) {
+                const char ch = static_cast<char>(c);
+                currentCommand.insert({&ch, 1});
+            }
             break;
         }
+
+        // pay the cold start costs of what is being typed before Enter is pressed
+        if (std::string typed = currentCommand.str(); typed != m_speculated) {
+            Profiler::Region region("parse");
+            speculate(tokenize(typed));
+            m_speculated = std::move(typed);
+        }
+        return {};
     }
 
-    /** output */
-    void drawRows(std::string& buffer)
+    /** Rows of the window used for output, the remainder is the prompt */
+    int32_t outputRows() const
     {
-        int32_t promptLines = 2;
-        int32_t terminalRows = winSize.y - promptLines;
-
-        const auto clearCurrent = [&buffer](bool lastLine = false) {
-            buffer.append("\x1b[K"); // clear the current line
-            if (!lastLine) {
-                buffer.append("\r\n");
-            }
-        };
-
-        /** Append a string to the row, truncating to the window width*/
-        const auto appendTruncated = [this, &buffer](const std::string& content) {
-            int rowLen = std::min(
-                    static_cast<int32_t>(content.size()), winSize.x);
-            buffer.append(content.begin(), content.begin() + rowLen);
-        };
-
-        outputs.render(buffer, terminalRows);
+        constexpr int32_t promptLines = 2;
+        return std::max(winSize.y - promptLines, 1);
+    }
 
-        { // print current command
-            cursor.y = terminalRows;
-            appendTruncated(currentCommand);
-            clearCurrent();
+    /** output */
+    void drawPrompt()
+    {
+        const int32_t terminalRows = outputRows();
+
+        // scroll horizontally to keep the cursor in view on lines wider than the window
+        const auto width = static_cast<size_t>(std::max(winSize.x, 1));
+        const size_t column = currentCommand.cursorColumn();
+        if (column < m_promptScroll) {
+            m_promptScroll = column;
+        } else if (column >= m_promptScroll + width) {
+            m_promptScroll = column - width + 1;
         }
-        { // provide detail below
-            buffer.append("crew interpreter - ctrl-q to quit");
-            clearCurrent(true);
+        cursor.x = static_cast<int>(column - m_promptScroll);
+
+        // the prompt lies below the scroll region, so it is unaffected by output scrolling.
+        // Only the part of the command after what is already on screen is transmitted.
+        const std::string shown = currentCommand.slice(m_promptScroll, width);
+        size_t common = 0;
+        while (common < shown.size() && common < m_drawnCommand.size()
+                && shown[common] == m_drawnCommand[common]) {
+            ++common;
+        }
+        cursor.y = terminalRows;
+        if (fullRedraw || common < shown.size() || common < m_drawnCommand.size()) {
+            m_encoder.moveTo(terminalRows, static_cast<int>(common));
+            m_encoder.write(shown.substr(common));
+            m_encoder.clearToEndOfLine();
+            m_drawnCommand.assign(shown);
+        }
+
+        if (fullRedraw) { // provide detail below
+            m_encoder.moveTo(terminalRows + 1, 0);
+            m_encoder.write(std::string_view("crew interpreter - ctrl-q to quit").substr(0, winSize.x));
+            m_encoder.clearToEndOfLine();
         }
     }
     void refreshScreen()
     {
-        std::string buffer;
-        buffer.append("\x1b[?25l"); // hide cursor
-        buffer.append("\x1b[H"); // move cursor to top left
+        Profiler::Region region("render");
+        if (fullRedraw) {
+            // forget the screen contents, every row is rewritten and cleared
+            m_encoder.reset(winSize);
+            m_drawnCommand.clear();
+            // restrict scrolling to the output rows, this also homes the cursor
+            m_encoder.setScrollRegion(0, outputRows() - 1);
+            outputs.render(m_encoder, outputRows(), winSize.x);
+        } else {
+            outputs.renderAppended(m_encoder, outputRows(), winSize.x);
+        }
+        drawPrompt();
+        fullRedraw = false;
+        std::string body = m_encoder.take();
 
-        drawRows(buffer);
+        // move cursor to position specified by the `cursor` member
+        m_encoder.moveTo(cursor.y, cursor.x);
+        std::string buffer = m_encoder.take();
 
-        { // move cursor to position specified by the `cursor` member
-            std::array<char, 32> buf;
-            snprintf(buf.data(), sizeof(buf), "\x1b[%d;%dH", cursor.y + 1, cursor.x + 1);
-            buffer.append(buf.begin(), buf.begin() + strlen(buf.data()));
+        // text typed at the cursor needs no hiding, anything moving it around does
+        if (body.find('\x1b') != std::string::npos) {
+            buffer = "\x1b[?25l" + body + buffer + "\x1b[?25h";
+        } else {
+            buffer = body + buffer;
         }
+        if (!buffer.empty()) {
+            write(STDOUT_FILENO, buffer.c_str(), buffer.length());
+        }
+    }
 
-        buffer.append("\x1b[?25h"); // show cursor
-
-        write(STDOUT_FILENO, buffer.c_str(), buffer.length());
+private:
+    /** Warm up for `tokens` if they name a command run as a program, builtins run in process */
+    void speculate(std::vector<std::string> tokens)
+    {
+        const auto parse = m_vm.parseTokens(tokens);
+        if (parse && parse->command != nullptr && !parse->command->builtin()) {
+            if (!m_warmup.has_value()) {
+                m_warmup.emplace(); // sessions only typing builtins never start its thread
+            }
+            m_warmup->speculate(std::move(tokens));
+        } else if (m_warmup.has_value()) {
+            m_warmup->cancel();
+        }
     }
+
+    Vm& m_vm;
+    std::optional<Warmup> m_warmup;
+    TerminalEncoder m_encoder;
+    std::string m_drawnCommand; // prompt contents currently on screen
+    size_t m_promptScroll{}; // column of the command shown at the left edge of the prompt
+    std::string m_speculated; // command line the warm-up last started for
 };
 
 struct TerminalConfig {
@@ -246,17 +392,18 @@ struct TerminalConfig {
 static TerminalConfig s_terminalConfig;
 
 /** Restore the terminal to its original state */
-void exitRawMode()
+Result<> exitRawMode()
 {
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &s_terminalConfig.origTermios) == -1) {
-        fatal("failed to tcsetattr: {}", std::strerror(errno));
+        return makeError("failed to tcsetattr: {}", std::strerror(errno));
     }
+    return {};
 }
 
-void enterRawMode()
+Result<> enterRawMode()
 {
     if (tcgetattr(STDIN_FILENO, &s_terminalConfig.origTermios) == -1) {
-        fatal("failed to tcgetattr: {}", std::strerror(errno));
+        return makeError("failed to tcgetattr: {}", std::strerror(errno));
     }
 
     struct termios raw = s_terminalConfig.origTermios;
@@ -281,40 +428,86 @@ void enterRawMode()
     raw.c_cc[VTIME] = 1;
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
-        fatal("failed to tcsetattr: {}", std::strerror(errno));
+        return makeError("failed to tcsetattr: {}", std::strerror(errno));
     }
 
     // setup atexit handler to restore original terminal on exit
-    ::atexit(exitRawMode);
+    ::atexit([]() {
+        if (auto restored = exitRawMode(); !restored) {
+            std::cerr << restored.error().message << std::endl;
+        }
+    });
+    return {};
 }
 
 int cookedRepl(Vm& vm, std::ostream& out)
 {
+    // Ctrl-C tears down the commands running in their own process groups, which the
+    // terminal no longer signals, and only quits when there are none
+    struct sigaction action {};
+    action.sa_handler = [](int) {
+        if (ProcessTree::interruptAll() == 0) {
+            ::signal(SIGINT, SIG_DFL);
+            ::raise(SIGINT);
+        }
+    };
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, nullptr);
+
     out << "Repl:" << std::endl;
     out << "working dir is: " << std::filesystem::current_path() << std::endl;
     while (true) {
         out << ">";
         std::string in;
-        getline(std::cin, in);
-        auto tokens = tokenize(in);
-        if (auto parse = vm.parseTokens(tokens)) {
+        if (!getline(std::cin, in)) { // end of a piped session
+            break;
+        }
+        const auto allocated = AllocationTracker::snapshot();
+        std::optional<ParseResult> parse;
+        {
+            Profiler::Region region("parse");
+            parse = vm.parseTokens(tokenize(in));
+        }
+        if (parse) {
             out << *parse << "\n";
+            if (parse->command != nullptr && parse->command->builtin()) {
+                if (auto status = vm.execute(*parse, out); !status) {
+                    out << status.error().message << "\n";
+                } else if (*status != 0) {
+                    out << "exit status: " << *status << "\n";
+                }
+            }
         } else {
             out << "NO COMMAND!\n";
         }
+        if (AllocationTracker::enabled()) { // allocations made for this command
+            for (const auto& usage : AllocationTracker::snapshot().since(allocated)) {
+                out << fmt::format("allocated {}: {} times, {} bytes\n", usage.subsystem, usage.allocations, usage.bytes);
+            }
+        }
         out.flush();
     }
     return 0;
 }
 
-int rawRepl()
+int rawRepl(Vm& vm)
 {
-    enterRawMode();
-    Editor editor{};
+    if (auto raw = enterRawMode(); !raw) {
+        std::cerr << raw.error().message << std::endl;
+        return 1;
+    }
+    Editor editor(vm);
 
     while (1) {
         editor.refreshScreen();
-        editor.processKeypress();
+        // transient read failures are retried by readKey(), the rest (e.g. EIO after a
+        // hangup) would fail again on every key
+        if (auto processed = editor.processKeypress(); !processed) {
+            write(STDOUT_FILENO, "\x1b[r", 3); // reset the scroll region
+            std::cerr << processed.error().message << std::endl;
+            return 1;
+        }
     }
 
     return 0;
@@ -341,14 +534,36 @@ int main(int argc, char** argv)
     vm.addParam("string", [](const std::string& s) { return !s.empty(); });
     vm.addParam("file", [](const std::string& s) { return std::filesystem::exists(s); });
     vm.addParam("directory", [](const std::string& s) { return std::filesystem::is_directory(s); });
-    vm.addCommand("print", {"string"});
-    vm.addCommand("print1", {"string"});
-    vm.addCommand("print2", {"string", "string"});
-    vm.addCommand("isfile", {"file"});
-    vm.addCommand("isdir", {"directory"});
+    for (const auto& [id, params] : std::vector<std::pair<std::string, std::vector<std::string>>>{
+                 {"print", {"string"}},
+                 {"print1", {"string"}},
+                 {"print2", {"string", "string"}},
+                 {"isfile", {"file"}},
+                 {"isdir", {"directory"}},
+         }) {
+        if (auto added = vm.addCommand(id, params); !added) {
+            crew::fatal("failed to define command {}: {}", id, added.error().message);
+        }
+    }
+
+    if (auto added = crew::addFileBuiltins(vm); !added) {
+        crew::fatal("failed to define file builtins: {}", added.error().message);
+    }
+
+    if (auto added = crew::addProfilerBuiltins(vm); !added) {
+        crew::fatal("failed to define profiler builtins: {}", added.error().message);
+    }
+    if (auto added = crew::addStatsBuiltins(vm); !added) {
+        crew::fatal("failed to define stats builtins: {}", added.error().message);
+    }
+    // `kill -USR2` starts sampling, the next one stops it and writes the flamegraph input
+    const auto profile = std::filesystem::temp_directory_path() / fmt::format("crew-repl-{}.folded", ::getpid());
+    if (auto toggled = crew::Profiler::shared().toggleOnSignal(SIGUSR2, profile); !toggled) {
+        std::cerr << toggled.error().message << std::endl;
+    }
 
     if (rawMode) {
-        return crew::rawRepl();
+        return crew::rawRepl(vm);
     } else {
         return cookedRepl(vm, std::cout);
     }
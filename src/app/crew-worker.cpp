@@ -0,0 +1,19 @@
+#include <common/worker.hpp>
+
+#include <string>
+
+/** Usage: crew-worker --fd <socket>, serves commands sent by a WorkerPool over the socket */
+int main(int argc, char** argv)
+{
+    int fd = -1;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--fd") {
+            fd = std::stoi(argv[i + 1]);
+        }
+    }
+    if (fd == -1) {
+        std::cerr << "usage: crew-worker --fd <socket>" << std::endl;
+        return 2;
+    }
+    return crew::serveWorker(fd);
+}
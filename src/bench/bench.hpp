@@ -0,0 +1,58 @@
+/**
+ * Minimal benchmark registry for crew-bench
+ */
+#ifndef CREW_BENCH_BENCH_HPP
+#define CREW_BENCH_BENCH_HPP
+
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+
+namespace crew::bench {
+
+/** Register a benchmark to be run by crew-bench, returns true so it can initialize a static */
+bool registerBenchmark(std::string name, std::function<void()> run);
+
+/** Report a single measured value of the benchmark currently running */
+void report(std::string_view metric, double value, std::string_view unit);
+
+class Stopwatch {
+public:
+    Stopwatch() :
+        m_start(std::chrono::steady_clock::now()) {}
+
+    double seconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+/** Stream buffer discarding everything written to it, so only the transfer is measured */
+class NullBuffer : public std::streambuf {
+protected:
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+    int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+};
+
+/** Prevent the optimizer from discarding a computed value */
+template <typename T>
+void keep(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+} // namespace crew::bench
+
+#define CREW_BENCHMARK(name)                                                                    \
+    static void bench_##name();                                                                 \
+    [[maybe_unused]] static const bool s_##name##Registered = ::crew::bench::registerBenchmark( \
+            #name, bench_##name);                                                               \
+    static void bench_##name()
+
+#endif
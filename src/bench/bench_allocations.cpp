@@ -0,0 +1,78 @@
+#include "bench.hpp"
+
+#include <common/allocation_tracker.hpp>
+#include <common/command.hpp>
+#include <common/profiler.hpp>
+#include <terminal/encoder.hpp>
+#include <terminal/terminal.hpp>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace {
+constexpr int kFrames = 1000;
+constexpr int kCols = 120;
+constexpr int kRows = 40;
+
+/** Report the allocations counted per frame for every subsystem tagged since `before` */
+void reportPerFrame(const crew::AllocationTracker::Snapshot& before)
+{
+    for (const auto& usage : crew::AllocationTracker::snapshot().since(before)) {
+        crew::bench::report(usage.subsystem, static_cast<double>(usage.allocations) / kFrames, "allocs/frame");
+        crew::bench::report(usage.subsystem + "_bytes", static_cast<double>(usage.bytes) / kFrames, "bytes/frame");
+    }
+}
+} // namespace
+
+/** Allocations made to wrap and draw a full screen of output, as on a resize */
+CREW_BENCHMARK(allocations_render_frame)
+{
+    std::string content;
+    for (int i = 0; i < 200; ++i) {
+        content += fmt::format("[{}/200] Building CXX object src/lib/common/CMakeFiles/crew-common.dir/file{}.cpp.o\n", i, i);
+    }
+    crew::TerminalEncoder encoder({kCols, kRows});
+
+    crew::AllocationTracker::setEnabled(true);
+    const auto before = crew::AllocationTracker::snapshot();
+    for (int frame = 0; frame < kFrames; ++frame) {
+        std::vector<std::string> rows;
+        {
+            crew::Profiler::Region region("wrap");
+            rows = crew::toRows(content, kCols - frame % 2); // alternate widths, as a resize would
+        }
+        crew::Profiler::Region region("render");
+        encoder.reset({kCols, kRows});
+        for (int row = 0; row < kRows && row < std::ssize(rows); ++row) {
+            encoder.moveTo(row, 0);
+            encoder.write(rows[rows.size() - kRows + row]);
+            encoder.clearToEndOfLine();
+        }
+        crew::bench::keep(encoder.take());
+    }
+    crew::AllocationTracker::setEnabled(false);
+    reportPerFrame(before);
+}
+
+/** Allocations made to build a typical command, before anything is spawned */
+CREW_BENCHMARK(allocations_command_build)
+{
+    std::stringstream sink;
+
+    crew::AllocationTracker::setEnabled(true);
+    const auto before = crew::AllocationTracker::snapshot();
+    for (int frame = 0; frame < kFrames; ++frame) {
+        crew::Profiler::Region region("command");
+        auto command = crew::Command("cc", "-c", "-O2", "-o", "out.o", "in.c")
+                               .setEnv("LANG", "C")
+                               .setOut(sink)
+                               .setErr(sink)
+                               .onError(crew::OnError::Return);
+        crew::bench::keep(command);
+    }
+    crew::AllocationTracker::setEnabled(false);
+    reportPerFrame(before);
+}
@@ -0,0 +1,123 @@
+#include "bench.hpp"
+
+#include <common/command.hpp>
+#include <common/command_spec.hpp>
+#include <common/filter.hpp>
+#include <common/process_backend.hpp>
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+/** Build commands into a queue, then submit each one to a backend running it without a process */
+CREW_BENCHMARK(command_build_submit_1m)
+{
+    constexpr size_t kCommands = 1'000'000;
+    crew::bench::NullBuffer nullBuffer;
+    std::ostream sink(&nullBuffer);
+    crew::SimulatedBackend backend;
+    backend.addProgram("cc", {});
+
+    std::vector<crew::Command> queue;
+    queue.reserve(kCommands);
+
+    crew::bench::Stopwatch time;
+    for (size_t i = 0; i < kCommands; ++i) {
+        // built with the rvalue builder chain and moved into the queue, as a pool would
+        queue.push_back(crew::Command("cc", "-c", "-O2", "-o", "out.o", "in.c")
+                                .setEnv("LANG", "C")
+                                .setCurrentDir(std::nullopt)
+                                .setOut(sink)
+                                .setErr(sink)
+                                .setBackend(&backend)
+                                .onError(crew::OnError::Return));
+    }
+    const double built = time.seconds();
+
+    crew::bench::Stopwatch submitTime;
+    for (auto& command : queue) {
+        crew::bench::keep(command.tryRun());
+    }
+    const double submitted = submitTime.seconds();
+
+    crew::bench::report("per_command", built * 1e9 / kCommands, "ns");
+    crew::bench::report("per_submit", submitted * 1e9 / kCommands, "ns");
+    crew::bench::report("children", static_cast<double>(backend.stats().children), "commands");
+    crew::bench::report("sizeof", sizeof(crew::Command), "bytes");
+}
+
+CREW_BENCHMARK(command_spec_build_1m)
+{
+    using Compile = crew::CommandSpec<"cc", crew::Lit<"-c">, crew::Lit<"-O2">, crew::Lit<"-o">, crew::Param<"file">, crew::Param<"file">>;
+    constexpr size_t kCommands = 1'000'000;
+    std::stringstream sink;
+
+    std::vector<crew::Command> queue;
+    queue.reserve(kCommands);
+
+    crew::bench::Stopwatch time;
+    for (size_t i = 0; i < kCommands; ++i) {
+        queue.push_back(Compile::make("out.o", "in.c")
+                                .setEnv("LANG", "C")
+                                .setOut(sink)
+                                .setErr(sink)
+                                .onError(crew::OnError::Return));
+    }
+    const double seconds = time.seconds();
+    crew::bench::keep(queue);
+
+    crew::bench::report("per_command", seconds * 1e9 / kCommands, "ns");
+}
+
+CREW_BENCHMARK(command_run_pty)
+{
+    constexpr size_t kRuns = 200;
+    std::stringstream sink;
+
+    crew::bench::Stopwatch time;
+    for (size_t i = 0; i < kRuns; ++i) {
+        crew::Command("true").setOut(sink).run(crew::RunMode::BlockPty);
+    }
+    crew::bench::report("per_run", time.seconds() * 1e6 / kRuns, "us");
+}
+
+/**
+ * A batch as a build runs it: real commands fanned out over threads, each one's output
+ * compacted and filtered down to its warnings and last lines. Also the PGO training
+ * workload for the command engine and filter pipeline, see data/pgo/pgo.sh.
+ */
+CREW_BENCHMARK(batch_fanout)
+{
+    constexpr size_t kCommands = 256;
+    constexpr size_t kThreads = 8;
+    const std::string script = "for i in $(seq 1 200); do printf '\\r[%d/200] Building CXX object file%d.o' $i $i; done;"
+                               "echo; echo 'file.cpp:12: warning: unused variable' >&2; seq 1 500";
+
+    std::atomic<size_t> next{};
+    std::atomic<size_t> failed{};
+    crew::bench::Stopwatch time;
+    {
+        std::vector<std::jthread> threads;
+        for (size_t t = 0; t < kThreads; ++t) {
+            threads.emplace_back([&] {
+                crew::bench::NullBuffer nullBuffer;
+                std::ostream sink(&nullBuffer);
+                for (size_t i = next++; i < kCommands; i = next++) {
+                    crew::FilterPipeline out(sink);
+                    out.compactProgress().tail(20);
+                    crew::FilterPipeline err(sink);
+                    err.grep("warning:");
+                    auto result = crew::Command("sh", "-c", script).setOut(out).setErr(err).onError(crew::OnError::Return).tryRun();
+                    out.finish();
+                    err.finish();
+                    failed += !result || *result != 0 ? 1 : 0;
+                }
+            });
+        }
+    }
+    crew::bench::report("per_command", time.seconds() * 1e6 / kCommands, "us");
+    crew::bench::report("failed", static_cast<double>(failed), "commands");
+}
@@ -0,0 +1,47 @@
+#include "bench.hpp"
+
+#include <common/compress.hpp>
+
+#include <fmt/format.h>
+
+namespace {
+/** Synthesize output resembling a chatty build tool */
+std::string buildLog(size_t bytes)
+{
+    std::string log;
+    log.reserve(bytes + 256);
+    for (size_t i = 0; log.size() < bytes; ++i) {
+        log += fmt::format("[{:3d}%] Building CXX object src/lib/module{}/CMakeFiles/target.dir/source_{}.cpp.o\n",
+                (i / 97) % 101, i % 13, i);
+        if (i % 17 == 0) {
+            log += fmt::format("src/lib/module{}/source_{}.cpp:{}:{}: warning: unused variable 'tmp{}' [-Wunused-variable]\n",
+                    i % 13, i, i % 400, i % 80, i % 7);
+        }
+    }
+    return log;
+}
+} // namespace
+
+CREW_BENCHMARK(compress_build_log)
+{
+    const std::string log = buildLog(64 * 1024 * 1024);
+
+    crew::CompressedBuffer buffer;
+    crew::bench::Stopwatch compressTime;
+    for (size_t pos = 0; pos < log.size(); pos += 4096) { // chunks as delivered by pumpFdToStream
+        buffer.append(std::string_view(log).substr(pos, 4096));
+    }
+    buffer.seal();
+    const double compressSeconds = compressTime.seconds();
+
+    crew::bench::Stopwatch decompressTime;
+    auto restored = buffer.str();
+    const double decompressSeconds = decompressTime.seconds();
+    crew::bench::keep(restored);
+
+    const double mib = static_cast<double>(log.size()) / (1024 * 1024);
+    crew::bench::report("ratio", static_cast<double>(log.size()) / buffer.compressedSize(), "x");
+    crew::bench::report("compress", mib / compressSeconds, "MiB/s");
+    crew::bench::report("decompress", mib / decompressSeconds, "MiB/s");
+    crew::bench::report("roundtrip_ok", restored.has_value() && *restored == log ? 1 : 0, "bool");
+}
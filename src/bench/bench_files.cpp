@@ -0,0 +1,77 @@
+#include "bench.hpp"
+
+#include <common/command.hpp>
+#include <common/file_ops.hpp>
+
+#include <fstream>
+#include <sstream>
+
+#include <fmt/format.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr int kDirs = 16;
+constexpr int kFilesPerDir = 32;
+
+/** Tree of small files, as found in a build or install directory */
+fs::path makeTree(const fs::path& root)
+{
+    const std::string content(4096, 'x');
+    for (int dir = 0; dir < kDirs; ++dir) {
+        fs::create_directories(root / fmt::format("d{}", dir));
+        for (int file = 0; file < kFilesPerDir; ++file) {
+            std::ofstream(root / fmt::format("d{}", dir) / fmt::format("f{}", file)) << content;
+        }
+    }
+    return root;
+}
+} // namespace
+
+/** Copy each file of a tree one at a time, in process and by spawning cp */
+CREW_BENCHMARK(files_copy_each)
+{
+    const fs::path base = fs::temp_directory_path() / fmt::format("crew-bench-files-{}", ::getpid());
+    const fs::path src = makeTree(base / "src");
+    fs::create_directories(base / "builtin");
+    fs::create_directories(base / "spawned");
+    std::stringstream sink;
+
+    crew::bench::Stopwatch builtin;
+    for (const auto& entry : fs::recursive_directory_iterator(src)) {
+        if (entry.is_regular_file()) {
+            crew::copyFile(entry.path(), base / "builtin" / entry.path().filename());
+        }
+    }
+    const double builtinSeconds = builtin.seconds();
+
+    crew::bench::Stopwatch spawned;
+    for (const auto& entry : fs::recursive_directory_iterator(src)) {
+        if (entry.is_regular_file()) {
+            crew::Command("cp", entry.path().string(), (base / "spawned").string()).setOut(sink).setErr(sink).run();
+        }
+    }
+    const double spawnedSeconds = spawned.seconds();
+
+    constexpr double kFiles = kDirs * kFilesPerDir;
+    crew::bench::report("builtin", builtinSeconds * 1e6 / kFiles, "us/file");
+    crew::bench::report("spawned", spawnedSeconds * 1e6 / kFiles, "us/file");
+    fs::remove_all(base);
+}
+
+/** Copy then remove a whole tree with the parallel builtins */
+CREW_BENCHMARK(files_tree)
+{
+    const fs::path base = fs::temp_directory_path() / fmt::format("crew-bench-tree-{}", ::getpid());
+    const fs::path src = makeTree(base / "src");
+
+    crew::bench::Stopwatch copy;
+    crew::copyTree(src, base / "dst");
+    crew::bench::report("copy", copy.seconds() * 1e3, "ms");
+
+    crew::bench::Stopwatch remove;
+    crew::removeTree(base / "dst");
+    crew::bench::report("remove", remove.seconds() * 1e3, "ms");
+    fs::remove_all(base);
+}
@@ -0,0 +1,44 @@
+#include "bench.hpp"
+
+#include <common/file_hash.hpp>
+
+#include <fstream>
+
+#include <fmt/format.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+CREW_BENCHMARK(hash64_throughput)
+{
+    const std::string data(64 * 1024 * 1024, 'x');
+
+    crew::bench::Stopwatch time;
+    crew::bench::keep(crew::hash64(data));
+    crew::bench::report("throughput", data.size() / time.seconds() / 1e9, "GB/s");
+}
+
+/** Hash a tree of files cold, then again with every file served from the cache */
+CREW_BENCHMARK(hash_tree)
+{
+    const fs::path root = fs::temp_directory_path() / fmt::format("crew-bench-hash-{}", ::getpid());
+    const std::string content(256 * 1024, 'x');
+    for (int dir = 0; dir < 8; ++dir) {
+        fs::create_directories(root / fmt::format("d{}", dir));
+        for (int file = 0; file < 32; ++file) {
+            const fs::path path = root / fmt::format("d{}", dir) / fmt::format("f{}", file);
+            std::ofstream(path) << content;
+            fs::last_write_time(path, fs::file_time_type::clock::now() - std::chrono::hours(1));
+        }
+    }
+
+    crew::FileHasher hasher;
+    crew::bench::Stopwatch cold;
+    crew::bench::keep(hasher.hashTree(root));
+    crew::bench::report("cold", cold.seconds() * 1e3, "ms");
+
+    crew::bench::Stopwatch cached;
+    crew::bench::keep(hasher.hashTree(root));
+    crew::bench::report("cached", cached.seconds() * 1e3, "ms");
+    fs::remove_all(root);
+}
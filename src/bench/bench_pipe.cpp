@@ -0,0 +1,26 @@
+#include "bench.hpp"
+
+#include <common/command.hpp>
+
+namespace {
+double transferSeconds(bool highVolume)
+{
+    crew::bench::NullBuffer nullBuffer;
+    std::ostream sink(&nullBuffer);
+    crew::bench::Stopwatch time;
+    auto result = crew::Command("head", "-c", "1G", "/dev/zero")
+                          .setOut(sink)
+                          .setHighVolume(highVolume)
+                          .tryRun();
+    crew::bench::keep(result);
+    return time.seconds();
+}
+} // namespace
+
+CREW_BENCHMARK(pipe_1g_output)
+{
+    const double defaultSeconds = transferSeconds(false);
+    const double highVolumeSeconds = transferSeconds(true);
+    crew::bench::report("default", 1024 / defaultSeconds, "MiB/s");
+    crew::bench::report("high_volume", 1024 / highVolumeSeconds, "MiB/s");
+}
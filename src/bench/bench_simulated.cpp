@@ -0,0 +1,192 @@
+#include "bench.hpp"
+
+#include <common/filter.hpp>
+#include <common/process_backend.hpp>
+#include <common/runtime_history.hpp>
+#include <terminal/encoder.hpp>
+#include <terminal/terminal.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace {
+constexpr size_t kChildren = 10'000;
+constexpr size_t kThreads = 8;
+
+/** A compile step: a short pause then a few lines of warnings, as most build steps are */
+crew::SimulatedProcess compileStep()
+{
+    return {.spawnLatency = std::chrono::milliseconds(2),
+        .outputBytes = 2048,
+        .errorBytes = 160,
+        .bytesPerSecond = 1e6,
+        .jitter = 0.5};
+}
+
+/** Run `kChildren` simulated commands from `kThreads` threads, `handle` receives each one's output */
+template <typename Handle>
+double fanOut(crew::SimulatedBackend& backend, Handle handle)
+{
+    std::atomic<size_t> next{};
+    crew::bench::Stopwatch time;
+    {
+        auto starting = backend.clock().participate();
+        std::vector<std::jthread> threads;
+        for (size_t t = 0; t < kThreads; ++t) {
+            threads.emplace_back([&, participant = backend.clock().participate()] {
+                for (size_t i = next++; i < kChildren; i = next++) {
+                    std::ostringstream out;
+                    auto result = crew::Command("cc", "-c", fmt::format("file{}.c", i))
+                                          .setBackend(&backend)
+                                          .setOut(out)
+                                          .setErr(out)
+                                          .onError(crew::OnError::Return)
+                                          .tryRun();
+                    crew::bench::keep(result);
+                    handle(out.str());
+                }
+            });
+        }
+        starting.leave();
+    }
+    return time.seconds();
+}
+
+struct Job {
+    std::string program;
+    std::string file;
+};
+
+/** A build: compile steps of widely varying length, then a few long link steps */
+std::vector<Job> buildJobs(crew::SimulatedBackend& backend)
+{
+    backend.addProgram("cc", {.spawnLatency = std::chrono::milliseconds(20), .outputBytes = 512, .jitter = 0.9});
+    backend.addProgram("ld", {.spawnLatency = std::chrono::seconds(1), .outputBytes = 512});
+
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < 400; ++i) {
+        jobs.push_back({"cc", fmt::format("file{}.c", i)});
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        jobs.push_back({"ld", fmt::format("tool{}", i)});
+    }
+    return jobs;
+}
+
+/**
+ * Run `jobs` on `kThreads` slots, each taking the next job in order once idle, and record
+ * their runtimes into `history`. Returns the virtual time until the last one finished.
+ */
+std::chrono::nanoseconds schedule(crew::SimulatedBackend& backend, const std::vector<Job>& jobs, crew::RuntimeHistory& history)
+{
+    std::atomic<size_t> next{};
+    std::mutex mutex;
+    {
+        auto starting = backend.clock().participate();
+        std::vector<std::jthread> threads;
+        for (size_t t = 0; t < kThreads; ++t) {
+            threads.emplace_back([&, participant = backend.clock().participate()] {
+                crew::bench::NullBuffer nullBuffer;
+                std::ostream sink(&nullBuffer);
+                for (size_t i = next++; i < jobs.size(); i = next++) {
+                    crew::Command command(jobs[i].program, jobs[i].file);
+                    command.setBackend(&backend).setOut(sink).setErr(sink).onError(crew::OnError::Return);
+                    const auto start = backend.clock().now();
+                    crew::bench::keep(command.tryRun());
+                    std::lock_guard lock(mutex);
+                    history.record(crew::RuntimeHistory::key(command), backend.clock().now() - start);
+                }
+            });
+        }
+        starting.leave();
+    }
+    return backend.stats().elapsed;
+}
+} // namespace
+
+/** Overhead of the command engine and the virtual clock per child, with children taking no real time */
+CREW_BENCHMARK(simulated_fanout_10k)
+{
+    crew::SimulatedBackend backend;
+    backend.addProgram("cc", compileStep());
+
+    crew::bench::NullBuffer nullBuffer;
+    std::ostream sink(&nullBuffer);
+    const double seconds = fanOut(backend, [&sink](const std::string& output) {
+        crew::FilterPipeline errors(sink);
+        errors.grep("cc").tail(5);
+        errors << output;
+        errors.finish();
+    });
+
+    const auto stats = backend.stats();
+    crew::bench::report("per_child", seconds * 1e9 / kChildren, "ns");
+    crew::bench::report("output", static_cast<double>(stats.bytes) / seconds / (1024 * 1024), "MiB/s");
+    crew::bench::report("virtual_time", std::chrono::duration<double>(stats.virtualTime).count(), "s");
+    crew::bench::report("makespan", std::chrono::duration<double>(stats.elapsed).count(), "s");
+    crew::bench::report("max_concurrent", static_cast<double>(stats.maxConcurrent), "children");
+}
+
+/** Wrapping and drawing the output of every child into a scrolling output region */
+CREW_BENCHMARK(simulated_render_10k)
+{
+    constexpr int kCols = 120;
+    constexpr int kRows = 40;
+
+    crew::SimulatedBackend backend;
+    backend.addProgram("cc", compileStep());
+
+    std::mutex mutex;
+    crew::TerminalEncoder encoder({kCols, kRows});
+    encoder.setScrollRegion(0, kRows - 3);
+    size_t sent = 0;
+    const double seconds = fanOut(backend, [&](const std::string& output) {
+        const auto rows = crew::toRows(output, kCols);
+        std::lock_guard lock(mutex);
+        for (const auto& row : rows) {
+            encoder.moveTo(kRows - 3, 0);
+            encoder.newLine();
+            encoder.write(row);
+        }
+        sent += encoder.take().size();
+    });
+
+    crew::bench::report("per_child", seconds * 1e9 / kChildren, "ns");
+    crew::bench::report("sent", static_cast<double>(sent) / kChildren, "bytes/child");
+}
+
+/**
+ * Total virtual time of a build on the simulated clock, run in submission order and then
+ * longest expected first as WorkerPool orders jobs with a RuntimeHistory
+ */
+CREW_BENCHMARK(simulated_schedule_history)
+{
+    crew::RuntimeHistory history;
+    crew::bench::Stopwatch time;
+
+    crew::SimulatedBackend fifo;
+    auto jobs = buildJobs(fifo);
+    const auto inOrder = schedule(fifo, jobs, history);
+
+    crew::SimulatedBackend ordered;
+    jobs = buildJobs(ordered);
+    auto expected = [&](const Job& job) {
+        return history.expected(crew::RuntimeHistory::key(crew::Command(job.program, job.file)))
+                .value_or(crew::RuntimeHistory::Seconds::max());
+    };
+    std::ranges::stable_sort(jobs, std::greater{}, expected);
+    const auto longestFirst = schedule(ordered, jobs, history);
+
+    const auto stats = ordered.stats();
+    crew::bench::report("makespan_in_order", std::chrono::duration<double>(inOrder).count(), "s");
+    crew::bench::report("makespan_longest_first", std::chrono::duration<double>(longestFirst).count(), "s");
+    crew::bench::report("lower_bound", std::chrono::duration<double>(stats.virtualTime).count() / kThreads, "s");
+    crew::bench::report("max_concurrent", static_cast<double>(stats.maxConcurrent), "children");
+    crew::bench::report("per_child", time.seconds() * 1e9 / static_cast<double>(2 * jobs.size()), "ns");
+}
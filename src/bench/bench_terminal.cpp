@@ -0,0 +1,133 @@
+#include "bench.hpp"
+
+#include <terminal/encoder.hpp>
+
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace {
+constexpr int kRows = 40;
+constexpr int kCols = 120;
+constexpr int kRegion = kRows - 2; // output rows above a two line prompt
+
+/** Output rows as produced by a typical build, with some separator rules */
+std::vector<std::string> sampleRows(size_t count)
+{
+    std::vector<std::string> rows;
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 10 == 0) {
+            rows.push_back(std::string(kCols, '-'));
+        } else {
+            rows.push_back(fmt::format("[{}/{}] Building CXX object src/lib/common/CMakeFiles/crew-common.dir/file{}.cpp.o", i, count, i));
+        }
+    }
+    return rows;
+}
+
+/** A frame drawn the straightforward way: absolute position and erase for every row touched */
+void naiveRow(std::string& out, int row, std::string_view text)
+{
+    out.append(fmt::format("\x1b[{};1H", row + 1));
+    out.append(text);
+    out.append("\x1b[K");
+}
+} // namespace
+
+/** Bytes sent for a full repaint of the output region followed by the prompt */
+CREW_BENCHMARK(terminal_full_repaint)
+{
+    const auto rows = sampleRows(kRegion);
+
+    std::string naive = "\x1b[?25l";
+    for (int row = 0; row < kRegion; ++row) {
+        naiveRow(naive, row, rows[row]);
+    }
+    naiveRow(naive, kRegion, "make -j8");
+    naiveRow(naive, kRegion + 1, "crew interpreter - ctrl-q to quit");
+    naive.append("\x1b[39;9H\x1b[?25h");
+
+    crew::TerminalEncoder encoder({kCols, kRows});
+    encoder.setCursorVisible(false);
+    for (int row = 0; row < kRegion; ++row) {
+        encoder.moveTo(row, 0);
+        encoder.write(rows[row]);
+        encoder.clearToEndOfLine();
+    }
+    encoder.moveTo(kRegion, 0);
+    encoder.write("make -j8");
+    encoder.clearToEndOfLine();
+    encoder.moveTo(kRegion + 1, 0);
+    encoder.write("crew interpreter - ctrl-q to quit");
+    encoder.clearToEndOfLine();
+    encoder.moveTo(kRegion, 8);
+    encoder.setCursorVisible(true);
+    const std::string encoded = encoder.take();
+
+    crew::bench::report("naive", naive.size(), "bytes");
+    crew::bench::report("encoded", encoded.size(), "bytes");
+}
+
+/**
+ * Bytes sent for an interactive session: a command typed one key per frame, then its
+ * output appended to the scrolling region
+ */
+CREW_BENCHMARK(terminal_session)
+{
+    constexpr int kCommands = 200;
+    constexpr std::string_view kCommand = "make -C build -j8 all";
+    const auto output = sampleRows(30);
+
+    crew::TerminalEncoder encoder({kCols, kRows});
+    encoder.setScrollRegion(0, kRegion - 1);
+    for (int row = 0; row < kRows; ++row) { // start from a blank screen
+        encoder.moveTo(row, 0);
+        encoder.clearToEndOfLine();
+    }
+    encoder.take();
+
+    size_t naive = 0;
+    size_t encoded = 0;
+    std::string frame;
+    for (int command = 0; command < kCommands; ++command) {
+        for (size_t typed = 1; typed <= kCommand.size(); ++typed) {
+            frame = "\x1b[?25l";
+            naiveRow(frame, kRegion, kCommand.substr(0, typed));
+            naiveRow(frame, kRegion + 1, "crew interpreter - ctrl-q to quit");
+            frame.append(fmt::format("\x1b[{};{}H\x1b[?25h", kRegion + 1, typed + 1));
+            naive += frame.size();
+
+            // only the new key needs sending, the cursor is already after the previous one
+            encoder.moveTo(kRegion, static_cast<int>(typed - 1));
+            encoder.write(kCommand.substr(typed - 1, 1));
+            encoder.clearToEndOfLine();
+            encoded += encoder.take().size();
+        }
+
+        frame = "\x1b[?25l";
+        for (const auto& row : output) {
+            naiveRow(frame, kRegion - 1, "");
+            frame.append("\r\n");
+            frame.append(row);
+        }
+        naiveRow(frame, kRegion, "");
+        naiveRow(frame, kRegion + 1, "crew interpreter - ctrl-q to quit");
+        frame.append(fmt::format("\x1b[{};1H\x1b[?25h", kRegion + 1));
+        naive += frame.size();
+
+        encoder.setCursorVisible(false);
+        for (const auto& row : output) {
+            encoder.moveTo(kRegion - 1, 0);
+            encoder.newLine();
+            encoder.write(row);
+        }
+        encoder.moveTo(kRegion, 0);
+        encoder.clearToEndOfLine();
+        encoder.setCursorVisible(true);
+        encoded += encoder.take().size();
+    }
+
+    crew::bench::report("naive", static_cast<double>(naive) / kCommands, "bytes/command");
+    crew::bench::report("encoded", static_cast<double>(encoded) / kCommands, "bytes/command");
+}
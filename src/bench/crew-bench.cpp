@@ -0,0 +1,48 @@
+#include "bench.hpp"
+
+#include <map>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace crew::bench {
+namespace {
+std::map<std::string, std::function<void()>>& registry()
+{
+    static std::map<std::string, std::function<void()>> s_registry;
+    return s_registry;
+}
+
+std::string s_current;
+} // namespace
+
+bool registerBenchmark(std::string name, std::function<void()> run)
+{
+    registry().emplace(std::move(name), std::move(run));
+    return true;
+}
+
+void report(std::string_view metric, double value, std::string_view unit)
+{
+    fmt::print("{:s}/{:s}: {:.3f} {:s}\n", s_current, metric, value, unit);
+}
+} // namespace crew::bench
+
+/** Usage: crew-bench [filter...], runs every benchmark whose name contains one of the filters */
+int main(int argc, char** argv)
+{
+    std::vector<std::string> filters(argv + 1, argv + argc);
+
+    for (const auto& [name, run] : crew::bench::registry()) {
+        bool selected = filters.empty();
+        for (const auto& f : filters) {
+            selected = selected || name.find(f) != std::string::npos;
+        }
+        if (!selected) {
+            continue;
+        }
+        crew::bench::s_current = name;
+        run();
+    }
+    return 0;
+}
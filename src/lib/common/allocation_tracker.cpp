@@ -0,0 +1,170 @@
+#include <common/allocation_tracker.hpp>
+#include <common/interpreter.hpp>
+#include <common/profiler.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+namespace crew {
+namespace {
+struct Counter {
+    std::atomic<const char*> name{}; // claimed by the first region allocating, slot 0 is "other"
+    std::atomic<uint64_t> allocations{};
+    std::atomic<uint64_t> bytes{};
+};
+
+constinit std::atomic<bool> s_enabled{};
+constinit std::array<Counter, AllocationTracker::kMaxSubsystems> s_counters{};
+
+/** Counter of the region `name`, claiming a free slot for a region seen for the first time */
+Counter& counterFor(const char* name)
+{
+    if (name == nullptr) {
+        return s_counters[0];
+    }
+    for (size_t i = 1; i < s_counters.size(); ++i) {
+        const char* claimed = s_counters[i].name.load(std::memory_order_acquire);
+        if (claimed == nullptr && s_counters[i].name.compare_exchange_strong(claimed, name)) {
+            return s_counters[i];
+        }
+        if (claimed == name) {
+            return s_counters[i];
+        }
+    }
+    return s_counters[0];
+}
+
+// must not allocate, it runs inside operator new
+void* allocate(size_t size) noexcept
+{
+    if (s_enabled.load(std::memory_order_relaxed)) {
+        Counter& counter = counterFor(Profiler::Region::current());
+        counter.allocations.fetch_add(1, std::memory_order_relaxed);
+        counter.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* allocateOrThrow(size_t size)
+{
+    while (true) {
+        if (void* allocated = allocate(size)) {
+            return allocated;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+} // namespace
+
+std::vector<AllocationTracker::Usage> AllocationTracker::Snapshot::since(const Snapshot& earlier) const
+{
+    // the same name may have claimed several slots when it is not the same literal
+    std::vector<Usage> result;
+    for (size_t i = 0; i < m_counts.size(); ++i) {
+        const Counts& counts = m_counts[i];
+        if (counts.allocations == earlier.m_counts[i].allocations) {
+            continue;
+        }
+        const char* name = i == 0 ? "other" : s_counters[i].name.load(std::memory_order_acquire);
+        auto it = std::find_if(result.begin(), result.end(), [name](const Usage& usage) {
+            return usage.subsystem == name;
+        });
+        if (it == result.end()) {
+            it = result.insert(result.end(), Usage{name});
+        }
+        it->allocations += counts.allocations - earlier.m_counts[i].allocations;
+        it->bytes += counts.bytes - earlier.m_counts[i].bytes;
+    }
+    std::sort(result.begin(), result.end(), [](const Usage& a, const Usage& b) {
+        return a.subsystem < b.subsystem;
+    });
+    return result;
+}
+
+void AllocationTracker::setEnabled(bool enabled)
+{
+    s_enabled = enabled;
+}
+
+bool AllocationTracker::enabled()
+{
+    return s_enabled;
+}
+
+AllocationTracker::Snapshot AllocationTracker::snapshot()
+{
+    Snapshot result;
+    for (size_t i = 0; i < s_counters.size(); ++i) {
+        result.m_counts[i] = {s_counters[i].allocations.load(std::memory_order_relaxed),
+            s_counters[i].bytes.load(std::memory_order_relaxed)};
+    }
+    return result;
+}
+
+std::string AllocationTracker::format(const std::vector<Usage>& usage)
+{
+    std::string result = fmt::format("{:<16} {:>12} {:>14}\n", "subsystem", "allocations", "bytes");
+    for (const auto& [subsystem, allocations, bytes] : usage) {
+        result += fmt::format("{:<16} {:>12} {:>14}\n", subsystem, allocations, bytes);
+    }
+    return result;
+}
+
+Result<> addStatsBuiltins(Vm& vm)
+{
+    vm.addParam("stats-action", [](const std::string& s) {
+        return s == "on" || s == "off" || s == "reset";
+    });
+
+    auto baseline = std::make_shared<AllocationTracker::Snapshot>();
+    return vm.addBuiltin("stats", {"stats-action"}, [baseline](const std::vector<std::string>& args, std::ostream& out) -> Result<int> {
+        if (args.empty()) {
+            if (!AllocationTracker::enabled()) {
+                out << "allocation tracking is off, enable it with: stats on\n";
+            }
+            out << AllocationTracker::format(AllocationTracker::snapshot().since(*baseline));
+            return 0;
+        }
+        if (args.front() == "on" || args.front() == "off") {
+            AllocationTracker::setEnabled(args.front() == "on");
+            return 0;
+        }
+        if (args.front() == "reset") {
+            *baseline = AllocationTracker::snapshot();
+            return 0;
+        }
+        return makeError("stats: unknown action {}, expected on, off or reset", args.front());
+    });
+}
+
+} // namespace crew
+
+// replacements of the global allocation functions, the default operator delete frees
+// with free() so it pairs with these
+void* operator new(size_t size)
+{
+    return crew::allocateOrThrow(size);
+}
+
+void* operator new[](size_t size)
+{
+    return crew::allocateOrThrow(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return crew::allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return crew::allocate(size);
+}
@@ -1,5 +1,11 @@
 #include <common/command.hpp>
+#include <common/logger.hpp>
+#include <common/process_backend.hpp>
+#include <common/profiler.hpp>
+#include <common/pty_pool.hpp>
+#include <common/single_flight.hpp>
 
+#include <array>
 #include <cstring>
 
 #include <fcntl.h>
@@ -8,58 +14,162 @@
 #else
 #include <pty.h>
 #endif
+#include <poll.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
 #include <utmp.h>
 
+extern char** environ;
+
 namespace fs = std::filesystem;
 
 namespace crew {
 namespace {
+/** Wait for a child process to exit, leaving it to be reaped */
+Result<> waitExited(int pid)
+{
+    siginfo_t info{};
+    while (::waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOWAIT) == -1) {
+        if (errno != EINTR) {
+            return makeError("waitid failed: {}", std::strerror(errno));
+        }
+    }
+    return {};
+}
+
 /** Wait for a child process to exit and return its exit code */
-int childExit(int pid)
+Result<int> childExit(int pid)
 {
     int status{};
-    if (::waitpid(pid, &status, 0) == -1) {
-        fatal("waitpid failed: {}", std::strerror(errno));
+    while (::waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            return makeError("waitpid failed: {}", std::strerror(errno));
+        }
     }
 
     if (!WIFEXITED(status)) {
-        fatal("child failed to exit normally");
+        return makeError("child failed to exit normally");
     }
 
     return WEXITSTATUS(status);
 }
 
+// read sizes double each time a read fills the buffer, i.e. the child is producing
+// faster than we drain, and never shrink for the lifetime of the thread
+constexpr size_t kMinReadSize = 4 * 1024;
+constexpr size_t kMaxReadSize = 1024 * 1024;
+
+// pipe capacity requested for high volume commands, the default is 64 KiB on linux
+constexpr int kHighVolumePipeSize = 1024 * 1024;
+
 /**
- * @param fd - fd to read data from
- * @param dest - stream to write data to
- *
- * @fatal - error occurs and errno is set to neither EINTR, EIO
+ * Read one chunk from `fd` into `dest`, doubling the thread's read buffer whenever a
+ * read fills it. Returns false once the fd is exhausted (EOF, or EIO when the child side
+ * of a pty closed).
  */
-void pumpFdToStream(int fd, std::ostream& dest)
+Result<bool> pumpChunk(int fd, std::ostream& dest)
 {
-    thread_local char buffer[4096];
+    thread_local std::vector<char> buffer(kMinReadSize);
 
     while (1) {
-        ssize_t count = ::read(fd, buffer, sizeof(buffer));
+        ssize_t count = ::read(fd, buffer.data(), buffer.size());
         if (count == -1) {
             if (errno == EINTR) {
                 continue;
             } else if (errno == EIO) { // child side closed
-                break;
+                return false;
             } else {
-                fatal("read() failed: ", std::strerror(errno));
+                return makeError("read() failed: {}", std::strerror(errno));
             }
         } else if (count == 0) {
+            return false;
+        }
+
+        dest << std::string_view(buffer.data(), count);
+        if (static_cast<size_t>(count) == buffer.size() && buffer.size() < kMaxReadSize) {
+            buffer.resize(buffer.size() * 2);
+        }
+        return true;
+    }
+}
+
+/**
+ * @param fd - fd to read data from
+ * @param dest - stream to write data to
+ *
+ * @error - error occurs and errno is set to neither EINTR, EIO
+ */
+Result<> pumpFdToStream(int fd, std::ostream& dest)
+{
+    while (1) {
+        auto more = pumpChunk(fd, dest);
+        if (!more) {
+            return std::unexpected(more.error());
+        }
+        if (!*more) {
             break;
-        } else {
-            dest << std::string_view(buffer, count);
         }
     }
     dest.flush();
+    return {};
+}
+
+/** Process fd which becomes readable when the process exits, -1 where unsupported */
+int openPidFd([[maybe_unused]] int pid)
+{
+#ifdef SYS_pidfd_open
+    return static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Pump a pooled pty whose slave the parent keeps open, so reading never reports the end
+ * of output. Instead stop once `pidFd` reports the child exited, after draining what it
+ * wrote before exiting.
+ */
+Result<> pumpPtyToStream(int master, int pidFd, std::ostream& dest)
+{
+    std::array<pollfd, 2> fds{{{master, POLLIN, 0}, {pidFd, POLLIN, 0}}};
+    bool exited = false;
+    while (!exited) {
+        if (::poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return makeError("poll() failed: {}", std::strerror(errno));
+        }
+        exited = (fds[1].revents & POLLIN) != 0;
+
+        // once exited, the output is complete and all of it is already queued
+        while ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+            auto more = pumpChunk(master, dest);
+            if (!more) {
+                return std::unexpected(more.error());
+            }
+            if (!*more || !exited) {
+                break;
+            }
+            if (::poll(fds.data(), 1, 0) == -1 && errno != EINTR) {
+                return makeError("poll() failed: {}", std::strerror(errno));
+            }
+        }
+    }
+    dest.flush();
+    return {};
+}
+
+/** Best effort increase of a pipe's capacity, so fast producers block less often */
+void growPipe([[maybe_unused]] int fd)
+{
+#ifdef F_SETPIPE_SZ
+    // fails with EPERM above /proc/sys/fs/pipe-max-size, the default capacity still works
+    ::fcntl(fd, F_SETPIPE_SZ, kHighVolumePipeSize);
+#endif
 }
 
 struct FdPair {
@@ -67,95 +177,183 @@ struct FdPair {
     int exit{};
     int entrance{};
 
-    static FdPair openPipe()
+    static Result<FdPair> openPipe()
     {
         FdPair result{};
         if (::pipe(&result.exit) == -1) {
-            fatal("failed to open pipe");
+            return makeError("failed to open pipe: {}", std::strerror(errno));
         }
         return result;
     }
+
+    void close()
+    {
+        ::close(exit);
+        ::close(entrance);
+    }
 };
 static_assert(sizeof(FdPair) == sizeof(int[2]));
 } // namespace
 
 int Command::run(RunMode mode)
 {
-    // if verbose flag is set, print details about the command being executed
-    if (m_verbose || m_dryRun) {
-        auto& str = std::cerr;
-        str << (m_dryRun ? "DRY: " : "LOG: ") << toString() << "\n";
+    auto result = tryRun(mode);
+    if (!result) {
+        if (m_verbose || m_dryRun) {
+            Logger::shared().flush(); // the command's line goes before the error
+        }
+        fatal("{}", result.error().message);
+    }
+    return *result;
+}
+
+Result<int> Command::tryRun(RunMode mode)
+{
+    Profiler::Region region("command");
+
+    if (m_nulInArgv) {
+        return makeError("command \"{}\" has an argument containing a NUL byte, which cannot be passed to a program", toString());
+    }
+
+    // if verbose flag is set, log details about the command being executed
+    // the logger and its thread only exist in processes that log
+    if ((m_verbose || m_dryRun) && Logger::shared().enabled(LogLevel::Info)) {
+        std::vector<LogField> fields;
         if (m_cd.has_value()) {
-            str << "\t- executing from directory: " << *m_cd << "\n";
+            fields.emplace_back("cwd", m_cd->string());
+        }
+        if (m_environment.has_value()) {
+            fields.emplace_back("environment", m_environment->size());
         }
         if (!m_envOverride.empty()) {
-            str << "\t- overriding "
-                << m_envOverride.size() << " environment variables\n";
+            fields.emplace_back("overrides", m_envOverride.size());
         }
-        str.flush();
+        Logger::shared().log(LogLevel::Info, (m_dryRun ? "DRY: " : "LOG: ") + toString(), fields);
     }
 
     if (m_dryRun) { // for dry run, we just want to know what would have been executed
         return 0;
     }
 
-    int result{};
-    switch (mode) {
-    case RunMode::Block:
-        result = runPipe();
-        break;
-    case RunMode::BlockPty:
-        result = runPty();
-        break;
-    case RunMode::ExecPty:
-        result = execPty();
-        break;
+    Result<int> result{};
+    if (m_singleFlight && mode != RunMode::ExecPty) {
+        auto& flights = SingleFlight::shared();
+        result = flights.run(SingleFlight::identity(*this, mode), outStream(), errStream(),
+                [this, mode](std::ostream& out, std::ostream& err) {
+                    std::ostream* const originalOut = std::exchange(m_out, &out);
+                    std::ostream* const originalErr = std::exchange(m_err, &err);
+                    auto executed = execute(mode);
+                    m_out = originalOut;
+                    m_err = originalErr;
+                    return executed;
+                });
+    } else {
+        result = execute(mode);
     }
 
-    if (result != 0) {
+    // each caller applies its own error policy, even to a shared result
+    if (result.has_value() && *result != 0) {
         switch (m_onError) {
         case OnError::Return:
             break; // return the result
         case OnError::Fatal:
-            fatal("command \"", toString(), "\" failed with non-zero exit status: ", result);
+            return makeError("command \"{}\" failed with non-zero exit status: {}", toString(), *result);
         }
     }
     return result;
 }
 
-int Command::runPipe()
+Result<int> Command::execute(RunMode mode)
 {
+    if (m_backend != nullptr) {
+        return m_backend->run(*this, mode);
+    }
 
+    if (m_environment.has_value()) {
+        // flatten in the parent so the envp is built once and shared by later spawns
+        m_environment->envp();
+    }
+
+    switch (mode) {
+    case RunMode::Block:
+        return runPipe();
+    case RunMode::BlockPty:
+        return runPty();
+    case RunMode::ExecPty:
+        return execPty();
+    }
+    return makeError("unknown run mode");
+}
+
+Result<int> Command::runPipe()
+{
     auto outPipe = FdPair::openPipe();
+    if (!outPipe) {
+        return std::unexpected(outPipe.error());
+    }
     auto errPipe = FdPair::openPipe();
+    if (!errPipe) {
+        outPipe->close();
+        return std::unexpected(errPipe.error());
+    }
+
+    if (m_highVolume) {
+        growPipe(outPipe->exit);
+        growPipe(errPipe->exit);
+    }
 
+    ProcessTree tree(treeOptions());
     int pid = ::fork();
 
     if (pid == -1) { // error
-        fatal("fork() failed");
+        outPipe->close();
+        errPipe->close();
+        return makeError("fork() failed: {}", std::strerror(errno));
     }
     if (pid == 0) { // child
-        while ((::dup2(outPipe.entrance, STDOUT_FILENO) == -1) && (errno == EINTR)) {
+        tree.enterChild();
+        while ((::dup2(outPipe->entrance, STDOUT_FILENO) == -1) && (errno == EINTR)) {
         }
-        while ((::dup2(errPipe.entrance, STDERR_FILENO) == -1) && (errno == EINTR)) {
+        while ((::dup2(errPipe->entrance, STDERR_FILENO) == -1) && (errno == EINTR)) {
+        }
+        ::close(outPipe->exit);
+        ::close(errPipe->exit);
+        // only stdout and stderr may keep the pipes open, not descendants inheriting the originals
+        for (int fd : {outPipe->entrance, errPipe->entrance}) {
+            if (fd > STDERR_FILENO) {
+                ::close(fd);
+            }
         }
-        ::close(outPipe.exit);
-        ::close(errPipe.exit);
 
         replaceProcessImage();
     }
 
     // parent
-    ::close(outPipe.entrance);
-    ::close(errPipe.entrance);
-
-    pumpFdToStream(outPipe.exit, outStream());
-    ::close(outPipe.exit);
-
-    pumpFdToStream(errPipe.exit, errStream());
-    ::close(errPipe.exit);
-
-    return childExit(pid);
+    tree.started(pid);
+    ::close(outPipe->entrance);
+    ::close(errPipe->entrance);
+
+    auto outPumped = pumpFdToStream(outPipe->exit, outStream());
+    ::close(outPipe->exit);
+
+    auto errPumped = pumpFdToStream(errPipe->exit, errStream());
+    ::close(errPipe->exit);
+
+    // the output may end before the child does, which the tree must still cover, and
+    // always reap the child, even if we failed to read its output
+    auto waited = waitExited(pid);
+    tree.release();
+    auto exitCode = treeResult(tree, childExit(pid));
+    if (!waited) {
+        return std::unexpected(waited.error());
+    }
+    if (!outPumped) {
+        return std::unexpected(outPumped.error());
+    }
+    if (!errPumped) {
+        return std::unexpected(errPumped.error());
+    }
+    return exitCode;
 }
 
 // TODO(antonio): make this work as smoothly as execPty
@@ -163,24 +361,88 @@ int Command::runPipe()
 // https://gist.github.com/zmwangx/2bac2af9195cad47069419ccd9ee98d8
 // TODO test input side of psuedoterminal works
 // try this approach: https://rmathew.blogspot.com/2006/09/terminal-sickness.html
-int Command::runPty()
+Result<int> Command::runPty()
 {
-    int amaster{};
+    auto pty = PtyPool::shared().acquire();
+    if (!pty) {
+        return std::unexpected(pty.error());
+    }
 
-    int pid = ::forkpty(&amaster, /*name*/ nullptr, nullptr, nullptr);
+    auto options = treeOptions();
+    options.newSession = true; // the pty becomes the controlling terminal of a new session
+    ProcessTree tree(std::move(options));
+    int pid = ::fork();
 
     if (pid == -1) { // error
-        fatal("fork() failed");
+        pty->discard();
+        return makeError("fork() failed: {}", std::strerror(errno));
     }
     if (pid == 0) { // child
+        tree.enterChild();
+        ::close(pty->master());
+        // the slave as controlling terminal and stdio
+        if (::login_tty(pty->slave()) == -1) {
+            fatal("login_tty failed: {}", std::strerror(errno));
+        }
         replaceProcessImage();
     }
 
     // parent
-    pumpFdToStream(amaster, outStream());
-    ::close(amaster);
+    tree.started(pid);
+    Result<> pumped;
+    if (int pidFd = openPidFd(pid); pidFd != -1) {
+        pumped = pumpPtyToStream(pty->master(), pidFd, outStream());
+        ::close(pidFd);
+    } else {
+        // the end of output can only be detected by the slave closing, so it is not reused
+        pty->discard();
+        pumped = pumpFdToStream(pty->master(), outStream());
+    }
 
-    return childExit(pid);
+    auto waited = waitExited(pid);
+    if (waited) {
+        // like a terminal closing, also ends what the session left running in the background
+        // and ignored the hangup for, it would write into the next command's output. The
+        // unreaped leader keeps its process group id from being reused
+        ::kill(-pid, SIGKILL);
+    }
+    tree.release();
+    auto exitCode = treeResult(tree, childExit(pid));
+    if (!waited) {
+        return std::unexpected(waited.error());
+    }
+    if (!pumped) {
+        pty->discard();
+        return std::unexpected(pumped.error());
+    }
+    return exitCode;
+}
+
+ProcessTree::Options Command::treeOptions() const
+{
+    ProcessTree::Options options;
+    options.newSession = m_newSession;
+    options.cgroup = m_cgroup;
+    if (m_timeout.has_value()) {
+        options.deadline = std::chrono::steady_clock::now() + *m_timeout;
+    }
+    options.stopToken = m_stopToken;
+    return options;
+}
+
+Result<int> Command::treeResult(const ProcessTree& tree, Result<int> exitCode) const
+{
+    switch (tree.ending()) {
+    case ProcessTree::Ending::Completed:
+        return exitCode;
+    case ProcessTree::Ending::Cancelled:
+        return makeError("command \"{}\" was cancelled", toString());
+    case ProcessTree::Ending::TimedOut:
+        return makeError("command \"{}\" timed out after {}ms", toString(), m_timeout.value_or(std::chrono::milliseconds{}).count());
+    case ProcessTree::Ending::Interrupted:
+        return makeError("command \"{}\" was interrupted", toString());
+    }
+    return exitCode;
 }
 
 [[noreturn]] int Command::execPty()
@@ -189,31 +451,41 @@ int Command::runPty()
     int fd = ::open("/dev/tty", 0);
     ::login_tty(fd);
 
+    if (m_verbose) {
+        Logger::shared().flush(); // queued lines would go with the process image
+    }
+
     replaceProcessImage();
     fatal("unreachable");
 }
 
+// runs in the child after fork(), so failures here terminate only the child
 void Command::replaceProcessImage()
 {
     if (m_cd.has_value()) {
         current_path(*m_cd);
     }
 
+    if (m_environment.has_value()) {
+        // exec only reads the array, setenv below copies it before making changes
+        environ = const_cast<char**>(m_environment->envp());
+    }
+
     // setup subprocess specific environment variables
     for (const auto& [k, v] : m_envOverride) {
         if (::setenv(k.c_str(), v.c_str(), 1) == -1) {
-            fatal("failed to update environment variable ", k, ": ", std::strerror(errno));
+            fatal("failed to update environment variable {}: {}", k, std::strerror(errno));
         }
     }
 
-    std::vector<char*> argv{m_command.data()};
-    for (auto& arg : m_args) {
-        argv.push_back(arg.data());
+    std::vector<char*> argv{};
+    for (size_t pos = 0; pos < m_argv.size(); pos = m_argv.find('\0', pos) + 1) {
+        argv.push_back(m_argv.data() + pos);
     }
     argv.push_back(nullptr);
 
-    if (::execvp(m_command.c_str(), argv.data()) == -1) {
-        fatal("execvp failed: ", std::strerror(errno));
+    if (::execvp(argv.front(), argv.data()) == -1) {
+        fatal("execvp failed: {}", std::strerror(errno));
     }
 }
 
@@ -0,0 +1,284 @@
+#include <common/compress.hpp>
+
+#include <array>
+#include <cstring>
+#include <limits>
+#include <streambuf>
+
+namespace crew {
+namespace {
+constexpr size_t kMinMatch = 4;
+constexpr uint32_t kHashBits = 14;
+constexpr uint32_t kNoPosition = std::numeric_limits<uint32_t>::max();
+
+uint32_t read32(const char* p)
+{
+    uint32_t v{};
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash4(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+/** Lengths that do not fit a token nibble continue in 255-valued bytes */
+void putLength(std::string& out, size_t length)
+{
+    while (length >= 255) {
+        out.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+void putSequence(std::string& out, std::string_view literals, size_t offset, size_t matchLength)
+{
+    const size_t extraMatch = matchLength == 0 ? 0 : matchLength - kMinMatch;
+    const uint8_t token = static_cast<uint8_t>((std::min<size_t>(literals.size(), 15) << 4)
+            | std::min<size_t>(extraMatch, 15));
+    out.push_back(static_cast<char>(token));
+    if (literals.size() >= 15) {
+        putLength(out, literals.size() - 15);
+    }
+    out.append(literals);
+
+    if (matchLength == 0) { // final sequence, literals only
+        return;
+    }
+    out.push_back(static_cast<char>(offset & 0xFF));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (extraMatch >= 15) {
+        putLength(out, extraMatch - 15);
+    }
+}
+
+/** Read a continued length, returns false if the block ends first */
+bool getLength(std::string_view block, size_t& ip, size_t& length)
+{
+    uint8_t b{};
+    do {
+        if (ip >= block.size()) {
+            return false;
+        }
+        b = static_cast<uint8_t>(block[ip++]);
+        length += b;
+    } while (b == 255);
+    return true;
+}
+} // namespace
+
+std::string lzCompressBlock(std::string_view input)
+{
+    thread_local std::array<uint32_t, 1u << kHashBits> table;
+    table.fill(kNoPosition);
+
+    std::string out;
+    out.reserve(input.size() / 2 + 16);
+
+    const char* in = input.data();
+    const size_t n = std::min(input.size(), kLzMaxBlockSize);
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + kMinMatch <= n) {
+        const uint32_t sequence = read32(in + pos);
+        uint32_t& slot = table[hash4(sequence)];
+        const uint32_t candidate = slot;
+        slot = static_cast<uint32_t>(pos);
+
+        if (candidate == kNoPosition || read32(in + candidate) != sequence) {
+            ++pos;
+            continue;
+        }
+
+        size_t length = kMinMatch;
+        while (pos + length < n && in[candidate + length] == in[pos + length]) {
+            ++length;
+        }
+        putSequence(out, input.substr(anchor, pos - anchor), pos - candidate, length);
+        pos += length;
+        anchor = pos;
+    }
+
+    if (anchor < n) {
+        putSequence(out, input.substr(anchor, n - anchor), 0, 0);
+    }
+    return out;
+}
+
+Result<> lzDecompressBlock(std::string_view block, size_t rawSize, std::string& out)
+{
+    const size_t start = out.size();
+    out.resize(start + rawSize);
+    char* const begin = out.data() + start;
+    char* const end = begin + rawSize;
+    char* op = begin;
+
+    size_t ip = 0;
+    while (ip < block.size()) {
+        const uint8_t token = static_cast<uint8_t>(block[ip++]);
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLength(block, ip, literals)) {
+            return makeError("lz: truncated literal length");
+        }
+        if (literals > block.size() - ip || literals > static_cast<size_t>(end - op)) {
+            return makeError("lz: literal run out of bounds");
+        }
+        std::memcpy(op, block.data() + ip, literals);
+        op += literals;
+        ip += literals;
+
+        if (ip == block.size()) { // final sequence has no match
+            break;
+        }
+
+        if (block.size() - ip < 2) {
+            return makeError("lz: truncated match offset");
+        }
+        const size_t offset = static_cast<uint8_t>(block[ip]) | (static_cast<uint8_t>(block[ip + 1]) << 8);
+        ip += 2;
+        size_t length = token & 0xF;
+        if (length == 15 && !getLength(block, ip, length)) {
+            return makeError("lz: truncated match length");
+        }
+        length += kMinMatch;
+
+        if (offset == 0 || offset > static_cast<size_t>(op - begin) || length > static_cast<size_t>(end - op)) {
+            return makeError("lz: match out of bounds");
+        }
+        const char* from = op - offset;
+        if (offset >= length) {
+            std::memcpy(op, from, length);
+            op += length;
+        } else { // overlapping match repeats the last `offset` bytes
+            for (size_t i = 0; i < length; ++i) {
+                *op++ = from[i];
+            }
+        }
+    }
+
+    if (op != end) {
+        out.resize(start);
+        return makeError("lz: block decompressed to {} bytes, expected {}", op - begin, rawSize);
+    }
+    return {};
+}
+
+void CompressedBuffer::append(std::string_view bytes)
+{
+    m_size += bytes.size();
+    while (!bytes.empty()) {
+        if (m_hot.empty() && bytes.size() >= kLzMaxBlockSize) { // full blocks skip the hot tail
+            sealBlock(bytes.substr(0, kLzMaxBlockSize));
+            bytes.remove_prefix(kLzMaxBlockSize);
+            continue;
+        }
+        const size_t take = std::min(bytes.size(), kLzMaxBlockSize - m_hot.size());
+        m_hot.append(bytes.substr(0, take));
+        bytes.remove_prefix(take);
+        if (m_hot.size() == kLzMaxBlockSize) {
+            seal();
+        }
+    }
+}
+
+void CompressedBuffer::seal()
+{
+    if (!m_hot.empty()) {
+        sealBlock(m_hot);
+        m_hot = {}; // release the hot block's allocation along with its contents
+    }
+}
+
+void CompressedBuffer::sealBlock(std::string_view raw)
+{
+    Block block{lzCompressBlock(raw), static_cast<uint32_t>(raw.size()), false};
+    if (block.data.size() >= raw.size()) {
+        block.data.assign(raw);
+        block.stored = true;
+    }
+    block.data.shrink_to_fit();
+    m_blocks.push_back(std::move(block));
+}
+
+Result<std::string> CompressedBuffer::str() const
+{
+    std::string result;
+    result.reserve(m_size);
+    for (const auto& block : m_blocks) {
+        if (block.stored) {
+            result.append(block.data);
+        } else if (auto ok = lzDecompressBlock(block.data, block.rawSize, result); !ok) {
+            return std::unexpected(ok.error());
+        }
+    }
+    result.append(m_hot);
+    return result;
+}
+
+Result<> CompressedBuffer::replay(std::ostream& dest) const
+{
+    std::string scratch;
+    scratch.reserve(kLzMaxBlockSize);
+    for (const auto& block : m_blocks) {
+        if (block.stored) {
+            dest << block.data;
+            continue;
+        }
+        scratch.clear();
+        if (auto ok = lzDecompressBlock(block.data, block.rawSize, scratch); !ok) {
+            return ok;
+        }
+        dest << scratch;
+    }
+    dest << m_hot;
+    return {};
+}
+
+size_t CompressedBuffer::compressedSize() const
+{
+    size_t result = m_hot.size();
+    for (const auto& block : m_blocks) {
+        result += block.data.size();
+    }
+    return result;
+}
+
+/** Unbuffered streambuf appending straight into the CompressedBuffer */
+class CompressedCapture::StreamBuffer : public std::streambuf {
+public:
+    explicit StreamBuffer(CompressedBuffer& buffer) :
+        m_buffer(buffer) {}
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        m_buffer.append(std::string_view(s, static_cast<size_t>(n)));
+        return n;
+    }
+
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            char ch = traits_type::to_char_type(c);
+            m_buffer.append(std::string_view(&ch, 1));
+        }
+        return traits_type::not_eof(c);
+    }
+
+private:
+    CompressedBuffer& m_buffer;
+};
+
+CompressedCapture::CompressedCapture() :
+    std::ostream(nullptr),
+    m_streamBuffer(std::make_unique<StreamBuffer>(m_buffer))
+{
+    rdbuf(m_streamBuffer.get());
+}
+
+CompressedCapture::~CompressedCapture() = default;
+
+} // namespace crew
@@ -0,0 +1,127 @@
+#include <common/environment.hpp>
+
+#include <cstring>
+
+extern char** environ;
+
+namespace crew {
+namespace {
+// chains of overlays deeper than this are collapsed so lookups stay cheap
+constexpr size_t kMaxLayerDepth = 8;
+} // namespace
+
+Environment::Environment() :
+    m_layer(std::make_shared<const Layer>())
+{
+}
+
+Environment Environment::inherited()
+{
+    return fromEnvp(environ);
+}
+
+Environment Environment::fromEnvp(const char* const* envp)
+{
+    auto layer = std::make_shared<Layer>();
+    for (const char* const* it = envp; it != nullptr && *it != nullptr; ++it) {
+        std::string_view entry(*it);
+        size_t eq = entry.find('=');
+        if (eq == std::string_view::npos) {
+            continue;
+        }
+        layer->overlay.try_emplace(std::string(entry.substr(0, eq)), std::string(entry.substr(eq + 1)));
+    }
+    return Environment(std::move(layer));
+}
+
+Environment Environment::with(std::string key, std::string value) const
+{
+    return layered(std::move(key), std::move(value));
+}
+
+Environment Environment::without(std::string key) const
+{
+    return layered(std::move(key), std::nullopt);
+}
+
+Environment Environment::layered(std::string key, std::optional<std::string> value) const
+{
+    auto layer = std::make_shared<Layer>();
+    if (m_layer->depth + 1 >= kMaxLayerDepth) {
+        for (auto& [k, v] : merged()) {
+            layer->overlay.emplace(k, std::move(v));
+        }
+        if (value.has_value()) {
+            layer->overlay[std::move(key)] = std::move(value);
+        } else {
+            layer->overlay.erase(key);
+        }
+    } else {
+        layer->parent = m_layer;
+        layer->depth = m_layer->depth + 1;
+        layer->overlay.emplace(std::move(key), std::move(value));
+    }
+    return Environment(std::move(layer));
+}
+
+std::optional<std::string_view> Environment::get(std::string_view key) const
+{
+    for (const Layer* layer = m_layer.get(); layer != nullptr; layer = layer->parent.get()) {
+        if (auto it = layer->overlay.find(key); it != layer->overlay.end()) {
+            if (!it->second.has_value()) {
+                return {};
+            }
+            return std::string_view(*it->second);
+        }
+    }
+    return {};
+}
+
+std::map<std::string, std::string, std::less<>> Environment::merged() const
+{
+    std::vector<const Layer*> chain;
+    for (const Layer* layer = m_layer.get(); layer != nullptr; layer = layer->parent.get()) {
+        chain.push_back(layer);
+    }
+
+    std::map<std::string, std::string, std::less<>> result;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) { // root first, so overlays win
+        for (const auto& [k, v] : (*it)->overlay) {
+            if (v.has_value()) {
+                result.insert_or_assign(k, *v);
+            } else {
+                result.erase(k);
+            }
+        }
+    }
+    return result;
+}
+
+const Environment::Layer& Environment::flat() const
+{
+    std::call_once(m_layer->flattened, [this]() {
+        auto vars = merged();
+        m_layer->entries.reserve(vars.size());
+        for (const auto& [k, v] : vars) {
+            m_layer->entries.push_back(k + "=" + v);
+        }
+        m_layer->envp.reserve(vars.size() + 1);
+        for (auto& entry : m_layer->entries) {
+            m_layer->envp.push_back(entry.data());
+        }
+        m_layer->envp.push_back(nullptr);
+    });
+    return *m_layer;
+}
+
+char* const* Environment::envp() const
+{
+    return flat().envp.data();
+}
+
+size_t Environment::size() const
+{
+    return flat().entries.size();
+}
+
+} // namespace crew
@@ -0,0 +1,350 @@
+#include <common/file_hash.hpp>
+#include <common/record_file.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/std.h>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+namespace {
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+constexpr RecordFormat kCacheFormat{{'C', 'R', 'W', 'H'}, 1};
+
+struct CacheRecord {
+    uint64_t device{};
+    uint64_t inode{};
+    uint64_t size{};
+    int64_t mtimeNs{};
+    uint64_t hash{};
+};
+
+// hashing threads, files are mostly read from the page cache so this is cpu bound
+constexpr unsigned kMaxHashThreads = 16;
+
+// bytes read at a time, enough to amortize the syscalls and small enough for the cache
+constexpr size_t kReadSize = 256 * 1024;
+
+template <typename T>
+T readLittleEndian(const char* p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * kPrime2;
+    acc = std::rotl(acc, 31);
+    return acc * kPrime1;
+}
+
+uint64_t mergeRound(uint64_t acc, uint64_t value)
+{
+    acc ^= round(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+
+/** Fold the four lanes together once all stripes have been consumed */
+uint64_t mergeLanes(uint64_t v1, uint64_t v2, uint64_t v3, uint64_t v4)
+{
+    uint64_t h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+    h = mergeRound(h, v1);
+    h = mergeRound(h, v2);
+    h = mergeRound(h, v3);
+    h = mergeRound(h, v4);
+    return h;
+}
+
+/** Consume the tail of fewer than 32 bytes [p, end) and avalanche */
+uint64_t finish(uint64_t h, const char* p, const char* const end)
+{
+    for (; p + 8 <= end; p += 8) {
+        h ^= round(0, readLittleEndian<uint64_t>(p));
+        h = std::rotl(h, 27) * kPrime1 + kPrime4;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(readLittleEndian<uint32_t>(p)) * kPrime1;
+        h = std::rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= static_cast<uint64_t>(static_cast<uint8_t>(*p)) * kPrime5;
+        h = std::rotl(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+/** hash64() of data arriving in pieces */
+class Hash64Stream {
+public:
+    void update(std::string_view bytes)
+    {
+        m_total += bytes.size();
+        if (m_buffered > 0) { // complete the stripe started by the previous piece
+            const size_t taken = std::min(sizeof(m_stripe) - m_buffered, bytes.size());
+            std::memcpy(m_stripe + m_buffered, bytes.data(), taken);
+            m_buffered += taken;
+            bytes.remove_prefix(taken);
+            if (m_buffered < sizeof(m_stripe)) {
+                return;
+            }
+            consume(m_stripe);
+            m_buffered = 0;
+        }
+        for (; bytes.size() >= sizeof(m_stripe); bytes.remove_prefix(sizeof(m_stripe))) {
+            consume(bytes.data());
+        }
+        std::memcpy(m_stripe, bytes.data(), bytes.size());
+        m_buffered = bytes.size();
+    }
+
+    uint64_t digest() const
+    {
+        uint64_t h = m_total >= sizeof(m_stripe) ? mergeLanes(m_v1, m_v2, m_v3, m_v4) : kPrime5;
+        h += m_total;
+        return finish(h, m_stripe, m_stripe + m_buffered);
+    }
+
+private:
+    void consume(const char* p)
+    {
+        m_v1 = round(m_v1, readLittleEndian<uint64_t>(p));
+        m_v2 = round(m_v2, readLittleEndian<uint64_t>(p + 8));
+        m_v3 = round(m_v3, readLittleEndian<uint64_t>(p + 16));
+        m_v4 = round(m_v4, readLittleEndian<uint64_t>(p + 24));
+    }
+
+    // lanes as hash64() seeds them for seed 0
+    uint64_t m_v1 = kPrime1 + kPrime2;
+    uint64_t m_v2 = kPrime2;
+    uint64_t m_v3 = 0;
+    uint64_t m_v4 = 0 - kPrime1;
+    uint64_t m_total{};
+    char m_stripe[32]{};
+    size_t m_buffered{};
+};
+
+/**
+ * Hash the contents of an open file. Read rather than mapped: a file truncated while it
+ * is hashed would raise SIGBUS on the mapping, but only ends a read early.
+ */
+Result<uint64_t> hashFd(int fd)
+{
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    thread_local std::vector<char> buffer(kReadSize);
+    Hash64Stream stream;
+    while (true) {
+        const ssize_t count = ::read(fd, buffer.data(), buffer.size());
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return makeError("read failed: {}", std::strerror(errno));
+        }
+        if (count == 0) {
+            return stream.digest();
+        }
+        stream.update({buffer.data(), static_cast<size_t>(count)});
+    }
+}
+} // namespace
+
+uint64_t hash64(std::string_view bytes, uint64_t seed)
+{
+    const char* p = bytes.data();
+    const char* const end = p + bytes.size();
+    uint64_t h{};
+
+    if (bytes.size() >= 32) {
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, readLittleEndian<uint64_t>(p));
+            v2 = round(v2, readLittleEndian<uint64_t>(p + 8));
+            v3 = round(v3, readLittleEndian<uint64_t>(p + 16));
+            v4 = round(v4, readLittleEndian<uint64_t>(p + 24));
+        }
+        h = mergeLanes(v1, v2, v3, v4);
+    } else {
+        h = seed + kPrime5;
+    }
+    h += bytes.size();
+    return finish(h, p, end);
+}
+
+FileHasher::FileHasher(std::optional<fs::path> cacheFile) :
+    m_cacheFile(std::move(cacheFile))
+{
+}
+
+Result<> FileHasher::load()
+{
+    if (!m_cacheFile.has_value()) {
+        return {};
+    }
+    auto records = readRecords<CacheRecord>(*m_cacheFile, kCacheFormat);
+    if (!records) {
+        return makeError("failed to load hash cache: {}", records.error().message);
+    }
+
+    std::map<Key, Entry> loaded;
+    for (const CacheRecord& record : *records) {
+        const Key key{record.device, record.inode, record.size, record.mtimeNs};
+        loaded.emplace_hint(loaded.end(), key, Entry{.hash = record.hash, .used = false});
+    }
+
+    std::lock_guard lock(m_mutex);
+    m_cache.merge(loaded);
+    return {};
+}
+
+Result<> FileHasher::save() const
+{
+    if (!m_cacheFile.has_value()) {
+        return {};
+    }
+    std::vector<CacheRecord> records;
+    {
+        std::lock_guard lock(m_mutex);
+        for (const auto& [key, entry] : m_cache) {
+            if (entry.used) {
+                records.push_back({key.device, key.inode, key.size, key.mtimeNs, entry.hash});
+            }
+        }
+    }
+    if (auto written = writeRecords<CacheRecord>(*m_cacheFile, kCacheFormat, records); !written) {
+        return makeError("failed to save hash cache: {}", written.error().message);
+    }
+    return {};
+}
+
+Result<uint64_t> FileHasher::hash(const fs::path& path)
+{
+    UniqueFd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.get() == -1) {
+        return makeError("failed to open {}: {}", path, std::strerror(errno));
+    }
+    struct stat info {};
+    if (::fstat(fd.get(), &info) == -1) {
+        return makeError("failed to stat {}: {}", path, std::strerror(errno));
+    }
+    const Key key{
+        static_cast<uint64_t>(info.st_dev),
+        static_cast<uint64_t>(info.st_ino),
+        static_cast<uint64_t>(info.st_size),
+        static_cast<int64_t>(info.st_mtim.tv_sec) * 1'000'000'000 + info.st_mtim.tv_nsec,
+    };
+
+    {
+        std::lock_guard lock(m_mutex);
+        if (auto it = m_cache.find(key); it != m_cache.end()) {
+            ++m_stats.hits;
+            it->second.used = true;
+            return it->second.hash;
+        }
+        ++m_stats.misses;
+    }
+
+    auto hashed = hashFd(fd.get());
+    if (!hashed) {
+        return makeError("failed to hash {}: {}", path, hashed.error().message);
+    }
+
+    // a file modified again within the filesystem's timestamp granularity would keep
+    // its key, so recently modified files are not cached until they have settled
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    if (key.mtimeNs + 2'000'000'000 < std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()) {
+        std::lock_guard lock(m_mutex);
+        m_cache.insert_or_assign(key, Entry{.hash = *hashed, .used = true});
+    }
+    return hashed;
+}
+
+std::vector<Result<uint64_t>> FileHasher::hashAll(const std::vector<fs::path>& paths)
+{
+    std::vector<Result<uint64_t>> results(paths.size());
+    std::atomic<size_t> next = 0;
+    const auto work = [&] {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            results[i] = hash(paths[i]);
+        }
+    };
+
+    const unsigned count = std::clamp<unsigned>(std::min<size_t>(std::thread::hardware_concurrency(), paths.size()), 1, kMaxHashThreads);
+    std::vector<std::jthread> threads;
+    for (unsigned i = 1; i < count; ++i) {
+        threads.emplace_back(work);
+    }
+    work(); // the calling thread takes part too
+    for (auto& thread : threads) {
+        thread.join(); // before `results` is handed out
+    }
+    return results;
+}
+
+Result<std::map<fs::path, uint64_t>> FileHasher::hashTree(const fs::path& root)
+{
+    std::vector<fs::path> paths;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec) && !it->is_symlink(ec)) {
+            paths.push_back(it->path());
+        }
+    }
+    if (ec) {
+        return makeError("failed to list {}: {}", root, ec.message());
+    }
+
+    auto hashes = hashAll(paths);
+    std::map<fs::path, uint64_t> result;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!hashes[i]) {
+            return std::unexpected(hashes[i].error());
+        }
+        result.emplace(std::move(paths[i]), *hashes[i]);
+    }
+    return result;
+}
+
+FileHasher::Stats FileHasher::stats() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+size_t FileHasher::cacheSize() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_cache.size();
+}
+
+} // namespace crew
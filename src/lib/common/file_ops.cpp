@@ -0,0 +1,448 @@
+#include <common/file_ops.hpp>
+#include <common/interpreter.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/std.h>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+namespace {
+// directory traversal threads, file operations are mostly waiting on the filesystem
+constexpr unsigned kMaxWalkThreads = 8;
+
+/** Copy the remaining contents with read/write, for when the kernel cannot copy for us */
+Result<> copyByReading(int in, int out)
+{
+    std::vector<char> buffer(128 * 1024);
+    while (true) {
+        ssize_t count = ::read(in, buffer.data(), buffer.size());
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return makeError("read() failed: {}", std::strerror(errno));
+        }
+        if (count == 0) {
+            return {};
+        }
+        for (ssize_t written = 0; written < count;) {
+            ssize_t n = ::write(out, buffer.data() + written, count - written);
+            if (n == -1 && errno != EINTR) {
+                return makeError("write() failed: {}", std::strerror(errno));
+            }
+            written += std::max<ssize_t>(n, 0);
+        }
+    }
+}
+
+/**
+ * Visit every entry below `root` from a set of threads. Each thread takes a directory,
+ * calls `visit` for its entries and queues the subdirectories, which are only listed
+ * after `visit` saw them (so a copy creates a directory before filling it). Stops at the
+ * first error.
+ */
+template <typename Visit>
+Result<> walkParallel(const fs::path& root, Visit&& visit)
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<fs::path> pending{root};
+    size_t active = 0; // directories being listed
+    std::optional<Error> error;
+
+    const auto work = [&] {
+        std::unique_lock lock(mutex);
+        while (true) {
+            changed.wait(lock, [&] { return !pending.empty() || active == 0 || error.has_value(); });
+            if (error.has_value() || pending.empty()) {
+                return; // failed, or no work queued and none being produced
+            }
+            fs::path dir = std::move(pending.front());
+            pending.pop_front();
+            ++active;
+            lock.unlock();
+
+            std::vector<fs::path> subdirs;
+            Result<> listed;
+            std::error_code ec;
+            for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+                if (listed = visit(*it); !listed) {
+                    break;
+                }
+                if (it->is_directory(ec) && !it->is_symlink(ec)) {
+                    subdirs.push_back(it->path());
+                }
+            }
+            if (ec && listed) {
+                listed = makeError("failed to list {}: {}", dir, ec.message());
+            }
+
+            lock.lock();
+            --active;
+            if (!listed && !error.has_value()) {
+                error = listed.error();
+            }
+            std::move(subdirs.begin(), subdirs.end(), std::back_inserter(pending));
+            changed.notify_all();
+        }
+    };
+
+    {
+        const unsigned count = std::clamp(std::thread::hardware_concurrency(), 1u, kMaxWalkThreads);
+        std::vector<std::jthread> threads;
+        for (unsigned i = 0; i < count; ++i) {
+            threads.emplace_back(work);
+        }
+    }
+
+    if (error.has_value()) {
+        return std::unexpected(*error);
+    }
+    return {};
+}
+
+/** Where a copy or link named `dest` goes, inside it if it is an existing directory */
+fs::path destinationFor(const fs::path& source, const fs::path& dest)
+{
+    std::error_code ec;
+    if (fs::is_directory(dest, ec)) {
+        return dest / source.filename();
+    }
+    return dest;
+}
+
+/**
+ * Split builtin arguments into single letter flags (which may be combined, e.g. -rf)
+ * and operands, failing on flags not in `allowed`
+ */
+Result<std::pair<std::string, std::vector<fs::path>>> parseArgs(std::string_view builtin, const std::vector<std::string>& args, std::string_view allowed)
+{
+    std::string flags;
+    std::vector<fs::path> operands;
+    for (const auto& arg : args) {
+        if (arg.size() > 1 && arg.front() == '-') {
+            for (char flag : std::string_view(arg).substr(1)) {
+                if (allowed.find(flag) == std::string_view::npos) {
+                    return makeError("{}: unsupported option -{}", builtin, flag);
+                }
+                flags.push_back(flag);
+            }
+        } else {
+            operands.emplace_back(arg);
+        }
+    }
+    return std::pair{std::move(flags), std::move(operands)};
+}
+
+bool hasFlag(std::string_view flags, char flag)
+{
+    return flags.find(flag) != std::string_view::npos;
+}
+} // namespace
+
+Result<> copyFile(const fs::path& from, const fs::path& to)
+{
+    UniqueFd in(::open(from.c_str(), O_RDONLY | O_CLOEXEC));
+    if (in.get() == -1) {
+        return makeError("failed to open {}: {}", from, std::strerror(errno));
+    }
+    struct stat info {};
+    if (::fstat(in.get(), &info) == -1) {
+        return makeError("failed to stat {}: {}", from, std::strerror(errno));
+    }
+    // truncated only once it is known not to be the source, as cp does
+    UniqueFd out(::open(to.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, info.st_mode & 07777));
+    if (out.get() == -1) {
+        return makeError("failed to create {}: {}", to, std::strerror(errno));
+    }
+    struct stat outInfo {};
+    if (::fstat(out.get(), &outInfo) == -1) {
+        return makeError("failed to stat {}: {}", to, std::strerror(errno));
+    }
+    if (outInfo.st_dev == info.st_dev && outInfo.st_ino == info.st_ino) {
+        return makeError("{} and {} are the same file", from, to);
+    }
+    if (::ftruncate(out.get(), 0) == -1) {
+        return makeError("failed to truncate {}: {}", to, std::strerror(errno));
+    }
+
+#ifdef FICLONE
+    if (::ioctl(out.get(), FICLONE, in.get()) == 0) {
+        return {};
+    }
+#endif
+
+#ifdef __linux__
+    for (off_t remaining = info.st_size; remaining > 0;) {
+        ssize_t copied = ::copy_file_range(in.get(), nullptr, out.get(), nullptr, remaining, 0);
+        if (copied == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL) {
+                break; // unsupported for this pair of files, read what is left instead
+            }
+            return makeError("failed to copy {} to {}: {}", from, to, std::strerror(errno));
+        }
+        if (copied == 0) {
+            return {}; // the file shrank while copying
+        }
+        remaining -= copied;
+    }
+#endif
+    if (auto copied = copyByReading(in.get(), out.get()); !copied) {
+        return makeError("failed to copy {} to {}: {}", from, to, copied.error().message);
+    }
+    return {};
+}
+
+Result<> copyTree(const fs::path& from, const fs::path& to)
+{
+    std::error_code ec;
+    if (!fs::is_directory(from, ec)) {
+        return copyFile(from, to);
+    }
+    // the walk would otherwise copy the directories it creates
+    const fs::path source = fs::canonical(from, ec);
+    if (ec) {
+        return makeError("failed to resolve {}: {}", from, ec.message());
+    }
+    const fs::path dest = fs::weakly_canonical(to, ec);
+    if (ec) {
+        return makeError("failed to resolve {}: {}", to, ec.message());
+    }
+    if (std::mismatch(source.begin(), source.end(), dest.begin(), dest.end()).first == source.end()) {
+        return makeError("cannot copy a directory, {}, into itself, {}", from, to);
+    }
+    if (fs::create_directory(to, from, ec); ec) {
+        return makeError("failed to create {}: {}", to, ec.message());
+    }
+
+    return walkParallel(from, [&](const fs::directory_entry& entry) -> Result<> {
+        const fs::path dest = to / entry.path().lexically_relative(from);
+        std::error_code ec;
+        const auto status = entry.symlink_status(ec);
+        if (fs::is_symlink(status)) {
+            fs::copy_symlink(entry.path(), dest, ec);
+        } else if (fs::is_directory(status)) {
+            fs::create_directory(dest, entry.path(), ec);
+        } else if (fs::is_regular_file(status)) {
+            return copyFile(entry.path(), dest);
+        } // sockets, fifos and devices are skipped
+        if (ec) {
+            return makeError("failed to copy {}: {}", entry.path(), ec.message());
+        }
+        return {};
+    });
+}
+
+Result<> makeDirectories(const fs::path& path)
+{
+    std::error_code ec;
+    fs::create_directories(path, ec);
+    if (ec) {
+        return makeError("failed to create {}: {}", path, ec.message());
+    }
+    return {};
+}
+
+Result<> makeLink(const fs::path& target, const fs::path& link, bool symbolic, bool force)
+{
+    std::error_code ec;
+    if (force && fs::symlink_status(link, ec).type() != fs::file_type::not_found) {
+        if (fs::remove(link, ec); ec) {
+            return makeError("failed to replace {}: {}", link, ec.message());
+        }
+    }
+    if (symbolic) {
+        fs::create_symlink(target, link, ec);
+    } else {
+        fs::create_hard_link(target, link, ec);
+    }
+    if (ec) {
+        return makeError("failed to link {} to {}: {}", link, target, ec.message());
+    }
+    return {};
+}
+
+Result<uint64_t> removeTree(const fs::path& path)
+{
+    // as rm does, e.g. for "$dir/" with an empty $dir
+    std::string_view text = path.native();
+    while (text.size() > 1 && text.back() == '/') {
+        text.remove_suffix(1);
+    }
+    if (const auto last = text.substr(text.rfind('/') + 1); last == "." || last == "..") {
+        return makeError("refusing to remove '.' or '..' directory: {}", path);
+    }
+    std::error_code ec;
+    if (text == "/" || fs::equivalent(path, "/", ec)) {
+        return makeError("refusing to remove the root directory: {}", path);
+    }
+
+    const auto status = fs::symlink_status(path, ec);
+    if (status.type() == fs::file_type::not_found) {
+        return 0;
+    }
+    if (!fs::is_directory(status)) {
+        if (fs::remove(path, ec); ec) {
+            return makeError("failed to remove {}: {}", path, ec.message());
+        }
+        return 1;
+    }
+
+    // files are unlinked during the walk, directories once they have been emptied
+    std::mutex mutex;
+    std::vector<fs::path> directories;
+    std::atomic<uint64_t> removed = 0;
+    auto walked = walkParallel(path, [&](const fs::directory_entry& entry) -> Result<> {
+        std::error_code ec;
+        if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+            std::lock_guard lock(mutex);
+            directories.push_back(entry.path());
+            return {};
+        }
+        if (fs::remove(entry.path(), ec); ec) {
+            return makeError("failed to remove {}: {}", entry.path(), ec.message());
+        }
+        ++removed;
+        return {};
+    });
+    if (!walked) {
+        return std::unexpected(walked.error());
+    }
+
+    // deepest first, so each directory is empty by the time it is removed
+    const auto depth = [](const fs::path& p) { return std::distance(p.begin(), p.end()); };
+    std::ranges::sort(directories, std::greater{}, depth);
+    directories.push_back(path);
+    for (const auto& dir : directories) {
+        if (fs::remove(dir, ec); ec) {
+            return makeError("failed to remove {}: {}", dir, ec.message());
+        }
+        ++removed;
+    }
+    return removed.load();
+}
+
+Result<> addFileBuiltins(Vm& vm)
+{
+    vm.addParam("path", [](const std::string& s) { return !s.empty(); });
+
+    auto added = vm.addBuiltin("cp", {"path", "path"}, [](const std::vector<std::string>& args, std::ostream&) -> Result<int> {
+        auto parsed = parseArgs("cp", args, "r");
+        if (!parsed) {
+            return std::unexpected(parsed.error());
+        }
+        auto& [flags, paths] = *parsed;
+        if (paths.size() < 2) {
+            return makeError("cp: expected a source and destination");
+        }
+        const fs::path dest = paths.back();
+        for (auto it = paths.begin(); it != std::prev(paths.end()); ++it) {
+            std::error_code ec;
+            if (fs::is_directory(*it, ec) && !hasFlag(flags, 'r')) {
+                return makeError("cp: -r not specified, omitting directory {}", *it);
+            }
+            if (auto copied = copyTree(*it, destinationFor(*it, dest)); !copied) {
+                return std::unexpected(copied.error());
+            }
+        }
+        return 0;
+    });
+    if (!added) {
+        return added;
+    }
+
+    added = vm.addBuiltin("ln", {"path"}, [](const std::vector<std::string>& args, std::ostream&) -> Result<int> {
+        auto parsed = parseArgs("ln", args, "sfi");
+        if (!parsed) {
+            return std::unexpected(parsed.error());
+        }
+        auto& [flags, paths] = *parsed;
+        if (paths.empty() || paths.size() > 2) {
+            return makeError("ln: expected a target and optionally a link name");
+        }
+        const fs::path link = destinationFor(paths.front(), paths.size() == 2 ? paths.back() : fs::path("."));
+        std::error_code ec;
+        if (hasFlag(flags, 'i') && fs::symlink_status(link, ec).type() != fs::file_type::not_found) {
+            return makeError("ln: not replacing {}", link);
+        }
+        if (auto linked = makeLink(paths.front(), link, hasFlag(flags, 's'), hasFlag(flags, 'f')); !linked) {
+            return std::unexpected(linked.error());
+        }
+        return 0;
+    });
+    if (!added) {
+        return added;
+    }
+
+    added = vm.addBuiltin("mkdir", {"path"}, [](const std::vector<std::string>& args, std::ostream&) -> Result<int> {
+        auto parsed = parseArgs("mkdir", args, "p");
+        if (!parsed) {
+            return std::unexpected(parsed.error());
+        }
+        auto& [flags, paths] = *parsed;
+        for (const auto& path : paths) {
+            if (hasFlag(flags, 'p')) {
+                if (auto made = makeDirectories(path); !made) {
+                    return std::unexpected(made.error());
+                }
+                continue;
+            }
+            std::error_code ec;
+            if (!fs::create_directory(path, ec)) {
+                return makeError("mkdir: cannot create {}: {}", path, ec ? ec.message() : "already exists");
+            }
+        }
+        return 0;
+    });
+    if (!added) {
+        return added;
+    }
+
+    return vm.addBuiltin("rm", {"path"}, [](const std::vector<std::string>& args, std::ostream&) -> Result<int> {
+        auto parsed = parseArgs("rm", args, "rf");
+        if (!parsed) {
+            return std::unexpected(parsed.error());
+        }
+        auto& [flags, paths] = *parsed;
+        for (const auto& path : paths) {
+            std::error_code ec;
+            const auto status = fs::symlink_status(path, ec);
+            if (status.type() == fs::file_type::not_found) {
+                if (hasFlag(flags, 'f')) {
+                    continue;
+                }
+                return makeError("rm: cannot remove {}: no such file or directory", path);
+            }
+            if (fs::is_directory(status) && !hasFlag(flags, 'r')) {
+                return makeError("rm: cannot remove {}: is a directory", path);
+            }
+            if (auto removed = removeTree(path); !removed) {
+                return std::unexpected(removed.error());
+            }
+        }
+        return 0;
+    });
+}
+
+} // namespace crew
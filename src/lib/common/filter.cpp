@@ -0,0 +1,468 @@
+#include <common/filter.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <streambuf>
+
+namespace crew {
+namespace {
+/**
+ * Locate `needle` in `haystack` using the libc memmem, which is vectorized on the
+ * platforms we target, returns npos if not found
+ */
+size_t findSubstring(std::string_view haystack, std::string_view needle)
+{
+    const void* hit = ::memmem(haystack.data(), haystack.size(), needle.data(), needle.size());
+    if (hit == nullptr) {
+        return std::string_view::npos;
+    }
+    return static_cast<const char*>(hit) - haystack.data();
+}
+
+/** Second to fourth byte of a UTF-8 encoded code point */
+bool isContinuation(char c)
+{
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+/** Offset of the first '\n' at or after `from`, or npos */
+size_t findNewline(std::string_view bytes, size_t from = 0)
+{
+    if (from >= bytes.size()) {
+        return std::string_view::npos;
+    }
+    const void* hit = std::memchr(bytes.data() + from, '\n', bytes.size() - from);
+    if (hit == nullptr) {
+        return std::string_view::npos;
+    }
+    return static_cast<const char*>(hit) - bytes.data();
+}
+
+/**
+ * Split `chunk` into the portion completing `partial`, a run of complete lines and a
+ * trailing incomplete line which replaces `partial`. The completed line is passed to
+ * `onLine`, the run of complete lines to `onLines`.
+ */
+template <typename OnLine, typename OnLines>
+void splitLines(std::string& partial, std::string_view chunk, OnLine&& onLine, OnLines&& onLines)
+{
+    if (!partial.empty()) {
+        size_t nl = findNewline(chunk);
+        if (nl == std::string_view::npos) {
+            partial.append(chunk);
+            return;
+        }
+        partial.append(chunk.substr(0, nl + 1));
+        onLine(std::string_view(partial));
+        partial.clear();
+        chunk.remove_prefix(nl + 1);
+    }
+
+    size_t last = chunk.rfind('\n');
+    if (last == std::string_view::npos) {
+        partial.assign(chunk);
+        return;
+    }
+    onLines(chunk.substr(0, last + 1));
+    partial.assign(chunk.substr(last + 1));
+}
+} // namespace
+
+void GrepStage::write(std::string_view chunk)
+{
+    const auto filter = [this](std::string_view lines) { filterLines(lines); };
+    splitLines(m_partial, chunk, filter, filter);
+}
+
+void GrepStage::finish()
+{
+    if (!m_partial.empty()) {
+        bool match = findSubstring(m_partial, m_pattern) != std::string_view::npos;
+        if (match != m_invert) {
+            emit(m_partial);
+        }
+        m_partial.clear();
+    }
+    finishNext();
+}
+
+void GrepStage::filterLines(std::string_view lines)
+{
+    // search the whole run for the pattern rather than line by line, then widen each
+    // hit to the line containing it. Non matching lines between hits are skipped (or
+    // emitted as one contiguous block when inverted).
+    size_t pos = 0;
+    while (pos < lines.size()) {
+        size_t hit = findSubstring(lines.substr(pos), m_pattern);
+        if (hit == std::string_view::npos) {
+            break;
+        }
+        hit += pos;
+
+        size_t lineStart = pos;
+        if (hit > pos) {
+            size_t prev = lines.rfind('\n', hit - 1);
+            if (prev != std::string_view::npos && prev >= pos) {
+                lineStart = prev + 1;
+            }
+        }
+        size_t lineEnd = findNewline(lines, hit) + 1;
+
+        if (m_invert) {
+            emit(lines.substr(pos, lineStart - pos));
+        } else {
+            emit(lines.substr(lineStart, lineEnd - lineStart));
+        }
+        pos = lineEnd;
+    }
+
+    if (m_invert) {
+        emit(lines.substr(pos));
+    }
+}
+
+void HeadStage::write(std::string_view chunk)
+{
+    size_t pos = 0;
+    while (m_remaining > 0) {
+        size_t nl = findNewline(chunk, pos);
+        if (nl == std::string_view::npos) {
+            emit(chunk);
+            return;
+        }
+        --m_remaining;
+        pos = nl + 1;
+    }
+    emit(chunk.substr(0, pos));
+}
+
+void TailStage::write(std::string_view chunk)
+{
+    if (m_ring.empty()) {
+        return;
+    }
+
+    const auto pushLines = [this](std::string_view lines) {
+        // only the last m_ring.size() lines of the run can survive, skip straight to them
+        size_t start = lines.size();
+        for (size_t found = 0; found < m_ring.size() && start > 0; ++found) {
+            // lines[start - 1] terminates the previous line, find the newline before it
+            size_t prev = start >= 2 ? lines.rfind('\n', start - 2) : std::string_view::npos;
+            start = prev == std::string_view::npos ? 0 : prev + 1;
+        }
+
+        while (start < lines.size()) {
+            size_t nl = findNewline(lines, start);
+            pushLine(lines.substr(start, nl + 1 - start));
+            start = nl + 1;
+        }
+    };
+    splitLines(m_partial, chunk, [this](std::string_view line) { pushLine(line); }, pushLines);
+}
+
+void TailStage::finish()
+{
+    if (!m_ring.empty()) {
+        if (!m_partial.empty()) {
+            pushLine(m_partial);
+            m_partial.clear();
+        }
+
+        size_t first = (m_next + m_ring.size() - m_size) % m_ring.size();
+        for (size_t i = 0; i < m_size; ++i) {
+            emit(m_ring[(first + i) % m_ring.size()]);
+        }
+        m_size = 0;
+    }
+    finishNext();
+}
+
+void TailStage::pushLine(std::string_view line)
+{
+    m_ring[m_next].assign(line); // reuses the slot's existing capacity
+    m_next = (m_next + 1) % m_ring.size();
+    m_size = std::min(m_size + 1, m_ring.size());
+}
+
+void CountStage::write(std::string_view chunk)
+{
+    if (chunk.empty()) {
+        return;
+    }
+    m_lines += std::count(chunk.begin(), chunk.end(), '\n');
+    m_midLine = chunk.back() != '\n';
+}
+
+void CountStage::finish()
+{
+    emit(std::to_string(lines()) + "\n");
+    finishNext();
+}
+
+void ProgressStage::write(std::string_view chunk)
+{
+    for (char c : chunk) {
+        switch (m_state) {
+        case State::Text:
+            switch (c) {
+            case '\n':
+                m_out.append(m_line);
+                m_out.push_back('\n');
+                clearLine();
+                break;
+            case '\r':
+                moveTo(0);
+                break;
+            case '\b':
+                moveTo(m_col > 0 ? m_col - 1 : 0);
+                break;
+            case '\x1b':
+                m_state = State::Escape;
+                break;
+            default:
+                put(c);
+                break;
+            }
+            break;
+        case State::Escape:
+            if (c == '[') {
+                m_params.clear();
+                m_state = State::Csi;
+            } else if (c == ']') {
+                m_state = State::Osc;
+            } else {
+                m_state = State::Text; // two byte sequence, dropped
+            }
+            break;
+        case State::Csi:
+            if (c >= 0x40 && c <= 0x7E) {
+                csi(c);
+                m_state = State::Text;
+            } else {
+                m_params.push_back(c);
+            }
+            break;
+        case State::Osc:
+            if (c == '\a') {
+                m_state = State::Text;
+            } else if (c == '\x1b') {
+                m_state = State::OscEscape;
+            }
+            break;
+        case State::OscEscape:
+            m_state = c == '\\' ? State::Text : State::Osc;
+            break;
+        }
+    }
+
+    emit(m_out);
+    m_out.clear();
+}
+
+void ProgressStage::finish()
+{
+    emit(m_line);
+    clearLine();
+    m_state = State::Text;
+    finishNext();
+}
+
+void ProgressStage::put(char c)
+{
+    if (isContinuation(c)) {
+        // the remaining bytes of a UTF-8 sequence extend the character just written, a
+        // stray one is dropped rather than taking a column of its own
+        if (m_glyphEnd != std::string::npos) {
+            m_line.insert(m_glyphEnd++, 1, c);
+        }
+        return;
+    }
+
+    if (m_col < m_lineCols) {
+        const size_t begin = offsetOf(m_col);
+        size_t end = begin + 1;
+        while (end < m_line.size() && isContinuation(m_line[end])) {
+            ++end;
+        }
+        m_line.replace(begin, end - begin, 1, c);
+        m_glyphEnd = begin + 1;
+    } else {
+        m_line.append(m_col - m_lineCols, ' '); // the cursor may have moved past the end of the line
+        m_line.push_back(c);
+        m_lineCols = m_col + 1;
+        m_glyphEnd = m_line.size();
+    }
+    ++m_col;
+}
+
+void ProgressStage::moveTo(size_t col)
+{
+    m_col = col;
+    m_glyphEnd = std::string::npos;
+}
+
+void ProgressStage::clearLine()
+{
+    m_line.clear();
+    m_lineCols = 0;
+    moveTo(0);
+}
+
+size_t ProgressStage::offsetOf(size_t col) const
+{
+    size_t offset = 0;
+    for (; offset < m_line.size(); ++offset) {
+        if (!isContinuation(m_line[offset]) && col-- == 0) {
+            break;
+        }
+    }
+    return offset;
+}
+
+void ProgressStage::csi(char final)
+{
+    size_t n = 0;
+    bool hasParam = false;
+    for (char p : m_params) {
+        if (p < '0' || p > '9') {
+            break; // only the first numeric parameter matters for the sequences we handle
+        }
+        n = n * 10 + (p - '0');
+        hasParam = true;
+    }
+
+    switch (final) {
+    case 'K': // erase in line
+        if (n == 0) {
+            m_line.resize(offsetOf(m_col));
+            m_lineCols = std::min(m_lineCols, m_col);
+        } else if (n == 1) {
+            const size_t cols = std::min(m_lineCols, m_col + 1);
+            m_line.replace(0, offsetOf(cols), cols, ' ');
+        } else if (n == 2) {
+            m_line.clear();
+            m_lineCols = 0;
+        }
+        moveTo(m_col);
+        break;
+    case 'C': // cursor forward
+        moveTo(m_col + (hasParam && n > 0 ? n : 1));
+        break;
+    case 'D': // cursor back
+        moveTo(m_col - std::min(m_col, hasParam && n > 0 ? n : 1));
+        break;
+    case 'G': // cursor to column
+        moveTo(hasParam && n > 0 ? n - 1 : 0);
+        break;
+    default: // colors and everything else are dropped
+        break;
+    }
+}
+
+std::string ProgressStage::compact(std::string_view content)
+{
+    std::string result;
+
+    class StringStage : public FilterStage {
+    public:
+        explicit StringStage(std::string& dest) :
+            m_dest(dest) {}
+        void write(std::string_view chunk) override { m_dest.append(chunk); }
+
+    private:
+        std::string& m_dest;
+    } sink(result);
+
+    ProgressStage stage;
+    stage.setNext(&sink);
+    stage.write(content);
+    stage.finish();
+    return result;
+}
+
+/** Terminal stage writing into the pipeline destination */
+class FilterPipeline::StreamStage : public FilterStage {
+public:
+    explicit StreamStage(std::ostream& dest) :
+        m_dest(dest) {}
+
+    void write(std::string_view chunk) override
+    {
+        m_dest.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    }
+    void finish() override { m_dest.flush(); }
+
+private:
+    std::ostream& m_dest;
+};
+
+/** Unbuffered streambuf forwarding writes straight into the first stage */
+class FilterPipeline::Buffer : public std::streambuf {
+public:
+    explicit Buffer(FilterPipeline& pipeline) :
+        m_pipeline(pipeline) {}
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        if (!m_pipeline.m_finished) {
+            head().write(std::string_view(s, static_cast<size_t>(n)));
+        }
+        return n;
+    }
+
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            char ch = traits_type::to_char_type(c);
+            xsputn(&ch, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+private:
+    FilterStage& head()
+    {
+        if (m_pipeline.m_stages.empty()) {
+            return *m_pipeline.m_sink;
+        }
+        return *m_pipeline.m_stages.front();
+    }
+
+    FilterPipeline& m_pipeline;
+};
+
+FilterPipeline::FilterPipeline(std::ostream& dest) :
+    std::ostream(nullptr),
+    m_sink(std::make_unique<StreamStage>(dest)),
+    m_buffer(std::make_unique<Buffer>(*this))
+{
+    rdbuf(m_buffer.get());
+}
+
+FilterPipeline::~FilterPipeline() = default;
+
+FilterPipeline& FilterPipeline::append(std::unique_ptr<FilterStage> stage)
+{
+    stage->setNext(m_sink.get());
+    if (!m_stages.empty()) {
+        m_stages.back()->setNext(stage.get());
+    }
+    m_stages.push_back(std::move(stage));
+    return *this;
+}
+
+void FilterPipeline::finish()
+{
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+    if (m_stages.empty()) {
+        m_sink->finish();
+    } else {
+        m_stages.front()->finish();
+    }
+}
+
+} // namespace crew
@@ -0,0 +1,74 @@
+/**
+ * Opt-in counting of heap allocations per subsystem
+ */
+#ifndef CREW_ALLOCATION_TRACKER_HPP
+#define CREW_ALLOCATION_TRACKER_HPP
+
+#include <common/util.hpp>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace crew {
+
+class Vm;
+
+/**
+ * Counts calls to the global operator new, and the bytes requested, per subsystem. The
+ * subsystem is the innermost Profiler::Region active on the allocating thread, "other"
+ * outside of any region.
+ *
+ * Linking the tracker into an executable replaces the global operator new, which only
+ * does more than calling malloc() while tracking is enabled. Aligned allocations are
+ * not counted.
+ */
+class AllocationTracker {
+public:
+    /** Distinct region names counted separately, later ones are counted as "other" */
+    static constexpr size_t kMaxSubsystems = 32;
+
+    struct Usage {
+        std::string subsystem;
+        uint64_t allocations{};
+        uint64_t bytes{};
+    };
+
+    /** Counts of every subsystem at one point in time */
+    class Snapshot {
+    public:
+        /** Usage per subsystem since `earlier`, subsystems without allocations are omitted */
+        std::vector<Usage> since(const Snapshot& earlier) const;
+
+    private:
+        friend class AllocationTracker;
+        struct Counts {
+            uint64_t allocations{};
+            uint64_t bytes{};
+        };
+        std::array<Counts, kMaxSubsystems> m_counts{};
+    };
+
+    static void setEnabled(bool enabled);
+    static bool enabled();
+
+    static Snapshot snapshot();
+    /** Usage per subsystem since the process started */
+    static std::vector<Usage> usage() { return snapshot().since({}); }
+
+    /** Table of `usage` with a row per subsystem */
+    static std::string format(const std::vector<Usage>& usage);
+};
+
+/**
+ * Add the `stats` builtin:
+ *
+ *     stats            allocations per subsystem since the last reset
+ *     stats on|off     enable or disable allocation tracking
+ *     stats reset      count from now on
+ */
+[[nodiscard]] Result<> addStatsBuiltins(Vm& vm);
+
+} // namespace crew
+#endif
@@ -0,0 +1,61 @@
+/**
+ * A thread serving an object for as long as the object lives
+ */
+#ifndef CREW_BACKGROUND_THREAD_HPP
+#define CREW_BACKGROUND_THREAD_HPP
+
+#include <functional>
+#include <stop_token>
+#include <thread>
+
+#include <unistd.h>
+
+namespace crew {
+
+/**
+ * Runs a loop on behalf of its owner until stopped. The owner calls start() at the end of
+ * its constructor and stop() at the start of its destructor, so the loop never sees the
+ * owner half built or half destroyed wherever the member is declared. Waits in the loop
+ * should take the stop token, condition_variable_any::wait() returns when it is requested.
+ *
+ * After fork() the object is copied into the child but the thread is not, a child that
+ * exits normally leaves it alone.
+ */
+class BackgroundThread {
+public:
+    BackgroundThread() = default;
+    ~BackgroundThread() { stop(); }
+    BackgroundThread(const BackgroundThread&) = delete;
+    BackgroundThread& operator=(const BackgroundThread&) = delete;
+
+    void start(std::function<void(std::stop_token)> loop)
+    {
+        m_pid = ::getpid();
+        m_thread = std::jthread(std::move(loop));
+    }
+
+    /**
+     * Request the loop to stop and wait for it to return
+     * @return false in a forked child, where there is no thread to stop
+     */
+    bool stop()
+    {
+        if (!m_thread.joinable()) {
+            return ::getpid() == m_pid;
+        }
+        if (::getpid() != m_pid) {
+            m_thread.detach();
+            return false;
+        }
+        m_thread.request_stop();
+        m_thread.join();
+        return true;
+    }
+
+private:
+    int m_pid{};
+    std::jthread m_thread;
+};
+
+} // namespace crew
+#endif
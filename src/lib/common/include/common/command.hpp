@@ -4,21 +4,28 @@
 #ifndef CREW_COMMAND_HPP
 #define CREW_COMMAND_HPP
 
+#include <common/environment.hpp>
+#include <common/process_tree.hpp>
 #include <common/util.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <concepts>
 #include <filesystem>
-#include <functional>
 #include <iostream>
-#include <map>
 #include <optional>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace crew {
 
+class ProcessBackend;
+
 enum class OnError {
-    Fatal = 0,
+    Fatal = 0, // run() exits the process, tryRun() returns an Error
     Return,
 };
 
@@ -32,15 +39,29 @@ class [[nodiscard]] Command {
 public:
     template <typename... Args>
     explicit Command(std::string command, Args... arguments) :
-        m_command(std::move(command))
+        m_argv(std::move(command))
     {
+        m_nulInArgv = m_argv.find('\0') != std::string::npos;
+        m_argv.push_back('\0');
         args(std::forward<Args>(arguments)...);
     }
 
+    /**
+     * Build from a prepared argv buffer, the program and each argument terminated by '\0'.
+     * More terminators than the `count` strings written means one contained a '\0'.
+     */
+    static Command fromArgv(std::string argv, size_t count)
+    {
+        Command result;
+        result.m_nulInArgv = static_cast<size_t>(std::ranges::count(argv, '\0')) != count;
+        result.m_argv = std::move(argv);
+        return result;
+    }
+
     template <std::convertible_to<std::string> First, typename... Rest>
     Command& args(First&& first, Rest&&... rest) &
     {
-        m_args.emplace_back(std::forward<First>(first));
+        appendArg(std::forward<First>(first));
         args<Rest...>(std::forward<Rest>(rest)...);
         return *this;
     }
@@ -54,7 +75,7 @@ public:
     Command& args(Begin begin, End end) &
     {
         for (auto it = begin; it != end; ++it) {
-            m_args.push_back(*it);
+            appendArg(*it);
         }
         return *this;
     }
@@ -66,7 +87,13 @@ public:
 
     Command& setEnv(const std::string& k, std::string value) &
     {
-        m_envOverride[k] = std::move(value);
+        for (auto& [key, v] : m_envOverride) {
+            if (key == k) {
+                v = std::move(value);
+                return *this;
+            }
+        }
+        m_envOverride.emplace_back(k, std::move(value));
         return *this;
     }
     Command setEnv(const std::string& k, std::string value) &&
@@ -74,6 +101,20 @@ public:
         return std::move(this->setEnv(k, std::move(value)));
     }
 
+    /**
+     * Run with `environment` instead of the inherited process environment, setEnv()
+     * overrides are still applied on top of it
+     */
+    Command& setEnvironment(Environment environment) &
+    {
+        m_environment = std::move(environment);
+        return *this;
+    }
+    Command setEnvironment(Environment environment) &&
+    {
+        return std::move(this->setEnvironment(std::move(environment)));
+    }
+
     Command& setCurrentDir(std::optional<std::filesystem::path> directory) &
     {
         m_cd = std::move(directory);
@@ -100,18 +141,91 @@ public:
 
     Command& setOut(std::ostream& str) &
     {
-        m_getOut = [&str]() -> std::ostream& { return str; };
+        m_out = &str;
         return *this;
     }
     Command setOut(std::ostream& str) && { return std::move(this->setOut(str)); }
 
     Command& setErr(std::ostream& str) &
     {
-        m_getErr = [&str]() -> std::ostream& { return str; };
+        m_err = &str;
         return *this;
     }
     Command setErr(std::ostream& str) && { return std::move(this->setErr(str)); }
 
+    /** Hint that the child produces a lot of output, enlarges the pipes it writes to */
+    Command& setHighVolume(bool highVolume) &
+    {
+        m_highVolume = highVolume;
+        return *this;
+    }
+    Command setHighVolume(bool highVolume) && { return std::move(this->setHighVolume(highVolume)); }
+
+    /**
+     * Share the execution of identical commands running concurrently (same argv,
+     * environment and working directory): rather than spawning again, a duplicate
+     * receives the output and exit code of the one already running
+     */
+    Command& setSingleFlight(bool singleFlight) &
+    {
+        m_singleFlight = singleFlight;
+        return *this;
+    }
+    Command setSingleFlight(bool singleFlight) && { return std::move(this->setSingleFlight(singleFlight)); }
+
+    /**
+     * Kill the command and its process group if it runs longer than `timeout`, tryRun()
+     * then returns an Error
+     */
+    Command& setTimeout(std::optional<std::chrono::milliseconds> timeout) &
+    {
+        m_timeout = timeout;
+        return *this;
+    }
+    Command setTimeout(std::optional<std::chrono::milliseconds> timeout) && { return std::move(this->setTimeout(timeout)); }
+
+    /** Kill the command and its process group when `token` is stopped, tryRun() then returns an Error */
+    Command& setStopToken(std::stop_token token) &
+    {
+        m_stopToken = std::move(token);
+        return *this;
+    }
+    Command setStopToken(std::stop_token token) && { return std::move(this->setStopToken(std::move(token))); }
+
+    /**
+     * Start the command in a session of its own rather than only a process group, detaching
+     * it from the terminal so it has none to prompt on and Ctrl-C only reaches it through
+     * ProcessTree::interruptAll(). Ptys always get a session of their own.
+     */
+    Command& setNewSession(bool newSession) &
+    {
+        m_newSession = newSession;
+        return *this;
+    }
+    Command setNewSession(bool newSession) && { return std::move(this->setNewSession(newSession)); }
+
+    /**
+     * Also confine the command to a cgroup of its own, so descendants that start their
+     * own session are torn down with it and none outlive it. Best effort, see ProcessTree.
+     */
+    Command& setCgroup(bool cgroup) &
+    {
+        m_cgroup = cgroup;
+        return *this;
+    }
+    Command setCgroup(bool cgroup) && { return std::move(this->setCgroup(cgroup)); }
+
+    /**
+     * Run the process through `backend`, e.g. a SimulatedBackend, rather than spawning
+     * a real one. The backend must outlive the command's runs, nullptr restores spawning.
+     */
+    Command& setBackend(ProcessBackend* backend) &
+    {
+        m_backend = backend;
+        return *this;
+    }
+    Command setBackend(ProcessBackend* backend) && { return std::move(this->setBackend(backend)); }
+
     Command& onError(OnError onError) &
     {
         m_onError = onError;
@@ -122,32 +236,73 @@ public:
     /** Execute the child process, block until it finishes and return its exit code */
     int run(RunMode mode = RunMode::Block);
 
+    /**
+     * Execute the child process and block until it finishes. Failures to spawn or reap
+     * the child, arguments containing a NUL byte, and non-zero exits under
+     * OnError::Fatal are returned as an Error rather than terminating the current process.
+     */
+    Result<int> tryRun(RunMode mode = RunMode::Block);
+
     /** Report the command line as a string */
     std::string toString() const
     {
-        std::string result = m_command;
-        for (const auto& a : m_args) {
-            result += " ";
-            result += a;
+        std::string result = m_argv;
+        result.pop_back();
+        std::replace(result.begin(), result.end(), '\0', ' ');
+        return result;
+    }
+
+    /** Name or path of the program to execute */
+    std::string_view program() const { return m_argv.c_str(); }
+
+    /** Program followed by its arguments */
+    std::vector<std::string_view> argv() const
+    {
+        std::vector<std::string_view> result;
+        for (size_t pos = 0; pos < m_argv.size(); pos = m_argv.find('\0', pos) + 1) {
+            result.emplace_back(m_argv.c_str() + pos);
         }
         return result;
     }
 
+    const std::optional<std::filesystem::path>& currentDir() const { return m_cd; }
+    const std::vector<std::pair<std::string, std::string>>& envOverrides() const { return m_envOverride; }
+    const std::optional<Environment>& environment() const { return m_environment; }
+    const std::optional<std::chrono::milliseconds>& timeout() const { return m_timeout; }
+    const std::stop_token& stopToken() const { return m_stopToken; }
+    bool verbose() const { return m_verbose; }
+    bool dryRun() const { return m_dryRun; }
+    bool highVolume() const { return m_highVolume; }
+    bool singleFlight() const { return m_singleFlight; }
+    bool newSession() const { return m_newSession; }
+    bool cgroup() const { return m_cgroup; }
+    ProcessBackend* backend() const { return m_backend; }
+
+    std::ostream& outStream() { return *m_out; }
+    std::ostream& errStream() { return *m_err; }
+
 protected:
-    std::ostream& outStream() { return m_getOut(); }
-    std::ostream& errStream() { return m_getErr(); }
+    /** Spawn the child process and return its exit code, whatever it is */
+    Result<int> execute(RunMode mode);
 
     /** Use pipes to receive child stdout, stderr */
-    int runPipe();
+    Result<int> runPipe();
     /** Use a pty to receive child stdout */
-    int runPty();
+    Result<int> runPty();
     /** Replace the current process with the command */
     [[noreturn]] int execPty();
 
     /** Called from the child process to replace the current process with the specified command */
     void replaceProcessImage();
 
+    /** Options for the ProcessTree of a run starting now */
+    ProcessTree::Options treeOptions() const;
+    /** The child was reaped with `exitCode`, fail if its tree was killed */
+    Result<int> treeResult(const ProcessTree& tree, Result<int> exitCode) const;
+
 private:
+    Command() = default;
+
     // recursive base case for the args(T...) methods
     template <typename None = void>
     Command& args() &
@@ -155,22 +310,46 @@ private:
         return *this;
     }
 
-    // streams to populate with child process output
-    std::function<std::ostream&()> m_getOut = []() -> std::ostream& {
-        return std::cout;
-    };
+    /** An argument containing '\0' cannot be passed to exec, it is left out and tryRun() fails */
+    template <typename T>
+    void appendArg(const T& arg)
+    {
+        const auto append = [this](std::string_view view) {
+            if (view.find('\0') != std::string_view::npos) {
+                m_nulInArgv = true;
+                return;
+            }
+            m_argv.append(view);
+            m_argv.push_back('\0');
+        };
+        if constexpr (std::convertible_to<const T&, std::string_view>) {
+            append(std::string_view(arg));
+        } else {
+            append(std::string(arg));
+        }
+    }
 
-    std::function<std::ostream&()> m_getErr = []() -> std::ostream& {
-        return std::cerr;
-    };
+    // streams to populate with child process output
+    std::ostream* m_out = &std::cout;
+    std::ostream* m_err = &std::cerr;
 
     OnError m_onError = OnError::Fatal;
     bool m_verbose{};
     bool m_dryRun{};
-    std::string m_command;
-    std::vector<std::string> m_args;
+    bool m_highVolume{};
+    bool m_singleFlight{};
+    bool m_newSession{};
+    bool m_cgroup{};
+    bool m_nulInArgv{}; // the program or an argument contained '\0', see appendArg()
+    ProcessBackend* m_backend = nullptr; // spawn real processes if null
+    std::optional<std::chrono::milliseconds> m_timeout;
+    std::stop_token m_stopToken;
+    // program followed by its arguments, each terminated by '\0', so that the whole
+    // command line lives in one allocation (or inline, for short commands)
+    std::string m_argv;
     std::optional<std::filesystem::path> m_cd;
-    std::map<std::string, std::string> m_envOverride;
+    std::optional<Environment> m_environment;
+    std::vector<std::pair<std::string, std::string>> m_envOverride; // few entries, searched linearly
 };
 } // namespace crew
 #endif
@@ -0,0 +1,168 @@
+/**
+ * Commands whose program and fixed arguments are known at compile time
+ */
+#ifndef CREW_COMMAND_SPEC_HPP
+#define CREW_COMMAND_SPEC_HPP
+
+#include <common/command.hpp>
+#include <common/interpreter.hpp>
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace crew {
+
+/** String literal usable as a template argument */
+template <size_t N>
+struct FixedString {
+    char data[N]{};
+
+    constexpr FixedString(const char (&s)[N]) { std::copy_n(s, N, data); }
+
+    constexpr std::string_view view() const { return {data, N - 1}; }
+    /** The string including its terminating '\0', as laid out in an argv buffer */
+    constexpr std::string_view terminated() const { return {data, N}; }
+};
+
+/** A fixed argument of a CommandSpec */
+template <FixedString Value>
+struct Lit {
+};
+
+/** A runtime argument of a CommandSpec, `Type` names the Vm param type it must satisfy */
+template <FixedString Type>
+struct Param {
+};
+
+namespace detail {
+template <typename T>
+struct SpecPart;
+
+template <FixedString Value>
+struct SpecPart<Lit<Value>> {
+    static constexpr bool isParam = false;
+    static constexpr std::string_view type = {};
+    static constexpr std::string_view text = Value.view();
+};
+
+template <FixedString Type>
+struct SpecPart<Param<Type>> {
+    static constexpr bool isParam = true;
+    static constexpr std::string_view type = Type.view();
+    static constexpr std::string_view text = {};
+};
+
+constexpr bool isPathType(std::string_view type)
+{
+    return type == "file" || type == "directory";
+}
+
+/** Vm params of path types also accept std::filesystem::path, everything accepts strings */
+template <typename Value, bool PathType>
+concept AcceptedBy = std::convertible_to<const Value&, std::string_view>
+        || (PathType && std::same_as<std::remove_cvref_t<Value>, std::filesystem::path>);
+
+template <typename Value>
+std::string_view argView(const Value& value)
+{
+    if constexpr (std::convertible_to<const Value&, std::string_view>) {
+        return value;
+    } else {
+        return value.native();
+    }
+}
+
+template <typename... Parts>
+constexpr auto paramTypes()
+{
+    std::array<std::string_view, (SpecPart<Parts>::isParam + ... + 0)> result{};
+    size_t i = 0;
+    ((SpecPart<Parts>::isParam ? void(result[i++] = SpecPart<Parts>::type) : void()), ...);
+    return result;
+}
+} // namespace detail
+
+/**
+ * Compile time description of a command line, e.g.
+ *
+ *     using Greet = CommandSpec<"bash", Lit<"-c">, Param<"string">>;
+ *     Greet::make("echo hello").run();
+ *
+ * The fixed parts of argv are laid out at compile time, so building a Command costs a
+ * single allocation, and the number and types of runtime arguments are checked at
+ * compile time against the Vm param types named by each Param.
+ */
+template <FixedString Program, typename... Parts>
+class CommandSpec {
+public:
+    /** Vm param types of the runtime arguments, in order */
+    static constexpr auto kParamTypes = detail::paramTypes<Parts...>();
+    static constexpr size_t kNumParams = kParamTypes.size();
+
+    /** argv of the command, runtime argument slots are empty */
+    static constexpr std::array<std::string_view, 1 + sizeof...(Parts)> kArgv{
+            Program.view(), detail::SpecPart<Parts>::text...};
+
+    /** Bytes taken by the fixed parts of argv, including terminators */
+    static constexpr size_t kFixedSize = Program.terminated().size()
+            + ((detail::SpecPart<Parts>::text.size() + 1) + ... + 0);
+
+    /** Whether `Values` are valid runtime arguments, in number and type */
+    template <typename... Values>
+    static constexpr bool accepts()
+    {
+        if constexpr (sizeof...(Values) != kNumParams) {
+            return false;
+        } else {
+            return acceptsAt<Values...>(std::make_index_sequence<kNumParams>{});
+        }
+    }
+
+    template <typename... Values, size_t... I>
+    static constexpr bool acceptsAt(std::index_sequence<I...>)
+    {
+        return (detail::AcceptedBy<Values, detail::isPathType(kParamTypes[I])> && ... && true);
+    }
+
+    template <typename... Values>
+        requires(accepts<Values...>())
+    static Command make(const Values&... values)
+    {
+        const std::array<std::string_view, kNumParams> views{detail::argView(values)...};
+
+        std::string argv;
+        size_t size = kFixedSize;
+        for (auto v : views) {
+            size += v.size();
+        }
+        argv.reserve(size);
+
+        argv.append(Program.terminated());
+        size_t param = 0;
+        const auto appendPart = [&]<typename Part>() {
+            if constexpr (detail::SpecPart<Part>::isParam) {
+                argv.append(views[param++]);
+            } else {
+                argv.append(detail::SpecPart<Part>::text);
+            }
+            argv.push_back('\0');
+        };
+        (appendPart.template operator()<Parts>(), ...);
+
+        return Command::fromArgv(std::move(argv), 1 + sizeof...(Parts));
+    }
+
+    /** Define this spec as command `id` in `vm`, fails if the vm lacks one of the param types */
+    [[nodiscard]] static Result<> addTo(Vm& vm, const std::string& id)
+    {
+        return vm.addCommand(id, std::vector<std::string>(kParamTypes.begin(), kParamTypes.end()));
+    }
+};
+
+} // namespace crew
+#endif
@@ -0,0 +1,81 @@
+/**
+ * Block compression for retained command output (scrollback, captured logs)
+ */
+#ifndef CREW_COMPRESS_HPP
+#define CREW_COMPRESS_HPP
+
+#include <common/util.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace crew {
+
+/** Largest block accepted by lzCompressBlock, match offsets are encoded in 16 bits */
+constexpr size_t kLzMaxBlockSize = 64 * 1024;
+
+/**
+ * Compress a block of at most kLzMaxBlockSize bytes with a byte oriented LZ77 codec
+ * (LZ4-style sequences of literals followed by a back reference)
+ */
+std::string lzCompressBlock(std::string_view input);
+
+/** Decompress a block produced by lzCompressBlock, appending exactly `rawSize` bytes to `out` */
+Result<> lzDecompressBlock(std::string_view block, size_t rawSize, std::string& out);
+
+/**
+ * Append-only byte buffer which compresses each full block as it is sealed. Recent
+ * output stays uncompressed in a hot tail until a block fills or seal() is called.
+ */
+class CompressedBuffer {
+public:
+    void append(std::string_view bytes);
+    /** Compress the hot tail so that all retained bytes are cold */
+    void seal();
+
+    /** Decompress the full contents */
+    Result<std::string> str() const;
+    /** Decompress block by block into `dest` without materializing the full contents */
+    Result<> replay(std::ostream& dest) const;
+
+    /** Uncompressed size of the contents */
+    size_t size() const { return m_size; }
+    /** Bytes actually retained for the contents */
+    size_t compressedSize() const;
+    bool empty() const { return m_size == 0; }
+
+private:
+    void sealBlock(std::string_view raw);
+
+    struct Block {
+        std::string data;
+        uint32_t rawSize{};
+        bool stored{}; // data is uncompressed, compression did not reduce its size
+    };
+    std::vector<Block> m_blocks;
+    std::string m_hot;
+    size_t m_size{};
+};
+
+/** Output stream retaining everything written to it in a CompressedBuffer, e.g. for Command::setOut */
+class CompressedCapture : public std::ostream {
+public:
+    CompressedCapture();
+    ~CompressedCapture() override;
+
+    const CompressedBuffer& buffer() const { return m_buffer; }
+    CompressedBuffer& buffer() { return m_buffer; }
+
+private:
+    class StreamBuffer;
+
+    CompressedBuffer m_buffer;
+    std::unique_ptr<StreamBuffer> m_streamBuffer;
+};
+
+} // namespace crew
+#endif
@@ -0,0 +1,69 @@
+/**
+ * Immutable, shareable process environments for spawning commands
+ */
+#ifndef CREW_ENVIRONMENT_HPP
+#define CREW_ENVIRONMENT_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace crew {
+
+/**
+ * An immutable set of environment variables. Copies are cheap and share state,
+ * with()/without() return a new Environment layered over this one rather than
+ * copying it. The flat envp array handed to exec is built once per Environment and
+ * shared by every copy, so a pool spawning many commands with the same Environment
+ * pays for it once.
+ */
+class Environment {
+public:
+    /** An empty environment */
+    Environment();
+
+    /** Snapshot of the current process environment */
+    static Environment inherited();
+    /** The variables of a null terminated "KEY=VALUE" array, as envp() returns */
+    static Environment fromEnvp(const char* const* envp);
+
+    /** Copy with `key` set to `value` */
+    [[nodiscard]] Environment with(std::string key, std::string value) const;
+    /** Copy with `key` removed */
+    [[nodiscard]] Environment without(std::string key) const;
+
+    std::optional<std::string_view> get(std::string_view key) const;
+
+    /** Null terminated "KEY=VALUE" array, built on first use. Must not be modified. */
+    char* const* envp() const;
+    /** Number of variables defined */
+    size_t size() const;
+
+private:
+    struct Layer {
+        std::shared_ptr<const Layer> parent;
+        std::map<std::string, std::optional<std::string>, std::less<>> overlay; // nullopt removes a key
+        size_t depth{};
+
+        // flattened view, built once
+        mutable std::once_flag flattened;
+        mutable std::vector<std::string> entries;
+        mutable std::vector<char*> envp;
+    };
+
+    explicit Environment(std::shared_ptr<const Layer> layer) :
+        m_layer(std::move(layer)) {}
+
+    [[nodiscard]] Environment layered(std::string key, std::optional<std::string> value) const;
+    std::map<std::string, std::string, std::less<>> merged() const;
+    const Layer& flat() const;
+
+    std::shared_ptr<const Layer> m_layer;
+};
+
+} // namespace crew
+#endif
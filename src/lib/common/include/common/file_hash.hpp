@@ -0,0 +1,81 @@
+/**
+ * Fast file fingerprints, computed on a thread pool and cached on disk
+ */
+#ifndef CREW_FILE_HASH_HPP
+#define CREW_FILE_HASH_HPP
+
+#include <common/util.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace crew {
+
+/**
+ * XXH64 of `bytes`: a non-cryptographic hash consuming 32 byte stripes in four
+ * independent lanes, so it runs at memory bandwidth on superscalar/SIMD hardware.
+ */
+uint64_t hash64(std::string_view bytes, uint64_t seed = 0);
+
+/**
+ * Hashes files, remembering the hash of each file by its (device, inode, size, mtime).
+ * A file whose metadata is unchanged is never read again, including across runs when
+ * the cache is loaded from and saved to a file. Only the entries of files hashed since
+ * the cache was loaded are saved, so those of changed and deleted files age out.
+ *
+ *     FileHasher hasher(".crew/hashes");
+ *     hasher.load();
+ *     auto hashes = hasher.hashAll(paths);
+ *     hasher.save();
+ */
+class FileHasher {
+public:
+    /** @param cacheFile - where load()/save() keep the cache, in memory only if not set */
+    explicit FileHasher(std::optional<std::filesystem::path> cacheFile = {});
+
+    /** Read the cache file, a missing file is an empty cache */
+    Result<> load();
+    /** Write the cache file atomically, replacing it, with the entries used by this run */
+    Result<> save() const;
+
+    Result<uint64_t> hash(const std::filesystem::path& path);
+    /** Hash many files on a thread pool, results are in the order of `paths` */
+    std::vector<Result<uint64_t>> hashAll(const std::vector<std::filesystem::path>& paths);
+    /** Hash every regular file below `root` */
+    Result<std::map<std::filesystem::path, uint64_t>> hashTree(const std::filesystem::path& root);
+
+    struct Stats {
+        uint64_t hits{}; // served from the cache
+        uint64_t misses{}; // read and hashed
+    };
+    Stats stats() const;
+    size_t cacheSize() const;
+
+private:
+    struct Key {
+        uint64_t device{};
+        uint64_t inode{};
+        uint64_t size{};
+        int64_t mtimeNs{};
+
+        auto operator<=>(const Key&) const = default;
+    };
+
+    std::optional<std::filesystem::path> m_cacheFile;
+    mutable std::mutex m_mutex;
+    struct Entry {
+        uint64_t hash{};
+        bool used{}; // looked up or hashed since loading, kept on save
+    };
+
+    std::map<Key, Entry> m_cache;
+    Stats m_stats;
+};
+
+} // namespace crew
+#endif
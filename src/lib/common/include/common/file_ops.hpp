@@ -0,0 +1,60 @@
+/**
+ * In-process file operations (cp, ln, mkdir -p, rm -r) usable as Vm builtins
+ */
+#ifndef CREW_FILE_OPS_HPP
+#define CREW_FILE_OPS_HPP
+
+#include <common/util.hpp>
+
+#include <cstdint>
+#include <filesystem>
+
+namespace crew {
+
+class Vm;
+
+/**
+ * Copy a regular file's contents and permissions. Tries a reflink (shared extents on
+ * filesystems supporting it), then copy_file_range so the kernel copies without a round
+ * trip through user space, then plain read/write. Fails without truncating if `to` is
+ * `from` under another name.
+ */
+Result<> copyFile(const std::filesystem::path& from, const std::filesystem::path& to);
+
+/**
+ * Copy a directory tree, symlinks are copied as links. Subdirectories are copied in parallel.
+ * Refuses a `to` inside `from`, whose copy would never end.
+ */
+Result<> copyTree(const std::filesystem::path& from, const std::filesystem::path& to);
+
+/** Create a directory and any missing parents, succeeding if it already exists */
+Result<> makeDirectories(const std::filesystem::path& path);
+
+/**
+ * Create `link` pointing at `target`, a symlink if `symbolic` otherwise a hard link.
+ * An existing `link` is replaced only if `force`.
+ */
+Result<> makeLink(const std::filesystem::path& target, const std::filesystem::path& link, bool symbolic, bool force);
+
+/**
+ * Remove a file or directory tree, traversing subdirectories in parallel. Returns the
+ * number of entries removed, 0 if `path` did not exist. Like rm, refuses the root
+ * directory and paths ending in . or ..
+ */
+Result<uint64_t> removeTree(const std::filesystem::path& path);
+
+/**
+ * Register cp, ln, mkdir and rm builtins with a subset of the coreutils flags:
+ *
+ *     cp [-r] SOURCE... DEST
+ *     ln [-s] [-f] [-i] TARGET [LINK]
+ *     mkdir [-p] DIRECTORY...
+ *     rm [-r] [-f] PATH...
+ *
+ * As with coreutils, a DEST or LINK naming an existing directory places the copy or
+ * link inside it. -i never overwrites, as there is no one to prompt.
+ */
+[[nodiscard]] Result<> addFileBuiltins(Vm& vm);
+
+} // namespace crew
+#endif
@@ -0,0 +1,190 @@
+/**
+ * In-process filter stages (grep, head, tail, line count, progress compaction) for command output
+ */
+#ifndef CREW_FILTER_HPP
+#define CREW_FILTER_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace crew {
+
+/**
+ * A single stage of an output pipeline. Stages receive arbitrary chunks of bytes
+ * (not aligned to line boundaries) and forward whatever they keep to the next stage.
+ */
+class FilterStage {
+public:
+    virtual ~FilterStage() = default;
+
+    /** Receive a chunk of bytes from upstream */
+    virtual void write(std::string_view chunk) = 0;
+    /** Upstream is exhausted, emit any retained state and finish the next stage */
+    virtual void finish() { finishNext(); }
+
+    void setNext(FilterStage* next) { m_next = next; }
+
+protected:
+    void emit(std::string_view bytes)
+    {
+        if (m_next != nullptr && !bytes.empty()) {
+            m_next->write(bytes);
+        }
+    }
+    void finishNext()
+    {
+        if (m_next != nullptr) {
+            m_next->finish();
+        }
+    }
+
+private:
+    FilterStage* m_next = nullptr;
+};
+
+/** Pass through lines containing a fixed substring */
+class GrepStage : public FilterStage {
+public:
+    explicit GrepStage(std::string pattern, bool invert = false) :
+        m_pattern(std::move(pattern)), m_invert(invert) {}
+
+    void write(std::string_view chunk) override;
+    void finish() override;
+
+private:
+    /** Filter a run of complete lines, `lines` must end in '\n' */
+    void filterLines(std::string_view lines);
+
+    std::string m_pattern;
+    bool m_invert{};
+    std::string m_partial; // incomplete trailing line from the previous chunk
+};
+
+/** Pass through the first `count` lines, discarding the rest */
+class HeadStage : public FilterStage {
+public:
+    explicit HeadStage(size_t count) :
+        m_remaining(count) {}
+
+    void write(std::string_view chunk) override;
+
+private:
+    size_t m_remaining{};
+};
+
+/** Retain only the last `count` lines in a ring buffer, emitted when upstream finishes */
+class TailStage : public FilterStage {
+public:
+    explicit TailStage(size_t count) :
+        m_ring(count) {}
+
+    void write(std::string_view chunk) override;
+    void finish() override;
+
+private:
+    void pushLine(std::string_view line);
+
+    std::vector<std::string> m_ring;
+    size_t m_next{}; // slot the next complete line is written to
+    size_t m_size{}; // number of valid lines in the ring
+    std::string m_partial;
+};
+
+/** Count newline terminated lines (plus an unterminated final line), emitting the count on finish */
+class CountStage : public FilterStage {
+public:
+    void write(std::string_view chunk) override;
+    void finish() override;
+
+    uint64_t lines() const { return m_lines + (m_midLine ? 1 : 0); }
+
+private:
+    uint64_t m_lines{};
+    bool m_midLine{};
+};
+
+/**
+ * Apply terminal line overwrite semantics so only the final state of each line is kept:
+ * '\r' returns to the start of the line and later output overwrites it, '\b' and cursor
+ * movement (CSI C/D/G) move within the line and CSI K erases. Other escape sequences
+ * (colors, OSC titles) are dropped. Lines are emitted once terminated by '\n'.
+ *
+ * Columns are counted in UTF-8 code points, so overwriting never splits a character.
+ * Wide characters take a single column like any other.
+ */
+class ProgressStage : public FilterStage {
+public:
+    void write(std::string_view chunk) override;
+    void finish() override;
+
+    /** Compact a complete piece of output in one go */
+    static std::string compact(std::string_view content);
+
+private:
+    enum class State {
+        Text,
+        Escape, // after ESC
+        Csi, // after ESC [
+        Osc, // after ESC ], until BEL or ESC backslash
+        OscEscape,
+    };
+
+    void put(char c);
+    void csi(char final);
+    void moveTo(size_t col);
+    void clearLine();
+    /** Byte offset of the code point at `col`, the end of the line past its last one */
+    size_t offsetOf(size_t col) const;
+
+    State m_state = State::Text;
+    std::string m_line; // current line in its latest state
+    size_t m_lineCols{}; // code points in m_line
+    size_t m_col{}; // cursor column, in code points
+    size_t m_glyphEnd = std::string::npos; // byte offset past the character just put, npos once the cursor moved
+    std::string m_params; // parameters of the pending CSI sequence
+    std::string m_out; // completed lines of the current chunk
+};
+
+/**
+ * Chain of filter stages ending in a destination stream. The pipeline is itself a
+ * std::ostream, so it can be handed directly to Command::setOut/setErr:
+ *
+ *     FilterPipeline errors(std::cout);
+ *     errors.grep("error:").tail(20);
+ *     Command("make").setOut(errors).run();
+ *     errors.finish();
+ */
+class FilterPipeline : public std::ostream {
+public:
+    explicit FilterPipeline(std::ostream& dest);
+    ~FilterPipeline() override;
+
+    FilterPipeline& grep(std::string pattern) { return append(std::make_unique<GrepStage>(std::move(pattern))); }
+    FilterPipeline& grepInverted(std::string pattern) { return append(std::make_unique<GrepStage>(std::move(pattern), true)); }
+    FilterPipeline& head(size_t count) { return append(std::make_unique<HeadStage>(count)); }
+    FilterPipeline& tail(size_t count) { return append(std::make_unique<TailStage>(count)); }
+    FilterPipeline& countLines() { return append(std::make_unique<CountStage>()); }
+    FilterPipeline& compactProgress() { return append(std::make_unique<ProgressStage>()); }
+
+    /** Add a custom stage to the end of the pipeline */
+    FilterPipeline& append(std::unique_ptr<FilterStage> stage);
+
+    /** Signal end of input, flushing retained state (tail ring, partial lines, counts) to the destination */
+    void finish();
+
+private:
+    class Buffer;
+    class StreamStage;
+
+    std::unique_ptr<StreamStage> m_sink;
+    std::vector<std::unique_ptr<FilterStage>> m_stages;
+    std::unique_ptr<Buffer> m_buffer;
+    bool m_finished{};
+};
+
+} // namespace crew
+#endif
@@ -20,23 +20,25 @@ struct VmParam {
     std::function<bool(const std::string&)> validate;
 };
 
+/** Implementation of a command run inside the interpreter process rather than spawned */
+using VmBuiltin = std::function<Result<int>(const std::vector<std::string>& args, std::ostream& out)>;
+
 class VmCommand {
 public:
     size_t numParams() const { return m_posParams.size(); }
-    const VmParam& param(size_t argPos) const
-    {
-        auto ptr = m_posParams.at(argPos);
-        if (ptr == nullptr) {
-            fatal("no param at {:d}", argPos);
-        }
-        return *ptr;
-    }
+    /** @pre argPos < numParams() */
+    const VmParam& param(size_t argPos) const { return *m_posParams.at(argPos); }
 
-    VmCommand(std::vector<const VmParam*> params) :
-        m_posParams(std::move(params)) {}
+    /** Empty unless the command is a builtin */
+    const VmBuiltin& builtin() const { return m_builtin; }
+
+    /** @param params - non-null pointers to params owned by the Vm */
+    VmCommand(std::vector<const VmParam*> params, VmBuiltin builtin = {}) :
+        m_posParams(std::move(params)), m_builtin(std::move(builtin)) {}
 
 private:
     std::vector<const VmParam*> m_posParams;
+    VmBuiltin m_builtin;
 };
 
 struct ParseResult {
@@ -77,22 +79,46 @@ public:
         m_params[id] = std::make_unique<VmParam>(VmParam{id, validator});
     }
 
-    void addCommand(const std::string& id, const std::vector<std::string>& paramIds)
+    /** Define a command, fails if any of the param ids have not been added */
+    [[nodiscard]] Result<> addCommand(const std::string& id, const std::vector<std::string>& paramIds)
+    {
+        return addBuiltin(id, paramIds, {});
+    }
+
+    /** Define a command implemented by `builtin`, fails if any of the param ids have not been added */
+    [[nodiscard]] Result<> addBuiltin(const std::string& id, const std::vector<std::string>& paramIds, VmBuiltin builtin)
     {
         std::vector<const VmParam*> params{};
         for (const auto& p : paramIds) {
-            params.push_back(&getParam(p));
+            auto param = getParam(p);
+            if (!param) {
+                return std::unexpected(param.error());
+            }
+            params.push_back(*param);
+        }
+        m_commands.try_emplace(id, std::make_unique<VmCommand>(std::move(params), std::move(builtin)));
+        return {};
+    }
+
+    /** Run a parsed builtin command, returning its exit code */
+    Result<int> execute(const ParseResult& parsed, std::ostream& out) const
+    {
+        if (parsed.command == nullptr) {
+            return makeError("unknown command {:s}", parsed.commandName);
+        }
+        if (!parsed.command->builtin()) {
+            return makeError("{:s} is not a builtin", parsed.commandName);
         }
-        m_commands.try_emplace(id, std::make_unique<VmCommand>(std::move(params)));
+        return parsed.command->builtin()(parsed.args, out);
     }
 
     /** get a stable pointer to a param definition */
-    const VmParam& getParam(const std::string& id)
+    Result<const VmParam*> getParam(const std::string& id)
     {
         if (auto it = m_params.find(id); it != m_params.end()) {
-            return *it->second;
+            return it->second.get();
         }
-        fatal("invalid param id {:s}", id);
+        return makeError("invalid param id {:s}", id);
     }
 
     /** get a stable pointer to a command definition, or nullptr if it doesnt exist */
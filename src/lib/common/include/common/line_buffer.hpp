@@ -0,0 +1,124 @@
+/**
+ * Gap buffer holding a single line being edited
+ */
+#ifndef CREW_LINE_BUFFER_HPP
+#define CREW_LINE_BUFFER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace crew {
+
+/**
+ * Text of one line with a cursor, stored as a gap buffer: the free space sits at the
+ * cursor so inserting and erasing there is O(1) amortized, and moving the cursor costs
+ * the distance moved. This keeps editing in the middle of very long lines (pasted
+ * argument lists several KB long) cheap.
+ *
+ * The cursor is a byte offset which always lies on a UTF-8 character boundary. Its
+ * screen column (one per code point) is maintained incrementally as it moves.
+ *
+ * Edits are recorded in an operation log for undo/redo. Each entry holds only the
+ * inserted or erased text and its offset, and consecutive keystrokes of the same kind
+ * are coalesced into one entry, so history costs memory per edit rather than per line.
+ */
+class LineBuffer {
+public:
+    /** Insert text before the cursor, leaving the cursor after it */
+    void insert(std::string_view text);
+    /** Erase the character before the cursor (backspace), false if at the start */
+    bool eraseBefore();
+    /** Erase the character after the cursor (delete), false if at the end */
+    bool eraseAfter();
+    /** Erase everything, which can be undone */
+    void clear();
+    /** Erase everything and forget the undo history, e.g. once the line is submitted */
+    void reset();
+
+    /** Revert the most recent edit, false if there is none */
+    bool undo();
+    /** Reapply the most recently undone edit, false if there is none */
+    bool redo();
+    /** Stop coalescing, so the next edit starts its own undo entry */
+    void breakUndoGroup() { m_coalesce = false; }
+
+    /** Move one character left, false if at the start */
+    bool moveLeft();
+    /** Move one character right, false if at the end */
+    bool moveRight();
+    void moveHome() { moveTo(0); }
+    void moveEnd() { moveTo(size()); }
+    /** Move the cursor to a byte offset, which must be a character boundary */
+    void moveTo(size_t offset)
+    {
+        breakUndoGroup();
+        moveGap(offset);
+    }
+
+    /** Byte offset of the cursor */
+    size_t cursor() const { return m_gapStart; }
+    /** Screen column of the cursor */
+    size_t cursorColumn() const { return m_cursorColumn; }
+    /** Size of the contents in bytes */
+    size_t size() const { return m_data.size() - gapSize(); }
+    /** Screen columns taken by the contents */
+    size_t columns() const { return m_columns; }
+    bool empty() const { return size() == 0; }
+
+    std::string_view beforeCursor() const { return {m_data.data(), m_gapStart}; }
+    std::string_view afterCursor() const { return {m_data.data() + m_gapEnd, m_data.size() - m_gapEnd}; }
+    std::string str() const;
+
+    /**
+     * Contents of the screen columns [firstColumn, firstColumn + count), found by walking
+     * from the cursor so the cost depends on the distance from it rather than the line length
+     */
+    std::string slice(size_t firstColumn, size_t count) const;
+
+    /** Most undo entries retained, older ones are dropped */
+    static constexpr size_t kMaxUndo = 1000;
+
+private:
+    struct Edit {
+        enum class Kind : uint8_t {
+            Insert,
+            EraseBefore, // backspace
+            EraseAfter, // delete
+        };
+        Kind kind{};
+        size_t offset{};
+        std::string text;
+    };
+
+    /** Primitive edits, not recorded */
+    void rawInsert(std::string_view text);
+    std::string rawErase(size_t offset, size_t length);
+    void moveGap(size_t offset);
+
+    /** Log an edit, merging it into the previous entry when it continues it */
+    void record(Edit::Kind kind, size_t offset, std::string text);
+    /** Apply an edit, or its inverse */
+    void apply(const Edit& edit, bool inverse);
+
+    size_t gapSize() const { return m_gapEnd - m_gapStart; }
+    /** Byte at a logical offset, skipping the gap */
+    char at(size_t offset) const { return offset < m_gapStart ? m_data[offset] : m_data[offset + gapSize()]; }
+    /** Grow the gap to hold at least `bytes` more */
+    void reserveGap(size_t bytes);
+
+    std::vector<char> m_data;
+    size_t m_gapStart{}; // also the cursor
+    size_t m_gapEnd{};
+    size_t m_cursorColumn{};
+    size_t m_columns{};
+
+    std::deque<Edit> m_undo;
+    std::vector<Edit> m_redo;
+    bool m_coalesce{};
+};
+
+} // namespace crew
+#endif
@@ -0,0 +1,117 @@
+/**
+ * Asynchronous logger writing structured lines from a background thread
+ */
+#ifndef CREW_LOGGER_HPP
+#define CREW_LOGGER_HPP
+
+#include <common/background_thread.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace crew {
+
+enum class LogLevel {
+    Debug = 0,
+    Info,
+    Warning,
+    Error,
+};
+
+/** A key=value pair appended to a log line */
+struct LogField {
+    template <typename T>
+    LogField(std::string_view key, const T& value) :
+        key(key), value(fmt::format("{}", value)) {}
+
+    std::string_view key;
+    std::string value;
+};
+
+/**
+ * Log lines are formatted on the calling thread and appended to a ring buffer owned by
+ * that thread, which a background thread drains to the sink. The thread sleeps until a
+ * line is logged. Logging takes no lock and
+ * does no I/O unless the thread's buffer is full, in which case the caller waits for the
+ * flusher rather than dropping the line. Lines of one thread stay in order, lines of
+ * different threads are interleaved whole.
+ *
+ * A line is "message key=value ...", values containing spaces or quotes are quoted.
+ * Warnings and errors are prefixed with their level.
+ */
+class Logger {
+public:
+    struct Options {
+        std::ostream* sink = &std::cerr;
+        size_t bufferSize = 64 * 1024; // per thread, lines longer than this are written directly
+        std::chrono::milliseconds interval{10}; // lines are gathered for this long before a drain
+    };
+
+    explicit Logger(Options options);
+    Logger() :
+        Logger(Options{}) {}
+    /** Writes out everything logged before returning */
+    ~Logger();
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    /** The logger used by Command, writing to stderr */
+    static Logger& shared();
+
+    /** Lines below `level` are discarded */
+    void setLevel(LogLevel level) { m_level = level; }
+    LogLevel level() const { return m_level; }
+    bool enabled(LogLevel level) const { return level >= m_level.load(std::memory_order_relaxed); }
+
+    void log(LogLevel level, std::string_view message, std::span<const LogField> fields);
+    void log(LogLevel level, std::string_view message, std::initializer_list<LogField> fields = {})
+    {
+        log(level, message, std::span<const LogField>(fields.begin(), fields.size()));
+    }
+
+    /** Block until everything logged so far has been written to the sink */
+    void flush();
+
+    /** Times a thread waited for the flusher because its buffer was full */
+    uint64_t stalls() const { return m_stalls; }
+
+private:
+    class ThreadBuffer;
+
+    /** The calling thread's buffer, created on its first line */
+    ThreadBuffer& localBuffer();
+    /** Write out the contents of every buffer, with m_sinkMutex held */
+    void drainLocked();
+    /** Have the flusher drain, `urgent`ly if a buffer is filling up rather than after the interval */
+    void wakeFlusher(bool urgent);
+    void run(std::stop_token stop);
+
+    Options m_options;
+    const uint64_t m_id; // distinguishes loggers in the per-thread buffer lookup
+    std::atomic<LogLevel> m_level{LogLevel::Info};
+    std::atomic<uint64_t> m_stalls{};
+
+    std::mutex m_buffersMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> m_buffers;
+    std::mutex m_sinkMutex;
+    std::mutex m_wakeMutex;
+    std::condition_variable_any m_wake;
+    std::atomic<bool> m_pending{}; // lines were logged since the flusher last woke up
+    bool m_urgent{}; // guarded by m_wakeMutex
+    BackgroundThread m_flusher;
+};
+
+} // namespace crew
+#endif
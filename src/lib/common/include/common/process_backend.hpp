@@ -0,0 +1,184 @@
+/**
+ * Pluggable process spawning for Command, with a simulated implementation for benchmarks
+ */
+#ifndef CREW_PROCESS_BACKEND_HPP
+#define CREW_PROCESS_BACKEND_HPP
+
+#include <common/command.hpp>
+#include <common/util.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+namespace crew {
+
+/**
+ * Runs the process of a Command. Commands without a backend spawn real processes, see
+ * Command::setBackend().
+ */
+class ProcessBackend {
+public:
+    virtual ~ProcessBackend() = default;
+
+    /**
+     * Run `command` to completion, writing its output to command.outStream() and
+     * command.errStream(), and return its exit code. Called concurrently for commands
+     * run from different threads.
+     */
+    virtual Result<int> run(Command& command, RunMode mode) = 0;
+};
+
+/**
+ * Discrete event clock shared by concurrently running simulated children. A child
+ * waiting for its time to pass queues an event at its virtual wake-up time. Once every
+ * participating thread waits, time jumps to the earliest event and its thread resumes,
+ * so children overlap in virtual time as they would in real time, without the waiting.
+ *
+ * Threads running commands concurrently take part with a Participant for as long as
+ * they may start more, time holds still while any of them is busy. The thread starting
+ * them should take part until all of them do, so the first to wait does not find itself
+ * alone. A thread waiting without participating is only woken once time passes for other
+ * reasons, or when no participant is left.
+ */
+class VirtualClock {
+public:
+    using Duration = std::chrono::nanoseconds;
+
+    /** Keeps time from advancing past its thread's next wait while it lives */
+    class Participant {
+    public:
+        Participant(Participant&& other) noexcept :
+            m_clock(std::exchange(other.m_clock, nullptr)) {}
+        Participant& operator=(Participant&&) = delete;
+        ~Participant() { leave(); }
+
+        /** Stop taking part before destruction */
+        void leave();
+
+    private:
+        friend class VirtualClock;
+        explicit Participant(VirtualClock& clock) :
+            m_clock(&clock) {}
+
+        VirtualClock* m_clock;
+    };
+
+    /** Take part in the clock, e.g. handed to each thread before it starts */
+    Participant participate();
+
+    /** Virtual time passed since the clock was created */
+    Duration now() const;
+    /** Block until `duration` of virtual time has passed */
+    void sleepFor(Duration duration);
+
+private:
+    void removeParticipant();
+    /** Wake the earliest sleeper once every participant sleeps, with m_mutex held */
+    void advance();
+
+    mutable std::mutex m_mutex;
+    Duration m_now{};
+    size_t m_participants{};
+    size_t m_sleeping{};
+    uint64_t m_sequence{}; // orders sleepers waking at the same time by arrival
+    // wake-up time of each sleeper, woken one at a time on its own condition variable
+    std::map<std::pair<Duration, uint64_t>, std::condition_variable*> m_events;
+};
+
+/** How a simulated program behaves */
+struct SimulatedProcess {
+    std::chrono::microseconds spawnLatency{}; // before the first output
+    uint64_t outputBytes{}; // written to stdout, in whole lines
+    uint64_t errorBytes{}; // written to stderr after stdout
+    size_t lineLength = 80;
+    size_t chunkSize = 4096; // bytes per write, as a pipe read would deliver them
+    double bytesPerSecond{}; // output rate, unlimited if zero
+    int exitCode{};
+    /** Latency and output sizes vary by up to this fraction, deterministically per command line */
+    double jitter{};
+};
+
+/**
+ * Behaves like spawning the programs described by a spec, without creating processes:
+ * output of the configured size is produced in chunks at the configured rate and the
+ * configured exit code returned. Unknown programs fail with 127, as a shell would.
+ *
+ * Under Clock::Virtual the children wait on a VirtualClock, so thousands of them run
+ * in the time it takes to copy their output while overlapping as real ones would, and
+ * runs are reproducible. Threads running commands concurrently should take part in
+ * clock() so that time only passes once all of them wait. Under Clock::Real the time is
+ * slept for, multiplied by the time scale.
+ *
+ * Commands with a backend are not carried to worker processes, see WorkerPool::submit().
+ */
+class SimulatedBackend : public ProcessBackend {
+public:
+    enum class Clock {
+        Virtual,
+        Real,
+    };
+
+    SimulatedBackend() = default;
+    explicit SimulatedBackend(Clock clock, double timeScale = 1.0) :
+        m_clock(clock), m_timeScale(timeScale) {}
+
+    /** Define `program`, programs must be defined before commands run */
+    void addProgram(std::string program, SimulatedProcess process) { m_programs[std::move(program)] = process; }
+    /** Behaviour of programs that have not been defined, instead of failing with 127 */
+    void setDefault(SimulatedProcess process) { m_default = process; }
+
+    /**
+     * Define programs from a spec of the form
+     *
+     *     { "programs": { "cc": { "spawn_latency_us": 2000, "output_bytes": 4096,
+     *                             "bytes_per_second": 1e6, "exit_code": 0 } },
+     *       "default": { ... } }
+     *
+     * Each program may also set error_bytes, line_length, chunk_size and jitter.
+     */
+    [[nodiscard]] Result<> load(const nlohmann::json& spec);
+
+    Result<int> run(Command& command, RunMode mode) override;
+
+    /** The clock children wait on under Clock::Virtual */
+    VirtualClock& clock() { return m_virtualClock; }
+
+    struct Stats {
+        uint64_t children{}; // commands run
+        uint64_t bytes{}; // output produced
+        std::chrono::nanoseconds virtualTime{}; // summed over all children
+        std::chrono::nanoseconds elapsed{}; // passed on the virtual clock, the makespan of all children
+        uint64_t maxConcurrent{}; // most children running at once
+    };
+    Stats stats() const;
+
+private:
+    /** Let `duration` of the child's time pass */
+    void elapse(std::chrono::nanoseconds duration);
+    /** Write `bytes` of numbered lines to `out` in chunks at the process' rate */
+    void produce(std::ostream& out, std::string_view program, uint64_t bytes, const SimulatedProcess& process);
+
+    Clock m_clock = Clock::Virtual;
+    double m_timeScale = 1.0;
+    std::map<std::string, SimulatedProcess, std::less<>> m_programs;
+    std::optional<SimulatedProcess> m_default;
+    VirtualClock m_virtualClock;
+
+    std::atomic<uint64_t> m_children{};
+    std::atomic<uint64_t> m_bytes{};
+    std::atomic<int64_t> m_virtualNs{};
+    std::atomic<uint64_t> m_running{};
+    std::atomic<uint64_t> m_maxConcurrent{};
+};
+
+} // namespace crew
+#endif
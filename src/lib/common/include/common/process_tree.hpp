@@ -0,0 +1,106 @@
+/**
+ * Tracking and teardown of the processes started for a command
+ */
+#ifndef CREW_PROCESS_TREE_HPP
+#define CREW_PROCESS_TREE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+
+namespace crew {
+
+/**
+ * A command's child leads its own process group, which its descendants (compilers and
+ * linkers started by a build script) inherit, so killing the group tears down the whole
+ * tree rather than only the direct child. As a shell does for a job, the group is made
+ * the foreground group of the terminal while it runs if the caller had it, so the
+ * command can still read the terminal and Ctrl-C reaches it. With a new session the
+ * child also leaves the terminal behind. Descendants leaving the group (setsid, daemons)
+ * are still tracked when the tree is put in its own cgroup, which is best effort: it
+ * needs a delegated cgroup v2 hierarchy and silently falls back to signalling the group
+ * otherwise.
+ *
+ * The tree is killed with SIGKILL when its stop token is triggered, when its deadline
+ * passes, or by interruptAll(). The owner must release() the tree before reaping the
+ * child, so that the group id cannot have been reused by the time it is signalled.
+ */
+class ProcessTree {
+public:
+    enum class Ending {
+        Completed, // not killed
+        Cancelled, // by the stop token
+        TimedOut,
+        Interrupted, // by interruptAll()
+    };
+
+    struct Options {
+        /** The child starts a session of its own rather than only a process group */
+        bool newSession{};
+        /** Also confine the tree to a cgroup of its own */
+        bool cgroup{};
+        std::optional<std::chrono::steady_clock::time_point> deadline{};
+        std::stop_token stopToken{};
+    };
+
+    /** Prepare before forking, creating the cgroup if requested */
+    explicit ProcessTree(Options options);
+    ~ProcessTree();
+    ProcessTree(const ProcessTree&) = delete;
+    ProcessTree& operator=(const ProcessTree&) = delete;
+
+    /**
+     * In the child after fork: join the cgroup, start the process group or session and
+     * take the terminal. Only async-signal-safe calls.
+     */
+    void enterChild() const noexcept;
+
+    /** In the parent after fork: start tracking the tree led by `pid` */
+    void started(int pid);
+
+    /**
+     * Stop tracking, once the child exited but before it is reaped, and take back the
+     * terminal. What remains of a tree in a cgroup is killed, as it can only be left over
+     * background processes.
+     */
+    void release();
+
+    /** Kill every process of the tree, recording `why` unless already killed */
+    void kill(Ending why);
+
+    Ending ending() const;
+    bool inCgroup() const { return m_cgroup.has_value(); }
+
+    /**
+     * Kill the trees of every running command, e.g. on Ctrl-C. Async-signal-safe, so it
+     * may be called from a signal handler. Returns the number of trees killed.
+     */
+    static size_t interruptAll() noexcept;
+
+private:
+    /** Called with m_mutex held */
+    void killLocked();
+
+    struct Cancel {
+        ProcessTree* tree;
+        void operator()() const { tree->kill(Ending::Cancelled); }
+    };
+
+    Options m_options;
+    std::optional<std::filesystem::path> m_cgroup;
+    int m_procsFd = -1; // cgroup.procs, written by the child to join
+    int m_killFd = -1; // cgroup.kill, -1 if the kernel has none
+    int m_terminal = -1; // handed to the child's group, -1 if the caller was not in the foreground
+
+    mutable std::mutex m_mutex;
+    int m_target{}; // -pgid to signal, 0 unless between started() and release()
+    std::optional<size_t> m_slot; // in the table interruptAll() walks
+    std::atomic<Ending> m_ending{Ending::Completed};
+    std::optional<std::stop_callback<Cancel>> m_onStop;
+};
+
+} // namespace crew
+#endif
@@ -0,0 +1,118 @@
+/**
+ * Built-in sampling CPU profiler writing folded stacks for flamegraphs
+ */
+#ifndef CREW_PROFILER_HPP
+#define CREW_PROFILER_HPP
+
+#include <common/util.hpp>
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace crew {
+
+class Vm;
+
+/**
+ * Samples the call stack of whichever thread is using CPU at a fixed frequency of
+ * process CPU time (setitimer ITIMER_PROF delivering SIGPROF). The signal handler only
+ * walks the frame pointer chain of the interrupted code into a buffer allocated up front,
+ * so callers are only found through code built with frame pointers (CREW_FRAME_POINTERS).
+ * Symbols are resolved with dladdr when the samples are folded. Executables should be linked with exported
+ * symbols (-rdynamic) for their own functions to be named.
+ *
+ * Each sample is rooted at the innermost Region active on the sampled thread, so time
+ * is attributed to e.g. "render" or "command" even when frames cannot be named.
+ *
+ * There is a single SIGPROF handler per process, hence a single shared profiler.
+ */
+class Profiler {
+public:
+    struct Options {
+        int frequency = 99; // samples per second of CPU time
+        size_t capacity = 16 * 1024; // samples kept, later ones are dropped
+    };
+
+    /**
+     * Attributes samples taken while in scope to `name`, which must outlive the scope.
+     * Also the subsystem AllocationTracker counts allocations against.
+     */
+    class Region {
+    public:
+        explicit Region(const char* name);
+        ~Region();
+        Region(const Region&) = delete;
+        Region& operator=(const Region&) = delete;
+
+        /** Name of the innermost region on this thread, nullptr outside of any */
+        static const char* current();
+
+    private:
+        const char* m_previous;
+    };
+
+    static Profiler& shared();
+    ~Profiler();
+
+    /** Discard previous samples and start sampling */
+    [[nodiscard]] Result<> start(Options options);
+    [[nodiscard]] Result<> start() { return start(Options{}); }
+    /** Stop sampling, the samples are kept until the next start() or clear() */
+    void stop();
+    bool running() const { return m_running; }
+
+    /** Samples as folded stacks, "region;outermost;...;innermost count" per line */
+    std::string folded() const;
+    [[nodiscard]] Result<> writeFolded(const std::filesystem::path& path) const;
+
+    size_t samples() const;
+    /** Samples lost because the buffer was full */
+    size_t dropped() const;
+    /** Stop sampling and release the sample buffer */
+    void clear();
+
+    /**
+     * Toggle sampling whenever `signal` is received, writing the folded stacks to
+     * `output` each time sampling stops. Profiles a process without a way to type commands
+     * into it, e.g. `kill -USR2 <pid>`.
+     */
+    [[nodiscard]] Result<> toggleOnSignal(int signal, std::filesystem::path output);
+
+private:
+    Profiler() = default;
+
+    struct Buffer;
+
+    /** SIGPROF handler recording the interrupted thread's stack */
+    static void onSample(int, siginfo_t*, void* context);
+    /** Free the sample buffer once no handler can be writing to it */
+    void releaseBuffer();
+    /** Body of the thread serving toggleOnSignal() */
+    void watchSignal(std::stop_token stop, int readFd, std::filesystem::path output);
+
+    mutable std::mutex m_mutex;
+    std::atomic<bool> m_running{};
+    std::unique_ptr<Buffer> m_buffer;
+    std::atomic<Buffer*> m_active{}; // buffer the handler records into, null when stopped
+    std::atomic<int> m_inHandler{}; // handlers currently recording a sample
+    int m_signalPipe[2] = {-1, -1};
+    std::jthread m_watcher;
+};
+
+/**
+ * Add the `profile` builtin controlling the shared profiler:
+ *
+ *     profile start [FREQUENCY]
+ *     profile stop [FILE]      folded stacks are written to FILE, or printed
+ *     profile status
+ */
+[[nodiscard]] Result<> addProfilerBuiltins(Vm& vm);
+
+} // namespace crew
+#endif
@@ -0,0 +1,98 @@
+/**
+ * Pool of pre-opened pseudo terminals reused between commands
+ */
+#ifndef CREW_PTY_POOL_HPP
+#define CREW_PTY_POOL_HPP
+
+#include <common/util.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <termios.h>
+
+namespace crew {
+
+/**
+ * Opening a pty (open /dev/ptmx, grant, unlock, open the slave) costs several syscalls
+ * per command. The pool keeps pty pairs open between RunMode::BlockPty runs and resets
+ * each one (flushed queues, default termios, configured window size) before reuse.
+ *
+ * The parent keeps the slave open while a command runs, so the end of output is detected
+ * from the child exiting rather than from the slave closing. A pty is only reused when
+ * that is possible, see Lease::discard(), and when no process of the previous command
+ * still has the slave open.
+ */
+class PtyPool {
+public:
+    struct Pty {
+        int master = -1;
+        int slave = -1;
+    };
+
+    /** A pty checked out of the pool, returned to it on destruction */
+    class Lease {
+    public:
+        Lease(PtyPool& pool, Pty pty) :
+            m_pool(&pool), m_pty(pty) {}
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&&) = delete;
+        ~Lease();
+
+        int master() const { return m_pty.master; }
+        int slave() const { return m_pty.slave; }
+
+        /** Close the slave now and the master on destruction, rather than reusing the pty */
+        void discard();
+
+    private:
+        PtyPool* m_pool;
+        Pty m_pty;
+        bool m_reusable = true;
+    };
+
+    /** Keep at most `capacity` idle ptys open */
+    explicit PtyPool(size_t capacity = 4);
+    ~PtyPool();
+    PtyPool(const PtyPool&) = delete;
+    PtyPool& operator=(const PtyPool&) = delete;
+
+    /** The pool used by Command for RunMode::BlockPty */
+    static PtyPool& shared();
+
+    /** Take an idle pty, or open a new one if there is none */
+    Result<Lease> acquire();
+    /** Open ptys until `count` are idle, so the first commands do not pay for opening */
+    Result<> prewarm(size_t count);
+
+    /** Window size reported to commands, applied whenever a pty is handed out */
+    void setWindowSize(uint16_t rows, uint16_t cols);
+
+    size_t idle() const;
+
+private:
+    Result<Pty> open();
+    /** Restore the pty to the state of a freshly opened one */
+    Result<> reset(const Pty& pty) const;
+    /**
+     * Make sure no process but us still has the slave open, reopening it to check
+     * @return false if the pty must not be reused
+     */
+    static bool detach(Pty& pty);
+    void release(Pty pty);
+    static void close(Pty pty);
+
+    static constexpr int kHangupTimeoutMs = 20;
+
+    mutable std::mutex m_mutex;
+    std::vector<Pty> m_idle;
+    size_t m_capacity{};
+    uint16_t m_rows = 24;
+    uint16_t m_cols = 80;
+    std::optional<struct termios> m_defaultTermios; // captured from the first pty opened
+};
+
+} // namespace crew
+#endif
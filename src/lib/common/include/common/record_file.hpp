@@ -0,0 +1,63 @@
+/**
+ * Files of fixed size binary records, replaced atomically
+ */
+#ifndef CREW_RECORD_FILE_HPP
+#define CREW_RECORD_FILE_HPP
+
+#include <common/util.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace crew {
+
+/** Identifies a file of fixed size binary records, bump the version when changing the record */
+struct RecordFormat {
+    std::array<char, 4> magic{};
+    uint32_t version{};
+};
+
+/**
+ * Bytes of the records in `path`, empty if it is missing, foreign or of another version so
+ * that callers start over and replace it on save
+ */
+Result<std::string> readRecordBytes(const std::filesystem::path& path, const RecordFormat& format, size_t recordSize);
+
+/**
+ * Replace `path` by `bytes` as records of `format`, creating its directory if needed. The file
+ * is written to a uniquely named temporary beside `path` and renamed over it, so readers never
+ * see a partial file and concurrent writers, in this or other processes, never share one.
+ */
+Result<> writeRecordBytes(const std::filesystem::path& path, const RecordFormat& format, size_t recordSize, std::string_view bytes);
+
+/** Records written to `path` by writeRecords() */
+template <typename Record>
+Result<std::vector<Record>> readRecords(const std::filesystem::path& path, const RecordFormat& format)
+{
+    static_assert(std::is_trivially_copyable_v<Record>);
+    auto bytes = readRecordBytes(path, format, sizeof(Record));
+    if (!bytes) {
+        return std::unexpected(bytes.error());
+    }
+    std::vector<Record> records(bytes->size() / sizeof(Record));
+    std::memcpy(records.data(), bytes->data(), bytes->size());
+    return records;
+}
+
+template <typename Record>
+Result<> writeRecords(const std::filesystem::path& path, const RecordFormat& format, std::span<const Record> records)
+{
+    static_assert(std::is_trivially_copyable_v<Record>);
+    const std::string_view bytes(reinterpret_cast<const char*>(records.data()), records.size_bytes());
+    return writeRecordBytes(path, format, sizeof(Record), bytes);
+}
+
+} // namespace crew
+#endif
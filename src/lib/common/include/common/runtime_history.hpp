@@ -0,0 +1,74 @@
+/**
+ * Record of how long commands took, used to order and estimate parallel runs
+ */
+#ifndef CREW_RUNTIME_HISTORY_HPP
+#define CREW_RUNTIME_HISTORY_HPP
+
+#include <common/util.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <unordered_map>
+
+namespace crew {
+
+class Command;
+
+/**
+ * Expected runtime of commands, keyed by their normalized command line and working
+ * directory and kept in a small binary file between runs. Each entry is a moving
+ * average, so it follows commands that get slower or faster over time. The file keeps
+ * the kMaxEntries commands run in the most recent sessions.
+ */
+class RuntimeHistory {
+public:
+    using Seconds = std::chrono::duration<double>;
+    using Key = uint64_t;
+
+    /** @param file - where load()/save() keep the history, in memory only if not set */
+    explicit RuntimeHistory(std::optional<std::filesystem::path> file = {});
+
+    /** $XDG_CACHE_HOME/crew/runtime-history, or the same below ~/.cache */
+    static std::filesystem::path defaultPath();
+
+    /**
+     * Key identifying runs of the same command: the program's file name (so /usr/bin/cc
+     * and cc match), its arguments and the absolute working directory
+     */
+    static Key key(const Command& command);
+
+    /** Read the history file, a missing file is an empty history */
+    Result<> load();
+    /**
+     * Write the history file atomically, creating its directory if needed. Beyond kMaxEntries
+     * the entries least recently run are dropped.
+     */
+    Result<> save() const;
+
+    void record(Key key, Seconds runtime);
+    std::optional<Seconds> expected(Key key) const;
+
+    size_t size() const { return m_entries.size(); }
+
+    /** Weight of the newest run in the moving average */
+    static constexpr double kSmoothing = 0.3;
+    /** Entries kept by save() */
+    static constexpr size_t kMaxEntries = 16384;
+
+private:
+    struct Entry {
+        double seconds{};
+        uint32_t runs{};
+        uint32_t lastRun{};
+    };
+
+    std::optional<std::filesystem::path> m_file;
+    std::unordered_map<Key, Entry> m_entries;
+    // counts sessions, one more than the newest loaded so the runs recorded now rank first
+    uint32_t m_generation{1};
+};
+
+} // namespace crew
+#endif
@@ -0,0 +1,77 @@
+/**
+ * Coalescing of identical commands running at the same time
+ */
+#ifndef CREW_SINGLE_FLIGHT_HPP
+#define CREW_SINGLE_FLIGHT_HPP
+
+#include <common/util.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace crew {
+
+class Command;
+enum class RunMode;
+
+/**
+ * Runs each distinct execution once at a time. The first caller for a key executes it,
+ * callers arriving with the same key while it is in flight do not execute anything:
+ * they receive the output produced so far, then follow the rest as it is produced, and
+ * get the same result. Once an execution finishes the next caller executes afresh, no
+ * result outlives its execution.
+ *
+ * Output is kept for callers attaching late up to a replay limit. Past the limit the
+ * execution takes no new followers, later callers execute afresh, and output is only
+ * kept while followers are attached to receive it.
+ */
+class SingleFlight {
+public:
+    using Execute = std::function<Result<int>(std::ostream& out, std::ostream& err)>;
+
+    /** Output of an execution, stdout and stderr together, kept for callers attaching late */
+    static constexpr size_t kMaxReplay = 4 * 1024 * 1024;
+
+    explicit SingleFlight(size_t maxReplay = kMaxReplay) :
+        m_maxReplay(maxReplay) {}
+
+    /** The flights used by Command::setSingleFlight */
+    static SingleFlight& shared();
+
+    /**
+     * Everything that determines what a command does: argv, working directory, base
+     * environment, environment overrides, whether it runs on a pty, its timeout, process
+     * options and backend
+     */
+    static std::string identity(const Command& command, RunMode mode);
+
+    /**
+     * Run `execute` writing into `out`/`err`, or attach to the execution already in
+     * flight for `key`
+     */
+    Result<int> run(const std::string& key, std::ostream& out, std::ostream& err, const Execute& execute);
+
+    struct Stats {
+        uint64_t executed{};
+        uint64_t coalesced{}; // attached to an execution in flight
+    };
+    Stats stats() const;
+    size_t inFlight() const;
+
+private:
+    struct Flight;
+    class TeeBuffer;
+
+    size_t m_maxReplay{};
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::shared_ptr<Flight>> m_flights;
+    Stats m_stats;
+};
+
+} // namespace crew
+#endif
@@ -4,10 +4,14 @@
 #ifndef CREW_UTIL_HPP
 #define CREW_UTIL_HPP
 
+#include <expected>
 #include <iostream>
+#include <string>
 
 #include <fmt/format.h>
 
+#include <unistd.h>
+
 namespace crew {
 
 template <typename... Args>
@@ -17,5 +21,40 @@ template <typename... Args>
     ::exit(1);
 }
 
+/** A recoverable failure, returned to the caller instead of terminating the process */
+struct Error {
+    std::string message;
+};
+
+template <typename T = void>
+using Result = std::expected<T, Error>;
+
+/** Construct a failed Result from a format string */
+template <typename... Args>
+std::unexpected<Error> makeError(fmt::format_string<Args...> format, Args&&... args)
+{
+    return std::unexpected(Error{fmt::format(format, std::forward<Args>(args)...)});
+}
+
+/** Closes the fd when going out of scope */
+class UniqueFd {
+public:
+    explicit UniqueFd(int fd) :
+        m_fd(fd) {}
+    ~UniqueFd()
+    {
+        if (m_fd != -1) {
+            ::close(m_fd);
+        }
+    }
+    UniqueFd(const UniqueFd&) = delete;
+    UniqueFd& operator=(const UniqueFd&) = delete;
+
+    int get() const { return m_fd; }
+
+private:
+    int m_fd;
+};
+
 } // namespace crew
 #endif
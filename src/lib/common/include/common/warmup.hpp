@@ -0,0 +1,72 @@
+/**
+ * Speculative warm-up of a command while it is still being typed
+ */
+#ifndef CREW_WARMUP_HPP
+#define CREW_WARMUP_HPP
+
+#include <common/background_thread.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace crew {
+
+/**
+ * Pays the cold start costs of a command before it is run, on a background thread:
+ * resolving the program through PATH, asking the kernel to read the program file ahead
+ * (posix_fadvise WILLNEED) and stat'ing file arguments. Only the kernel's dentry and page
+ * caches are warmed, Command still searches PATH itself when it execs. Each speculate()
+ * call supersedes the previous one, whose remaining steps are abandoned.
+ */
+class Warmup {
+public:
+    /** Programs are read ahead again after this long, their pages may have been evicted */
+    static constexpr std::chrono::seconds kReadAheadInterval{60};
+
+    explicit Warmup(std::chrono::steady_clock::duration readAheadInterval = kReadAheadInterval);
+    ~Warmup();
+    Warmup(const Warmup&) = delete;
+    Warmup& operator=(const Warmup&) = delete;
+
+    /** Warm up for the command line `tokens` (program followed by arguments) */
+    void speculate(std::vector<std::string> tokens);
+    /** Abandon the current speculation */
+    void cancel();
+
+    /** Absolute path of the program `name`, resolved through PATH and cached until PATH changes */
+    std::optional<std::filesystem::path> resolve(const std::string& name);
+
+    struct Stats {
+        uint64_t speculations{}; // requests completed
+        uint64_t cancelled{}; // requests superseded or cancelled before completing
+        uint64_t advised{}; // program files read ahead
+        uint64_t statted{}; // arguments stat'ed
+    };
+    Stats stats() const;
+
+private:
+    void run(std::stop_token stop);
+    /** Whether the request of `generation` has been superseded */
+    bool superseded(uint64_t generation) const;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable_any m_changed;
+    std::optional<std::vector<std::string>> m_request;
+    uint64_t m_generation{};
+    std::string m_resolvedPath; // PATH the resolved programs were searched in
+    std::map<std::string, std::optional<std::filesystem::path>> m_resolved;
+    std::chrono::steady_clock::duration m_readAheadInterval;
+    std::map<std::filesystem::path, std::chrono::steady_clock::time_point> m_advised; // when each program was last read ahead
+    Stats m_stats;
+    BackgroundThread m_thread;
+};
+
+} // namespace crew
+#endif
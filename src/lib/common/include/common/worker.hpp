@@ -0,0 +1,146 @@
+/**
+ * Execute commands in separate worker processes, connected over unix sockets
+ */
+#ifndef CREW_WORKER_HPP
+#define CREW_WORKER_HPP
+
+#include <common/command.hpp>
+#include <common/runtime_history.hpp>
+#include <common/util.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace crew {
+
+/**
+ * Serialize what a command runs with to run it in another process: the command line,
+ * working directory, environment and options. Not its streams, backend or stop token.
+ */
+nlohmann::json commandToJson(const Command& command);
+Result<Command> commandFromJson(const nlohmann::json& json);
+
+/**
+ * Serve commands received over the connected socket `fd` until the peer disconnects,
+ * streaming output back as it is produced. Returns the worker's exit code.
+ */
+int serveWorker(int fd);
+
+/**
+ * A set of worker processes commands can be offloaded to. Each worker runs one command
+ * at a time, queued commands are handed to the idle worker whose commands used the least
+ * CPU time so far, spreading the work evenly, and output is streamed back into each
+ * command's out/err streams. The result of a finished job is kept until it is collected
+ * with wait(), so every job must be waited for or detach()ed.
+ *
+ * With a RuntimeHistory, queued commands start longest expected first so long commands
+ * do not stretch the total time by starting last, and the remaining time is estimated.
+ */
+class WorkerPool {
+public:
+    using JobId = uint64_t;
+
+    /**
+     * Start `count` workers. Workers exec `workerExe --fd <n>` (e.g. crew-worker), or are
+     * forked copies of the current process if no executable is given.
+     */
+    static Result<std::unique_ptr<WorkerPool>> start(size_t count, std::optional<std::filesystem::path> workerExe = {});
+
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * Queue a command for execution on a worker. Fails for a command that cannot be
+     * carried to another process, one with a backend or stop token. Whatever the
+     * command's OnError, failures are returned by wait().
+     */
+    Result<JobId> submit(Command command);
+
+    /**
+     * Block until job `id` has finished, streaming output of all running jobs meanwhile.
+     * Returns the exit code, or an Error if the job's worker failed.
+     */
+    Result<int> wait(JobId id);
+
+    /** Drop job `id`'s result once it finishes rather than keeping it for wait() */
+    void detach(JobId id);
+
+    size_t size() const { return m_workers.size(); }
+    /** Jobs submitted and not yet waited for or detached, finished or not */
+    size_t jobs() const { return m_jobs.size(); }
+
+    /**
+     * Fail every queued job without running it and kill the process trees of the running
+     * ones, whose wait() then returns an Error
+     */
+    void cancel();
+    /** Cancel everything once any job fails or exits non-zero */
+    void setFailFast(bool failFast) { m_failFast = failFast; }
+
+    /**
+     * Order queued jobs by the runtimes in `history` and record finished runs into it.
+     * The history must outlive the pool, only jobs submitted afterwards are ordered.
+     */
+    void setHistory(RuntimeHistory* history) { m_history = history; }
+    /** Report progress and the estimated time remaining to `progress` as jobs finish */
+    void setProgress(std::ostream* progress) { m_progress = progress; }
+
+    /**
+     * Time until every submitted job has finished, simulating the queue on the live
+     * workers with the expected runtimes. Jobs without history count as the average of
+     * those with, nullopt if there is no history for any job.
+     */
+    std::optional<RuntimeHistory::Seconds> estimatedRemaining() const;
+
+private:
+    struct Worker {
+        int pid{};
+        int fd{};
+        std::optional<JobId> running{};
+        int64_t cpuMs{}; // used by the worker's commands, as last reported
+        bool alive = true;
+    };
+
+    struct Job {
+        Command command;
+        std::optional<size_t> worker{};
+        std::optional<Result<int>> result{}; // set once finished
+        RuntimeHistory::Key key{};
+        std::optional<RuntimeHistory::Seconds> expected{};
+        std::chrono::steady_clock::time_point started{};
+        bool detached{};
+    };
+
+    WorkerPool() = default;
+
+    /** Hand queued jobs to idle workers */
+    void dispatch();
+    /** Wait for and handle at least one message from any worker */
+    Result<> pump();
+    void workerFailed(size_t worker, const std::string& reason);
+    /** Forget finished jobs nobody will wait for */
+    void eraseDetached();
+    /** A job's worker reported it exited */
+    void jobFinished(Job& job);
+
+    std::vector<Worker> m_workers;
+    std::map<JobId, Job> m_jobs;
+    std::deque<JobId> m_queue;
+    JobId m_nextId{};
+    RuntimeHistory* m_history = nullptr;
+    std::ostream* m_progress = nullptr;
+    size_t m_finished{};
+    bool m_failFast{};
+};
+
+} // namespace crew
+#endif
@@ -0,0 +1,264 @@
+#include <common/line_buffer.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace crew {
+namespace {
+/** Whether the byte continues a UTF-8 sequence rather than starting a character */
+bool isContinuation(char byte)
+{
+    return (static_cast<unsigned char>(byte) & 0xC0) == 0x80;
+}
+
+size_t countColumns(std::string_view bytes)
+{
+    return static_cast<size_t>(std::count_if(bytes.begin(), bytes.end(), [](char b) { return !isContinuation(b); }));
+}
+} // namespace
+
+void LineBuffer::insert(std::string_view text)
+{
+    if (text.empty()) {
+        return;
+    }
+    const size_t offset = m_gapStart;
+    rawInsert(text);
+    record(Edit::Kind::Insert, offset, std::string(text));
+}
+
+bool LineBuffer::eraseBefore()
+{
+    if (m_gapStart == 0) {
+        return false;
+    }
+    size_t start = m_gapStart - 1;
+    while (start > 0 && isContinuation(m_data[start])) {
+        --start;
+    }
+    record(Edit::Kind::EraseBefore, start, rawErase(start, m_gapStart - start));
+    return true;
+}
+
+bool LineBuffer::eraseAfter()
+{
+    if (m_gapEnd == m_data.size()) {
+        return false;
+    }
+    size_t end = m_gapEnd + 1;
+    while (end < m_data.size() && isContinuation(m_data[end])) {
+        ++end;
+    }
+    const size_t offset = m_gapStart;
+    record(Edit::Kind::EraseAfter, offset, rawErase(offset, end - m_gapEnd));
+    return true;
+}
+
+void LineBuffer::clear()
+{
+    if (empty()) {
+        return;
+    }
+    breakUndoGroup();
+    record(Edit::Kind::EraseAfter, 0, rawErase(0, size()));
+    breakUndoGroup();
+}
+
+void LineBuffer::reset()
+{
+    m_gapStart = 0;
+    m_gapEnd = m_data.size();
+    m_cursorColumn = 0;
+    m_columns = 0;
+    m_undo.clear();
+    m_redo.clear();
+    m_coalesce = false;
+}
+
+bool LineBuffer::undo()
+{
+    if (m_undo.empty()) {
+        return false;
+    }
+    apply(m_undo.back(), true);
+    m_redo.push_back(std::move(m_undo.back()));
+    m_undo.pop_back();
+    breakUndoGroup();
+    return true;
+}
+
+bool LineBuffer::redo()
+{
+    if (m_redo.empty()) {
+        return false;
+    }
+    apply(m_redo.back(), false);
+    m_undo.push_back(std::move(m_redo.back()));
+    m_redo.pop_back();
+    breakUndoGroup();
+    return true;
+}
+
+void LineBuffer::apply(const Edit& edit, bool inverse)
+{
+    if ((edit.kind == Edit::Kind::Insert) != inverse) {
+        moveGap(edit.offset);
+        rawInsert(edit.text);
+        if (edit.kind == Edit::Kind::EraseAfter) {
+            moveGap(edit.offset); // deleting left the cursor before the text
+        }
+    } else {
+        rawErase(edit.offset, edit.text.size());
+    }
+}
+
+void LineBuffer::record(Edit::Kind kind, size_t offset, std::string text)
+{
+    m_redo.clear();
+
+    if (m_coalesce && !m_undo.empty() && m_undo.back().kind == kind) {
+        Edit& last = m_undo.back();
+        if (kind == Edit::Kind::Insert && offset == last.offset + last.text.size()
+                && !(last.text.back() == ' ' && text.front() != ' ')) { // a typed word ends its entry
+            last.text.append(text);
+            return;
+        }
+        if (kind == Edit::Kind::EraseBefore && offset + text.size() == last.offset) {
+            last.text.insert(0, text);
+            last.offset = offset;
+            return;
+        }
+        if (kind == Edit::Kind::EraseAfter && offset == last.offset) {
+            last.text.append(text);
+            return;
+        }
+    }
+
+    m_undo.push_back({kind, offset, std::move(text)});
+    if (m_undo.size() > kMaxUndo) {
+        m_undo.pop_front();
+    }
+    m_coalesce = true;
+}
+
+void LineBuffer::rawInsert(std::string_view text)
+{
+    reserveGap(text.size());
+    std::memcpy(m_data.data() + m_gapStart, text.data(), text.size());
+    m_gapStart += text.size();
+
+    const size_t added = countColumns(text);
+    m_cursorColumn += added;
+    m_columns += added;
+}
+
+std::string LineBuffer::rawErase(size_t offset, size_t length)
+{
+    moveGap(offset);
+    std::string erased(afterCursor().substr(0, length));
+    m_gapEnd += erased.size();
+    m_columns -= countColumns(erased);
+    return erased;
+}
+
+bool LineBuffer::moveLeft()
+{
+    if (m_gapStart == 0) {
+        return false;
+    }
+    size_t offset = m_gapStart - 1;
+    while (offset > 0 && isContinuation(m_data[offset])) {
+        --offset;
+    }
+    moveTo(offset);
+    return true;
+}
+
+bool LineBuffer::moveRight()
+{
+    if (m_gapEnd == m_data.size()) {
+        return false;
+    }
+    size_t offset = m_gapStart + 1;
+    while (offset < size() && isContinuation(at(offset))) {
+        ++offset;
+    }
+    moveTo(offset);
+    return true;
+}
+
+void LineBuffer::moveGap(size_t offset)
+{
+    offset = std::min(offset, size());
+    if (offset < m_gapStart) {
+        // shift the bytes between the new cursor and the gap to the far side of it
+        const size_t count = m_gapStart - offset;
+        m_cursorColumn -= countColumns({m_data.data() + offset, count});
+        std::memmove(m_data.data() + m_gapEnd - count, m_data.data() + offset, count);
+        m_gapStart -= count;
+        m_gapEnd -= count;
+    } else if (offset > m_gapStart) {
+        const size_t count = offset - m_gapStart;
+        m_cursorColumn += countColumns({m_data.data() + m_gapEnd, count});
+        std::memmove(m_data.data() + m_gapStart, m_data.data() + m_gapEnd, count);
+        m_gapStart += count;
+        m_gapEnd += count;
+    }
+}
+
+std::string LineBuffer::str() const
+{
+    std::string result;
+    result.reserve(size());
+    result.append(beforeCursor());
+    result.append(afterCursor());
+    return result;
+}
+
+std::string LineBuffer::slice(size_t firstColumn, size_t count) const
+{
+    if (firstColumn >= m_columns || count == 0) {
+        return {};
+    }
+
+    // find the byte offset of firstColumn relative to the cursor
+    size_t start = m_gapStart;
+    for (size_t column = m_cursorColumn; column > firstColumn; --column) {
+        do {
+            --start;
+        } while (start > 0 && isContinuation(at(start)));
+    }
+    for (size_t column = m_cursorColumn; column < firstColumn; ++column) {
+        do {
+            ++start;
+        } while (start < size() && isContinuation(at(start)));
+    }
+
+    std::string result;
+    size_t taken = 0;
+    for (size_t offset = start; offset < size(); ++offset) {
+        const char byte = at(offset);
+        if (!isContinuation(byte) && taken++ == count) {
+            break;
+        }
+        result.push_back(byte);
+    }
+    return result;
+}
+
+void LineBuffer::reserveGap(size_t bytes)
+{
+    if (gapSize() >= bytes) {
+        return;
+    }
+    const size_t after = m_data.size() - m_gapEnd;
+    const size_t capacity = std::max({m_data.size() * 2, size() + bytes, size_t{64}});
+
+    std::vector<char> grown(capacity);
+    std::memcpy(grown.data(), m_data.data(), m_gapStart);
+    std::memcpy(grown.data() + capacity - after, m_data.data() + m_gapEnd, after);
+    m_data = std::move(grown);
+    m_gapEnd = capacity - after;
+}
+
+} // namespace crew
@@ -0,0 +1,226 @@
+#include <common/logger.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <utility>
+
+namespace crew {
+namespace {
+std::atomic<uint64_t> s_nextLoggerId{1};
+
+/** Append `value`, quoted if it would otherwise not read back as a single value */
+void appendValue(std::string& out, std::string_view value)
+{
+    if (!value.empty() && value.find_first_of(" \t\n\"") == std::string_view::npos) {
+        out += value;
+        return;
+    }
+    out += '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+} // namespace
+
+/** Single producer (the owning thread), single consumer (whoever drains) byte ring */
+class Logger::ThreadBuffer {
+public:
+    explicit ThreadBuffer(size_t size) :
+        m_data(std::bit_ceil(size)), m_mask(m_data.size() - 1) {}
+
+    size_t capacity() const { return m_data.size(); }
+
+    /** Append all of `bytes` if there is room for them, never a part */
+    bool tryPush(std::string_view bytes)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        const size_t tail = m_tail.load(std::memory_order_acquire);
+        if (capacity() - (head - tail) < bytes.size()) {
+            return false;
+        }
+        const size_t start = head & m_mask;
+        const size_t first = std::min(bytes.size(), capacity() - start);
+        std::memcpy(m_data.data() + start, bytes.data(), first);
+        std::memcpy(m_data.data(), bytes.data() + first, bytes.size() - first);
+        m_head.store(head + bytes.size(), std::memory_order_release);
+        return true;
+    }
+
+    /** Whether more than half of the buffer is in use */
+    bool pressured() const
+    {
+        return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed) > capacity() / 2;
+    }
+
+    bool empty() const { return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_relaxed); }
+
+    /** Write out everything pushed so far */
+    void drainTo(std::ostream& sink)
+    {
+        const size_t head = m_head.load(std::memory_order_acquire);
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (head == tail) {
+            return;
+        }
+        const size_t start = tail & m_mask;
+        const size_t first = std::min(head - tail, capacity() - start);
+        sink.write(m_data.data() + start, static_cast<std::streamsize>(first));
+        sink.write(m_data.data(), static_cast<std::streamsize>(head - tail - first));
+        m_tail.store(head, std::memory_order_release);
+    }
+
+private:
+    std::vector<char> m_data;
+    size_t m_mask{};
+    // positions increase forever and are masked on access
+    alignas(64) std::atomic<size_t> m_head{}; // written by the producer
+    alignas(64) std::atomic<size_t> m_tail{}; // written by the consumer
+};
+
+Logger::Logger(Options options) :
+    m_options(options),
+    m_id(s_nextLoggerId.fetch_add(1))
+{
+    m_flusher.start([this](std::stop_token stop) { run(stop); });
+}
+
+Logger::~Logger()
+{
+    if (m_flusher.stop()) {
+        flush();
+    }
+}
+
+Logger& Logger::shared()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::ThreadBuffer& Logger::localBuffer()
+{
+    // buffers of the loggers this thread has logged to, kept alive by the loggers
+    // until drained should the thread exit first
+    thread_local std::vector<std::pair<uint64_t, std::shared_ptr<ThreadBuffer>>> t_buffers;
+    for (const auto& [id, buffer] : t_buffers) {
+        if (id == m_id) {
+            return *buffer;
+        }
+    }
+
+    auto buffer = std::make_shared<ThreadBuffer>(m_options.bufferSize);
+    {
+        std::lock_guard lock(m_buffersMutex);
+        m_buffers.push_back(buffer);
+    }
+    t_buffers.emplace_back(m_id, buffer);
+    return *buffer;
+}
+
+void Logger::log(LogLevel level, std::string_view message, std::span<const LogField> fields)
+{
+    if (!enabled(level)) {
+        return;
+    }
+
+    thread_local std::string t_line;
+    t_line.clear();
+    switch (level) {
+    case LogLevel::Warning:
+        t_line += "warning: ";
+        break;
+    case LogLevel::Error:
+        t_line += "error: ";
+        break;
+    case LogLevel::Debug:
+    case LogLevel::Info:
+        break;
+    }
+    t_line += message;
+    for (const auto& field : fields) {
+        t_line += ' ';
+        t_line += field.key;
+        t_line += '=';
+        appendValue(t_line, field.value);
+    }
+    t_line += '\n';
+
+    ThreadBuffer& buffer = localBuffer();
+    if (t_line.size() > buffer.capacity()) {
+        // can never fit, write it directly after what the thread logged before it
+        std::lock_guard lock(m_sinkMutex);
+        drainLocked();
+        m_options.sink->write(t_line.data(), static_cast<std::streamsize>(t_line.size()));
+        return;
+    }
+
+    if (!buffer.tryPush(t_line)) {
+        ++m_stalls;
+        do {
+            wakeFlusher(true);
+            std::this_thread::yield();
+        } while (!buffer.tryPush(t_line));
+    }
+    if (buffer.pressured()) {
+        wakeFlusher(true);
+    } else if (!m_pending.exchange(true)) {
+        wakeFlusher(false); // the first line since the last drain
+    }
+}
+
+void Logger::wakeFlusher(bool urgent)
+{
+    {
+        // the flusher checks the flags under the lock, so it cannot miss this wake up
+        std::lock_guard lock(m_wakeMutex);
+        m_pending = true;
+        m_urgent = m_urgent || urgent;
+    }
+    m_wake.notify_one();
+}
+
+void Logger::flush()
+{
+    std::lock_guard lock(m_sinkMutex);
+    drainLocked();
+    m_options.sink->flush();
+}
+
+void Logger::drainLocked()
+{
+    std::lock_guard lock(m_buffersMutex);
+    for (auto& buffer : m_buffers) {
+        buffer->drainTo(*m_options.sink);
+    }
+    // buffers of exited threads are only referenced here once drained
+    std::erase_if(m_buffers, [](const auto& buffer) {
+        return buffer.use_count() == 1 && buffer->empty();
+    });
+}
+
+void Logger::run(std::stop_token stop)
+{
+    while (!stop.stop_requested()) {
+        {
+            std::unique_lock lock(m_wakeMutex);
+            // idle until a line is logged, then gather more for an interval unless a
+            // buffer is filling up
+            m_wake.wait(lock, stop, [this] { return m_pending.load(); });
+            m_wake.wait_for(lock, stop, m_options.interval, [this] { return m_urgent; });
+            m_urgent = false;
+            m_pending = false; // lines logged from here on wake us up again
+        }
+        flush();
+    }
+}
+
+} // namespace crew
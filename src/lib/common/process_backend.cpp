@@ -0,0 +1,182 @@
+#include <common/file_hash.hpp>
+#include <common/process_backend.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using nlohmann::json;
+
+namespace crew {
+namespace {
+/** Scale `value` by a factor in [1 - jitter, 1 + jitter] derived from `seed` */
+double vary(double value, double jitter, uint64_t seed)
+{
+    if (jitter <= 0) {
+        return value;
+    }
+    const double unit = static_cast<double>(seed % 10'001) / 10'000.0; // [0, 1]
+    return value * (1.0 + jitter * (2.0 * unit - 1.0));
+}
+} // namespace
+
+void VirtualClock::Participant::leave()
+{
+    if (m_clock != nullptr) {
+        std::exchange(m_clock, nullptr)->removeParticipant();
+    }
+}
+
+VirtualClock::Participant VirtualClock::participate()
+{
+    std::lock_guard lock(m_mutex);
+    ++m_participants;
+    return Participant(*this);
+}
+
+void VirtualClock::removeParticipant()
+{
+    std::lock_guard lock(m_mutex);
+    --m_participants;
+    advance();
+}
+
+VirtualClock::Duration VirtualClock::now() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_now;
+}
+
+void VirtualClock::sleepFor(Duration duration)
+{
+    if (duration <= Duration::zero()) {
+        return;
+    }
+    std::unique_lock lock(m_mutex);
+    std::condition_variable wake;
+    const auto event = std::make_pair(m_now + duration, m_sequence++);
+    m_events.emplace(event, &wake);
+    ++m_sleeping;
+    advance();
+    wake.wait(lock, [&] { return !m_events.contains(event); });
+}
+
+void VirtualClock::advance()
+{
+    // one sleeper at a time, it may start more children at the new time before time moves on
+    if (m_events.empty() || m_sleeping < std::max<size_t>(m_participants, 1)) {
+        return;
+    }
+    const auto earliest = m_events.begin();
+    m_now = earliest->first.first;
+    earliest->second->notify_one();
+    m_events.erase(earliest);
+    --m_sleeping;
+}
+
+Result<> SimulatedBackend::load(const json& spec)
+{
+    auto parseProcess = [](const json& j) {
+        SimulatedProcess process;
+        process.spawnLatency = std::chrono::microseconds(j.value("spawn_latency_us", int64_t{}));
+        process.outputBytes = j.value("output_bytes", uint64_t{});
+        process.errorBytes = j.value("error_bytes", uint64_t{});
+        process.lineLength = std::max<size_t>(j.value("line_length", process.lineLength), 1);
+        process.chunkSize = std::max<size_t>(j.value("chunk_size", process.chunkSize), 1);
+        process.bytesPerSecond = j.value("bytes_per_second", 0.0);
+        process.exitCode = j.value("exit_code", 0);
+        process.jitter = j.value("jitter", 0.0);
+        return process;
+    };
+
+    try {
+        if (spec.contains("programs")) {
+            for (const auto& [program, process] : spec.at("programs").items()) {
+                addProgram(program, parseProcess(process));
+            }
+        }
+        if (spec.contains("default")) {
+            setDefault(parseProcess(spec.at("default")));
+        }
+    } catch (const json::exception& e) {
+        return makeError("malformed simulation spec: {}", e.what());
+    }
+    return {};
+}
+
+Result<int> SimulatedBackend::run(Command& command, RunMode mode)
+{
+    const std::string_view program = command.program();
+    auto it = m_programs.find(program);
+    if (it == m_programs.end() && !m_default) {
+        command.errStream() << program << ": command not found\n";
+        return 127;
+    }
+    SimulatedProcess process = it != m_programs.end() ? it->second : *m_default;
+
+    // the same command line always varies the same way
+    const uint64_t seed = hash64(command.toString());
+    process.spawnLatency = std::chrono::microseconds(
+            std::llround(vary(static_cast<double>(process.spawnLatency.count()), process.jitter, seed)));
+    process.outputBytes = std::llround(vary(static_cast<double>(process.outputBytes), process.jitter, seed >> 16));
+    process.errorBytes = std::llround(vary(static_cast<double>(process.errorBytes), process.jitter, seed >> 32));
+
+    const uint64_t running = m_running.fetch_add(1) + 1;
+    uint64_t most = m_maxConcurrent.load();
+    while (running > most && !m_maxConcurrent.compare_exchange_weak(most, running)) {
+    }
+    ++m_children;
+
+    elapse(process.spawnLatency);
+    // a pty carries both streams, as does replacing the current process with the child
+    std::ostream& err = mode == RunMode::Block ? command.errStream() : command.outStream();
+    produce(command.outStream(), program, process.outputBytes, process);
+    produce(err, program, process.errorBytes, process);
+    command.outStream().flush();
+
+    --m_running;
+    return process.exitCode;
+}
+
+void SimulatedBackend::elapse(std::chrono::nanoseconds duration)
+{
+    if (duration <= std::chrono::nanoseconds::zero()) {
+        return;
+    }
+    m_virtualNs += duration.count();
+    if (m_clock == Clock::Real) {
+        std::this_thread::sleep_for(std::chrono::duration_cast<std::chrono::nanoseconds>(duration * m_timeScale));
+    } else {
+        m_virtualClock.sleepFor(duration);
+    }
+}
+
+void SimulatedBackend::produce(std::ostream& out, std::string_view program, uint64_t bytes, const SimulatedProcess& process)
+{
+    thread_local std::string t_chunk;
+    uint64_t line = 0;
+    uint64_t written = 0;
+    while (written < bytes) {
+        t_chunk.clear();
+        while (t_chunk.size() < process.chunkSize && written + t_chunk.size() < bytes) {
+            // numbered lines padded to the line length
+            const size_t start = t_chunk.size();
+            fmt::format_to(std::back_inserter(t_chunk), "{} output line {}", program, ++line);
+            t_chunk.resize(start + process.lineLength - 1, '.');
+            t_chunk.push_back('\n');
+        }
+        out.write(t_chunk.data(), static_cast<std::streamsize>(t_chunk.size()));
+        written += t_chunk.size();
+        if (process.bytesPerSecond > 0) {
+            elapse(std::chrono::nanoseconds(std::llround(static_cast<double>(t_chunk.size()) * 1e9 / process.bytesPerSecond)));
+        }
+    }
+    m_bytes += written;
+}
+
+SimulatedBackend::Stats SimulatedBackend::stats() const
+{
+    return {m_children, m_bytes, std::chrono::nanoseconds(m_virtualNs.load()), m_virtualClock.now(), m_maxConcurrent};
+}
+
+} // namespace crew
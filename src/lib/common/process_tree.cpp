@@ -0,0 +1,306 @@
+#include <common/background_thread.hpp>
+#include <common/process_tree.hpp>
+
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+namespace {
+constexpr size_t kMaxTrees = 1024;
+
+/** A running tree, as seen by interruptAll() which may run in a signal handler */
+struct Slot {
+    std::atomic<bool> used{};
+    std::atomic<int> target{}; // published last, 0 while the slot is being set up
+    std::atomic<int> killFd{-1};
+    std::atomic<bool> interrupted{};
+};
+constinit std::array<Slot, kMaxTrees> s_slots{};
+
+/** SIGKILL `target`, a pid or a negated process group, and the cgroup behind `killFd` if any */
+void killTree(int target, int killFd) noexcept
+{
+    if (killFd != -1) {
+        [[maybe_unused]] const auto written = ::write(killFd, "1", 1);
+    }
+    // the child may not have started its own group yet
+    if (::kill(target, SIGKILL) == -1 && errno == ESRCH && target < 0) {
+        ::kill(-target, SIGKILL);
+    }
+}
+
+/** Make `pgid` the foreground group of `terminal`, also when called from a background group */
+void setForeground(int terminal, int pgid) noexcept
+{
+    sigset_t ttou;
+    sigset_t previous;
+    sigemptyset(&ttou);
+    sigaddset(&ttou, SIGTTOU);
+    ::pthread_sigmask(SIG_BLOCK, &ttou, &previous);
+    ::tcsetpgrp(terminal, pgid);
+    ::pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+/** The cgroup v2 directory this process belongs to, if the unified hierarchy is mounted */
+std::optional<fs::path> ownCgroup()
+{
+    static const std::optional<fs::path> cgroup = []() -> std::optional<fs::path> {
+        std::ifstream file("/proc/self/cgroup");
+        for (std::string line; std::getline(file, line);) {
+            if (!line.starts_with("0::")) {
+                continue;
+            }
+            // the unified hierarchy is mounted on its own, or beside the v1 controllers
+            for (const std::string mount : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+                std::error_code ec;
+                if (fs::exists(mount + "/cgroup.controllers", ec)) {
+                    return fs::path(mount + line.substr(3));
+                }
+            }
+        }
+        return std::nullopt;
+    }();
+    return cgroup;
+}
+
+/** Kills trees whose deadline passed, on a thread of its own */
+class Deadlines {
+public:
+    static Deadlines& shared()
+    {
+        static Deadlines deadlines;
+        return deadlines;
+    }
+
+    ~Deadlines() { m_thread.stop(); }
+
+    void add(ProcessTree* tree, std::chrono::steady_clock::time_point deadline)
+    {
+        std::lock_guard lock(m_mutex);
+        m_trees.emplace(deadline, tree);
+        m_changed.notify_one();
+    }
+
+    void remove(ProcessTree* tree)
+    {
+        std::lock_guard lock(m_mutex);
+        std::erase_if(m_trees, [tree](const auto& entry) { return entry.second == tree; });
+    }
+
+private:
+    Deadlines()
+    {
+        m_thread.start([this](std::stop_token stop) { run(stop); });
+    }
+
+    void run(std::stop_token stop)
+    {
+        std::unique_lock lock(m_mutex);
+        while (!stop.stop_requested()) {
+            if (m_trees.empty()) {
+                m_changed.wait(lock, stop, [this] { return !m_trees.empty(); });
+                continue;
+            }
+            auto first = m_trees.begin();
+            if (first->first <= std::chrono::steady_clock::now()) {
+                // trees are removed under the lock before they are destroyed
+                first->second->kill(ProcessTree::Ending::TimedOut);
+                m_trees.erase(first);
+                continue;
+            }
+            // until the deadline passes or an earlier one is added
+            m_changed.wait_until(lock, stop, first->first, [this, at = first->first] {
+                return m_trees.empty() || m_trees.begin()->first < at;
+            });
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable_any m_changed;
+    std::multimap<std::chrono::steady_clock::time_point, ProcessTree*> m_trees;
+    BackgroundThread m_thread;
+};
+} // namespace
+
+ProcessTree::ProcessTree(Options options) :
+    m_options(std::move(options))
+{
+    // a group of our own takes over the terminal if we have it, as a shell's job would
+    if (!m_options.newSession && ::isatty(STDIN_FILENO) && ::tcgetpgrp(STDIN_FILENO) == ::getpgrp()) {
+        m_terminal = STDIN_FILENO;
+    }
+    if (!m_options.cgroup) {
+        return;
+    }
+    auto parent = ownCgroup();
+    if (!parent) {
+        return;
+    }
+    static std::atomic<uint64_t> s_next{};
+    fs::path dir = *parent / fmt::format("crew-{}-{}", ::getpid(), s_next++);
+    if (::mkdir(dir.c_str(), 0755) == -1) {
+        return; // not delegated to us, the process group still works
+    }
+    m_procsFd = ::open((dir / "cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+    if (m_procsFd == -1) {
+        ::rmdir(dir.c_str());
+        return;
+    }
+    m_killFd = ::open((dir / "cgroup.kill").c_str(), O_WRONLY | O_CLOEXEC); // linux 5.14+
+    m_cgroup = std::move(dir);
+}
+
+ProcessTree::~ProcessTree()
+{
+    release();
+    if (m_procsFd != -1) {
+        ::close(m_procsFd);
+    }
+    if (m_killFd != -1) {
+        ::close(m_killFd);
+    }
+    if (m_cgroup.has_value()) {
+        // killed processes leave the cgroup once the kernel finishes tearing them down
+        for (int attempt = 0; attempt < 100 && ::rmdir(m_cgroup->c_str()) == -1 && errno == EBUSY; ++attempt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void ProcessTree::enterChild() const noexcept
+{
+    if (m_procsFd != -1) {
+        [[maybe_unused]] const auto written = ::write(m_procsFd, "0", 1); // moves the writer
+    }
+    if (m_options.newSession) {
+        ::setsid();
+        return;
+    }
+    // also done by the parent, whichever runs first
+    ::setpgid(0, 0);
+    if (m_terminal != -1) {
+        setForeground(m_terminal, ::getpid());
+    }
+}
+
+void ProcessTree::started(int pid)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_options.newSession) {
+            ::setpgid(pid, pid); // fails once the child has exec'd, by then it did so itself
+            if (m_terminal != -1) {
+                setForeground(m_terminal, pid);
+            }
+        }
+        m_target = -pid;
+        for (size_t i = 0; i < s_slots.size(); ++i) {
+            bool used = false;
+            if (s_slots[i].used.compare_exchange_strong(used, true)) {
+                s_slots[i].interrupted = false;
+                s_slots[i].killFd = m_killFd;
+                s_slots[i].target = m_target;
+                m_slot = i;
+                break;
+            }
+        }
+    }
+
+    if (m_options.deadline.has_value()) {
+        Deadlines::shared().add(this, *m_options.deadline);
+    }
+    if (m_options.stopToken.stop_possible()) {
+        m_onStop.emplace(m_options.stopToken, Cancel{this}); // runs now if already stopped
+    }
+}
+
+void ProcessTree::release()
+{
+    // neither may kill the tree once this returns
+    m_onStop.reset();
+    if (m_options.deadline.has_value()) {
+        Deadlines::shared().remove(this);
+    }
+
+    std::lock_guard lock(m_mutex);
+    if (m_target == 0) {
+        return;
+    }
+    if (m_cgroup.has_value()) {
+        killLocked();
+    }
+    if (m_terminal != -1 && ::tcgetpgrp(m_terminal) == -m_target) {
+        setForeground(m_terminal, ::getpgrp());
+    }
+    if (m_slot.has_value()) {
+        Slot& slot = s_slots[*m_slot];
+        if (slot.interrupted) {
+            Ending expected = Ending::Completed;
+            m_ending.compare_exchange_strong(expected, Ending::Interrupted);
+        }
+        slot.target = 0;
+        slot.killFd = -1;
+        slot.used = false;
+        m_slot.reset();
+    }
+    m_target = 0;
+}
+
+void ProcessTree::kill(Ending why)
+{
+    std::lock_guard lock(m_mutex);
+    if (m_target == 0) {
+        return;
+    }
+    Ending expected = Ending::Completed;
+    m_ending.compare_exchange_strong(expected, why);
+    killLocked();
+}
+
+void ProcessTree::killLocked()
+{
+    killTree(m_target, m_killFd);
+    if (m_cgroup.has_value() && m_killFd == -1) {
+        // without cgroup.kill, members that left the group are signalled one by one
+        std::ifstream procs(*m_cgroup / "cgroup.procs");
+        for (int pid{}; procs >> pid;) {
+            ::kill(pid, SIGKILL);
+        }
+    }
+}
+
+ProcessTree::Ending ProcessTree::ending() const
+{
+    return m_ending;
+}
+
+size_t ProcessTree::interruptAll() noexcept
+{
+    const int savedErrno = errno;
+    size_t killed = 0;
+    for (auto& slot : s_slots) {
+        if (const int target = slot.target.load(); target != 0) {
+            slot.interrupted = true;
+            killTree(target, slot.killFd.load());
+            ++killed;
+        }
+    }
+    errno = savedErrno;
+    return killed;
+}
+
+} // namespace crew
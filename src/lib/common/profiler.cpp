@@ -0,0 +1,433 @@
+#include <common/interpreter.hpp>
+#include <common/profiler.hpp>
+
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+namespace {
+constexpr int kMaxDepth = 64;
+constexpr int kMaxFrequency = 10'000;
+// frames further above the interrupted stack pointer are taken for a corrupt chain
+constexpr uintptr_t kMaxStackBytes = 64 * 1024 * 1024;
+
+constinit thread_local const char* t_region = nullptr;
+
+// write end of the toggleOnSignal() pipe, -1 while there is none
+std::atomic<int> s_toggleFd{-1};
+
+void onToggleSignal(int)
+{
+    const int savedErrno = errno;
+    if (const int fd = s_toggleFd.load(); fd != -1) {
+        const char byte = 0;
+        [[maybe_unused]] const auto written = ::write(fd, &byte, 1); // a full pipe already has a toggle pending
+    }
+    errno = savedErrno;
+}
+
+/** Program counter, frame pointer and stack pointer of the interrupted code */
+struct Registers {
+    uintptr_t pc{};
+    uintptr_t fp{};
+    uintptr_t sp{};
+};
+
+bool interruptedRegisters(const void* context, Registers& registers)
+{
+    const auto& machine = static_cast<const ucontext_t*>(context)->uc_mcontext;
+#if defined(__linux__) && defined(__x86_64__)
+    registers.pc = static_cast<uintptr_t>(machine.gregs[REG_RIP]);
+    registers.fp = static_cast<uintptr_t>(machine.gregs[REG_RBP]);
+    registers.sp = static_cast<uintptr_t>(machine.gregs[REG_RSP]);
+    return true;
+#elif defined(__linux__) && defined(__aarch64__)
+    registers.pc = machine.pc;
+    registers.fp = machine.regs[29];
+    registers.sp = machine.sp;
+    return true;
+#else
+    (void)machine;
+    (void)registers;
+    return false;
+#endif
+}
+
+/** Copy the frame record at `fp`, failing rather than faulting when it is not mapped */
+bool readFrameRecord(uintptr_t fp, uintptr_t (&record)[2])
+{
+    iovec local{record, sizeof(record)};
+    iovec remote{reinterpret_cast<void*>(fp), sizeof(record)};
+    return ::process_vm_readv(::getpid(), &local, 1, &remote, 1, 0) == static_cast<ssize_t>(sizeof(record));
+}
+
+/**
+ * Walk the frame pointer chain of the interrupted code, async-signal-safe unlike
+ * backtrace(). Each frame record holds the caller's frame pointer and the return address
+ * and lies above the previous one on the same stack, the walk ends at the first that
+ * does not. Code built without frame pointers loses its callers.
+ * @return number of addresses stored in `frames`, the interrupted one first
+ */
+int walkFramePointers(const void* context, void** frames, int capacity)
+{
+    Registers registers;
+    if (!interruptedRegisters(context, registers) || capacity == 0) {
+        return 0;
+    }
+    int depth = 0;
+    frames[depth++] = reinterpret_cast<void*>(registers.pc);
+
+    uintptr_t fp = registers.fp;
+    uintptr_t lowest = registers.sp;
+    while (depth < capacity && fp >= lowest && fp - registers.sp < kMaxStackBytes && fp % alignof(uintptr_t) == 0) {
+        uintptr_t record[2]{};
+        if (!readFrameRecord(fp, record) || record[1] == 0) {
+            break;
+        }
+        frames[depth++] = reinterpret_cast<void*>(record[1]);
+        lowest = fp + sizeof(record);
+        fp = record[0];
+    }
+    return depth;
+}
+
+/** Function name containing `address`, or the module and offset when it has no symbol */
+std::string symbolize(void* address)
+{
+    Dl_info info{};
+    if (::dladdr(address, &info) == 0) {
+        return fmt::format("{}", address);
+    }
+    if (info.dli_sname != nullptr) {
+        int status = 0;
+        std::unique_ptr<char, decltype(&std::free)> demangled(
+                abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status), &std::free);
+        return status == 0 ? demangled.get() : info.dli_sname;
+    }
+    const auto offset = static_cast<const char*>(address) - static_cast<const char*>(info.dli_fbase);
+    return fmt::format("{}+{:#x}", fs::path(info.dli_fname).filename().string(), offset);
+}
+} // namespace
+
+struct Profiler::Buffer {
+    struct Sample {
+        std::atomic<bool> ready{};
+        const char* region{};
+        int depth{};
+        void* frames[kMaxDepth]{};
+    };
+
+    explicit Buffer(size_t capacity) :
+        samples(std::make_unique<Sample[]>(capacity)), capacity(capacity) {}
+
+    size_t recorded() const { return std::min(next.load(), capacity); }
+
+    std::unique_ptr<Sample[]> samples;
+    size_t capacity{};
+    std::atomic<size_t> next{}; // slot claimed by the next sample, may run past capacity
+};
+
+Profiler::Region::Region(const char* name) :
+    m_previous(t_region)
+{
+    t_region = name;
+    std::atomic_signal_fence(std::memory_order_release);
+}
+
+Profiler::Region::~Region()
+{
+    std::atomic_signal_fence(std::memory_order_release);
+    t_region = m_previous;
+}
+
+const char* Profiler::Region::current()
+{
+    return t_region;
+}
+
+Profiler& Profiler::shared()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::~Profiler()
+{
+    if (m_watcher.joinable()) {
+        s_toggleFd = -1;
+        m_watcher.request_stop();
+        const char byte = 0;
+        [[maybe_unused]] const auto written = ::write(m_signalPipe[1], &byte, 1); // wake the watcher
+        m_watcher.join();
+        ::close(m_signalPipe[0]);
+        ::close(m_signalPipe[1]);
+    }
+    stop();
+}
+
+// runs in signal context: no allocation, no locks
+void Profiler::onSample(int, siginfo_t*, void* context)
+{
+    const int savedErrno = errno;
+    Profiler& profiler = shared();
+    profiler.m_inHandler.fetch_add(1);
+    if (Buffer* buffer = profiler.m_active.load()) {
+        if (const size_t slot = buffer->next.fetch_add(1); slot < buffer->capacity) {
+            auto& sample = buffer->samples[slot];
+            sample.depth = walkFramePointers(context, sample.frames, kMaxDepth);
+            sample.region = t_region;
+            sample.ready.store(true, std::memory_order_release);
+        }
+    }
+    profiler.m_inHandler.fetch_sub(1);
+    errno = savedErrno;
+}
+
+Result<> Profiler::start(Options options)
+{
+    if (options.frequency <= 0 || options.frequency > kMaxFrequency) {
+        return makeError("profiler frequency must be between 1 and {} Hz, got {}", kMaxFrequency, options.frequency);
+    }
+    if (options.capacity == 0) {
+        return makeError("profiler capacity must not be zero");
+    }
+
+    std::lock_guard lock(m_mutex);
+    if (m_running) {
+        return makeError("profiler is already running");
+    }
+    releaseBuffer();
+
+    struct sigaction action {};
+    action.sa_sigaction = &Profiler::onSample;
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    if (::sigaction(SIGPROF, &action, nullptr) == -1) {
+        return makeError("failed to install SIGPROF handler: {}", std::strerror(errno));
+    }
+
+    m_buffer = std::make_unique<Buffer>(options.capacity);
+    m_active = m_buffer.get();
+
+    const auto interval = static_cast<suseconds_t>(1'000'000 / options.frequency);
+    const itimerval timer{{interval / 1'000'000, interval % 1'000'000}, {interval / 1'000'000, interval % 1'000'000}};
+    if (::setitimer(ITIMER_PROF, &timer, nullptr) == -1) {
+        m_active = nullptr;
+        return makeError("failed to start profiling timer: {}", std::strerror(errno));
+    }
+    m_running = true;
+    return {};
+}
+
+void Profiler::stop()
+{
+    std::lock_guard lock(m_mutex);
+    if (!m_running) {
+        return;
+    }
+    const itimerval disarmed{};
+    ::setitimer(ITIMER_PROF, &disarmed, nullptr);
+    m_active = nullptr;
+    m_running = false;
+}
+
+void Profiler::clear()
+{
+    stop();
+    std::lock_guard lock(m_mutex);
+    releaseBuffer();
+}
+
+void Profiler::releaseBuffer()
+{
+    // a signal delivered just before the timer stopped may still be writing a sample
+    while (m_inHandler.load() != 0) {
+        std::this_thread::yield();
+    }
+    m_buffer.reset();
+}
+
+size_t Profiler::samples() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_buffer ? m_buffer->recorded() : 0;
+}
+
+size_t Profiler::dropped() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_buffer ? m_buffer->next.load() - m_buffer->recorded() : 0;
+}
+
+std::string Profiler::folded() const
+{
+    std::lock_guard lock(m_mutex);
+    if (!m_buffer) {
+        return {};
+    }
+
+    std::unordered_map<void*, std::string> names; // the same frames recur in most samples
+    std::map<std::string, size_t> stacks;
+    std::string stack;
+    for (size_t i = 0; i < m_buffer->recorded(); ++i) {
+        const auto& sample = m_buffer->samples[i];
+        if (!sample.ready.load(std::memory_order_acquire)) {
+            continue; // claimed by a handler still running
+        }
+
+        stack.assign(sample.region != nullptr ? sample.region : "");
+        for (int frame = sample.depth - 1; frame >= 0; --frame) {
+            // return addresses point past the call, the interrupted frame is exact
+            void* address = sample.frames[frame];
+            if (frame != 0) {
+                address = static_cast<char*>(address) - 1;
+            }
+            auto [it, inserted] = names.try_emplace(address);
+            if (inserted) {
+                it->second = symbolize(address);
+            }
+            if (!stack.empty()) {
+                stack += ';';
+            }
+            stack += it->second;
+        }
+        if (!stack.empty()) {
+            ++stacks[stack];
+        }
+    }
+
+    std::string result;
+    for (const auto& [frames, count] : stacks) {
+        result += fmt::format("{} {}\n", frames, count);
+    }
+    return result;
+}
+
+Result<> Profiler::writeFolded(const fs::path& path) const
+{
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        return makeError("failed to open {}: {}", path.string(), std::strerror(errno));
+    }
+    file << folded();
+    if (!file.flush()) {
+        return makeError("failed to write {}", path.string());
+    }
+    return {};
+}
+
+Result<> Profiler::toggleOnSignal(int signal, fs::path output)
+{
+    std::lock_guard lock(m_mutex);
+    if (m_watcher.joinable()) {
+        return makeError("profiler is already toggled by a signal");
+    }
+
+    if (::pipe(m_signalPipe) == -1) {
+        return makeError("failed to open pipe: {}", std::strerror(errno));
+    }
+    for (int fd : m_signalPipe) {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    // the handler must never block on a full pipe
+    ::fcntl(m_signalPipe[1], F_SETFL, O_NONBLOCK);
+
+    m_watcher = std::jthread([this, readFd = m_signalPipe[0], output = std::move(output)](std::stop_token stop) {
+        watchSignal(stop, readFd, output);
+    });
+    s_toggleFd = m_signalPipe[1];
+
+    struct sigaction action {};
+    action.sa_handler = &onToggleSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (::sigaction(signal, &action, nullptr) == -1) {
+        return makeError("failed to install handler for signal {}: {}", signal, std::strerror(errno));
+    }
+    return {};
+}
+
+void Profiler::watchSignal(std::stop_token stop, int readFd, fs::path output)
+{
+    while (true) {
+        char byte{};
+        if (::read(readFd, &byte, 1) == -1 && errno == EINTR) {
+            continue;
+        }
+        if (stop.stop_requested()) {
+            return;
+        }
+
+        if (running()) {
+            Profiler::stop();
+            if (auto written = writeFolded(output); !written) {
+                std::cerr << written.error().message << std::endl;
+            }
+        } else if (auto started = start(); !started) {
+            std::cerr << started.error().message << std::endl;
+        }
+    }
+}
+
+Result<> addProfilerBuiltins(Vm& vm)
+{
+    vm.addParam("profile-action", [](const std::string& s) {
+        return s == "start" || s == "stop" || s == "status";
+    });
+
+    return vm.addBuiltin("profile", {"profile-action"}, [](const std::vector<std::string>& args, std::ostream& out) -> Result<int> {
+        auto& profiler = Profiler::shared();
+        const std::string action = args.empty() ? "status" : args.front();
+
+        if (action == "start") {
+            Profiler::Options options;
+            if (args.size() > 1) {
+                const auto& arg = args[1];
+                auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), options.frequency);
+                if (ec != std::errc{} || end != arg.data() + arg.size()) {
+                    return makeError("profile: invalid frequency {}", arg);
+                }
+            }
+            if (auto started = profiler.start(options); !started) {
+                return std::unexpected(started.error());
+            }
+            out << fmt::format("profiling at {} Hz\n", options.frequency);
+            return 0;
+        }
+        if (action == "stop") {
+            profiler.stop();
+            if (args.size() > 1) {
+                if (auto written = profiler.writeFolded(args[1]); !written) {
+                    return std::unexpected(written.error());
+                }
+                out << fmt::format("wrote {} samples to {}\n", profiler.samples(), args[1]);
+            } else {
+                out << profiler.folded();
+            }
+            return 0;
+        }
+        if (action == "status") {
+            out << fmt::format("profiler {}, {} samples, {} dropped\n",
+                    profiler.running() ? "running" : "stopped", profiler.samples(), profiler.dropped());
+            return 0;
+        }
+        return makeError("profile: unknown action {}, expected start, stop or status", action);
+    });
+}
+
+} // namespace crew
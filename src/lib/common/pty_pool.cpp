@@ -0,0 +1,214 @@
+#include <common/pty_pool.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#ifdef __APPLE__
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace crew {
+namespace {
+/** Keep pooled fds out of every other child the process spawns */
+Result<> setCloseOnExec(int fd)
+{
+    if (::fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+        return makeError("fcntl(FD_CLOEXEC) failed: {}", std::strerror(errno));
+    }
+    return {};
+}
+} // namespace
+
+PtyPool::Lease::Lease(Lease&& other) noexcept :
+    m_pool(other.m_pool), m_pty(std::exchange(other.m_pty, {})), m_reusable(other.m_reusable)
+{
+}
+
+PtyPool::Lease::~Lease()
+{
+    if (m_pty.master == -1) {
+        return; // moved from
+    }
+    if (m_reusable) {
+        m_pool->release(m_pty);
+    } else {
+        PtyPool::close(m_pty);
+    }
+}
+
+void PtyPool::Lease::discard()
+{
+    if (m_pty.slave != -1) {
+        ::close(m_pty.slave);
+        m_pty.slave = -1;
+    }
+    m_reusable = false;
+}
+
+PtyPool::PtyPool(size_t capacity) :
+    m_capacity(capacity)
+{
+}
+
+PtyPool::~PtyPool()
+{
+    for (const Pty& pty : m_idle) {
+        close(pty);
+    }
+}
+
+PtyPool& PtyPool::shared()
+{
+    static PtyPool pool;
+    return pool;
+}
+
+Result<PtyPool::Lease> PtyPool::acquire()
+{
+    std::optional<Pty> pty;
+    struct winsize size {};
+    {
+        std::lock_guard lock(m_mutex);
+        size.ws_row = m_rows;
+        size.ws_col = m_cols;
+        if (!m_idle.empty()) {
+            pty = m_idle.back();
+            m_idle.pop_back();
+        }
+    }
+
+    if (!pty.has_value()) {
+        auto opened = open();
+        if (!opened) {
+            return std::unexpected(opened.error());
+        }
+        pty = *opened;
+    }
+
+    // applied on every checkout, the window size may have changed while it was idle
+    if (::ioctl(pty->slave, TIOCSWINSZ, &size) == -1) {
+        auto error = makeError("ioctl(TIOCSWINSZ) failed: {}", std::strerror(errno));
+        close(*pty);
+        return std::unexpected(error);
+    }
+    return Lease(*this, *pty);
+}
+
+Result<> PtyPool::prewarm(size_t count)
+{
+    while (idle() < std::min(count, m_capacity)) {
+        auto pty = open();
+        if (!pty) {
+            return std::unexpected(pty.error());
+        }
+        std::lock_guard lock(m_mutex);
+        m_idle.push_back(*pty);
+    }
+    return {};
+}
+
+void PtyPool::setWindowSize(uint16_t rows, uint16_t cols)
+{
+    std::lock_guard lock(m_mutex);
+    m_rows = rows;
+    m_cols = cols;
+}
+
+size_t PtyPool::idle() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_idle.size();
+}
+
+Result<PtyPool::Pty> PtyPool::open()
+{
+    Pty pty;
+    if (::openpty(&pty.master, &pty.slave, /*name*/ nullptr, nullptr, nullptr) == -1) {
+        return makeError("openpty() failed: {}", std::strerror(errno));
+    }
+    for (int fd : {pty.master, pty.slave}) {
+        if (auto set = setCloseOnExec(fd); !set) {
+            close(pty);
+            return std::unexpected(set.error());
+        }
+    }
+
+    std::lock_guard lock(m_mutex);
+    if (!m_defaultTermios.has_value()) {
+        struct termios settings {};
+        if (::tcgetattr(pty.slave, &settings) == -1) {
+            auto error = makeError("tcgetattr() failed: {}", std::strerror(errno));
+            close(pty);
+            return std::unexpected(error);
+        }
+        m_defaultTermios = settings;
+    }
+    return pty;
+}
+
+Result<> PtyPool::reset(const Pty& pty) const
+{
+    // drop anything the previous command left unread in either direction
+    if (::tcflush(pty.master, TCIOFLUSH) == -1 || ::tcflush(pty.slave, TCIOFLUSH) == -1) {
+        return makeError("tcflush() failed: {}", std::strerror(errno));
+    }
+    // the command may have switched to raw mode, disabled echo etc.
+    if (m_defaultTermios.has_value() && ::tcsetattr(pty.slave, TCSANOW, &*m_defaultTermios) == -1) {
+        return makeError("tcsetattr() failed: {}", std::strerror(errno));
+    }
+    return {};
+}
+
+bool PtyPool::detach(Pty& pty)
+{
+    // once our slave is closed the master reports a hangup, unless a process of the previous
+    // command (e.g. one that left the session) still has the slave open and could write into
+    // the next command's output. Processes that were just killed may take a moment to close it
+    ::close(pty.slave);
+    pty.slave = -1;
+    struct pollfd master {.fd = pty.master, .events = POLLIN, .revents = 0};
+    if (::poll(&master, 1, kHangupTimeoutMs) != 1 || (master.revents & POLLHUP) == 0) {
+        return false;
+    }
+
+    std::array<char, 64> name{};
+    if (::ptsname_r(pty.master, name.data(), name.size()) != 0) {
+        return false;
+    }
+    pty.slave = ::open(name.data(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    return pty.slave != -1;
+}
+
+void PtyPool::release(Pty pty)
+{
+    if (!detach(pty)) {
+        close(pty);
+        return;
+    }
+    std::lock_guard lock(m_mutex);
+    if (m_idle.size() >= m_capacity || !reset(pty)) {
+        close(pty);
+        return;
+    }
+    m_idle.push_back(pty);
+}
+
+void PtyPool::close(Pty pty)
+{
+    if (pty.slave != -1) {
+        ::close(pty.slave);
+    }
+    if (pty.master != -1) {
+        ::close(pty.master);
+    }
+}
+
+} // namespace crew
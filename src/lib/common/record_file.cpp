@@ -0,0 +1,80 @@
+#include <common/record_file.hpp>
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+
+#include <fcntl.h>
+
+#include <fmt/std.h>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+
+Result<std::string> readRecordBytes(const fs::path& path, const RecordFormat& format, size_t recordSize)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return {}; // nothing written yet
+    }
+
+    std::array<char, 4> magic{};
+    uint32_t version{};
+    uint64_t count{};
+    in.read(magic.data(), magic.size());
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!in || magic != format.magic || version != format.version) {
+        return {};
+    }
+
+    // checked before allocating, a corrupt count must not ask for all of memory
+    std::error_code ec;
+    const uint64_t available = fs::file_size(path, ec) - static_cast<uint64_t>(in.tellg());
+    if (ec || count > available / recordSize) {
+        return makeError("{} is truncated", path);
+    }
+    std::string bytes(count * recordSize, '\0');
+    in.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    if (!in) {
+        return makeError("{} is truncated", path);
+    }
+    return bytes;
+}
+
+Result<> writeRecordBytes(const fs::path& path, const RecordFormat& format, size_t recordSize, std::string_view bytes)
+{
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+
+    // unique per call, threads of one process may save at the same time
+    std::string name = path.string() + ".XXXXXX";
+    UniqueFd created(::mkostemp(name.data(), O_CLOEXEC));
+    if (created.get() == -1) {
+        return makeError("failed to create a temporary file beside {}: {}", path, std::strerror(errno));
+    }
+    const fs::path temporary = name;
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        const uint64_t count = bytes.size() / recordSize;
+        out.write(format.magic.data(), format.magic.size());
+        out.write(reinterpret_cast<const char*>(&format.version), sizeof(format.version));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!out.flush()) {
+            fs::remove(temporary, ec);
+            return makeError("failed to write {}", temporary);
+        }
+    }
+
+    fs::rename(temporary, path, ec);
+    if (ec) {
+        std::error_code ignored;
+        fs::remove(temporary, ignored);
+        return makeError("failed to replace {}: {}", path, ec.message());
+    }
+    return {};
+}
+
+} // namespace crew
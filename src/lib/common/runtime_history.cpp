@@ -0,0 +1,110 @@
+#include <common/command.hpp>
+#include <common/file_hash.hpp>
+#include <common/record_file.hpp>
+#include <common/runtime_history.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+namespace {
+constexpr RecordFormat kHistoryFormat{{'C', 'R', 'W', 'R'}, 1};
+
+struct Record {
+    uint64_t key{};
+    double seconds{};
+    uint32_t runs{};
+    uint32_t lastRun{}; // generation of the newest run, zero in files from before it was kept
+};
+} // namespace
+
+RuntimeHistory::RuntimeHistory(std::optional<fs::path> file) :
+    m_file(std::move(file))
+{
+}
+
+fs::path RuntimeHistory::defaultPath()
+{
+    if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache != nullptr && *cache != '\0') {
+        return fs::path(cache) / "crew" / "runtime-history";
+    }
+    const char* home = std::getenv("HOME");
+    return fs::path(home != nullptr ? home : ".") / ".cache" / "crew" / "runtime-history";
+}
+
+RuntimeHistory::Key RuntimeHistory::key(const Command& command)
+{
+    std::error_code ec;
+    fs::path cwd = command.currentDir().value_or(fs::current_path(ec));
+    cwd = fs::absolute(cwd, ec).lexically_normal();
+
+    std::string normalized = cwd.string();
+    bool first = true;
+    for (std::string_view arg : command.argv()) {
+        normalized.push_back('\0');
+        normalized.append(first ? fs::path(arg).filename().string() : std::string(arg));
+        first = false;
+    }
+    return hash64(normalized);
+}
+
+Result<> RuntimeHistory::load()
+{
+    if (!m_file.has_value()) {
+        return {};
+    }
+    auto records = readRecords<Record>(*m_file, kHistoryFormat);
+    if (!records) {
+        return makeError("failed to load runtime history: {}", records.error().message);
+    }
+    for (const Record& record : *records) {
+        m_entries.try_emplace(record.key, Entry{record.seconds, record.runs, record.lastRun});
+        m_generation = std::max(m_generation, record.lastRun + 1);
+    }
+    return {};
+}
+
+Result<> RuntimeHistory::save() const
+{
+    if (!m_file.has_value()) {
+        return {};
+    }
+    std::vector<Record> records;
+    records.reserve(m_entries.size());
+    for (const auto& [key, entry] : m_entries) {
+        records.push_back({key, entry.seconds, entry.runs, entry.lastRun});
+    }
+    if (records.size() > kMaxEntries) {
+        // keep the commands run most recently, the others are likely gone
+        std::ranges::nth_element(records, records.begin() + kMaxEntries, std::ranges::greater(), &Record::lastRun);
+        records.resize(kMaxEntries);
+    }
+    if (auto written = writeRecords<Record>(*m_file, kHistoryFormat, records); !written) {
+        return makeError("failed to save runtime history: {}", written.error().message);
+    }
+    return {};
+}
+
+void RuntimeHistory::record(Key key, Seconds runtime)
+{
+    auto [it, inserted] = m_entries.try_emplace(key, Entry{runtime.count(), 1, m_generation});
+    if (!inserted) {
+        Entry& entry = it->second;
+        entry.seconds += kSmoothing * (runtime.count() - entry.seconds);
+        ++entry.runs;
+        entry.lastRun = m_generation;
+    }
+}
+
+std::optional<RuntimeHistory::Seconds> RuntimeHistory::expected(Key key) const
+{
+    if (auto it = m_entries.find(key); it != m_entries.end()) {
+        return Seconds(it->second.seconds);
+    }
+    return std::nullopt;
+}
+
+} // namespace crew
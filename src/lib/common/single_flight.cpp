@@ -0,0 +1,199 @@
+#include <common/command.hpp>
+#include <common/single_flight.hpp>
+
+#include <condition_variable>
+#include <optional>
+#include <streambuf>
+
+namespace crew {
+
+/** Output and result of an execution, shared with the callers attached to it */
+struct SingleFlight::Flight {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::string out;
+    std::string err;
+    std::optional<Result<int>> result;
+    size_t followers{};
+    bool full{}; // past the replay limit, so no new followers
+};
+
+/** Forwards to the executing caller's stream while recording into the flight */
+class SingleFlight::TeeBuffer : public std::streambuf {
+public:
+    TeeBuffer(std::ostream& dest, Flight& flight, std::string Flight::*record, size_t maxReplay) :
+        m_dest(dest), m_flight(flight), m_record(record), m_maxReplay(maxReplay) {}
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        m_dest.write(s, n);
+        {
+            std::lock_guard lock(m_flight.mutex);
+            if (m_flight.full && m_flight.followers == 0) {
+                return n; // nobody left to receive it
+            }
+            (m_flight.*m_record).append(s, static_cast<size_t>(n));
+            if (!m_flight.full && m_flight.out.size() + m_flight.err.size() > m_maxReplay) {
+                m_flight.full = true;
+                if (m_flight.followers == 0) {
+                    std::string().swap(m_flight.out);
+                    std::string().swap(m_flight.err);
+                }
+            }
+        }
+        m_flight.changed.notify_all();
+        return n;
+    }
+
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            char ch = traits_type::to_char_type(c);
+            xsputn(&ch, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override
+    {
+        m_dest.flush();
+        return 0;
+    }
+
+private:
+    std::ostream& m_dest;
+    Flight& m_flight;
+    std::string Flight::*m_record;
+    size_t m_maxReplay{};
+};
+
+SingleFlight& SingleFlight::shared()
+{
+    static SingleFlight flights;
+    return flights;
+}
+
+std::string SingleFlight::identity(const Command& command, RunMode mode)
+{
+    // fields are separated by '\0', which cannot occur within any of them
+    std::string key(1, static_cast<char>(mode));
+    for (std::string_view arg : command.argv()) {
+        key.append(arg).push_back('\0');
+    }
+    key.push_back('\0');
+    if (command.currentDir().has_value()) {
+        key.append(command.currentDir()->string());
+    }
+    key.push_back('\0');
+    if (command.environment().has_value()) {
+        for (char* const* entry = command.environment()->envp(); *entry != nullptr; ++entry) {
+            key.append(*entry).push_back('\0');
+        }
+    }
+    key.push_back('\0');
+    for (const auto& [k, v] : command.envOverrides()) {
+        key.append(k).append("=").append(v).push_back('\0');
+    }
+    key.push_back('\0');
+    if (command.timeout().has_value()) {
+        key.append(std::to_string(command.timeout()->count()));
+    }
+    key.push_back('\0');
+    key.push_back(command.newSession() ? '1' : '0');
+    key.push_back(command.cgroup() ? '1' : '0');
+    key.push_back(command.highVolume() ? '1' : '0');
+    key.append(fmt::format("{}", static_cast<const void*>(command.backend())));
+    return key;
+}
+
+Result<int> SingleFlight::run(const std::string& key, std::ostream& out, std::ostream& err, const Execute& execute)
+{
+    std::shared_ptr<Flight> flight;
+    bool leader = false;
+    {
+        std::lock_guard lock(m_mutex);
+        auto& slot = m_flights[key];
+        if (slot != nullptr) {
+            std::lock_guard flightLock(slot->mutex);
+            if (!slot->full) {
+                ++slot->followers;
+                flight = slot;
+            }
+        }
+        if (flight == nullptr) {
+            // the one in flight, if any, has output it can no longer replay
+            slot = std::make_shared<Flight>();
+            flight = slot;
+            leader = true;
+            ++m_stats.executed;
+        } else {
+            ++m_stats.coalesced;
+        }
+    }
+
+    if (leader) {
+        TeeBuffer outTee(out, *flight, &Flight::out, m_maxReplay);
+        TeeBuffer errTee(err, *flight, &Flight::err, m_maxReplay);
+        std::ostream outStream(&outTee);
+        std::ostream errStream(&errTee);
+        Result<int> result = execute(outStream, errStream);
+
+        {
+            // later callers start a new execution rather than attaching to a finished one
+            std::lock_guard lock(m_mutex);
+            if (auto it = m_flights.find(key); it != m_flights.end() && it->second == flight) {
+                m_flights.erase(it);
+            }
+        }
+        {
+            std::lock_guard lock(flight->mutex);
+            flight->result = result;
+        }
+        flight->changed.notify_all();
+        return result;
+    }
+
+    // follow the execution, writing outside the lock so a slow stream does not stall it
+    size_t outSent = 0;
+    size_t errSent = 0;
+    while (true) {
+        std::string outChunk;
+        std::string errChunk;
+        bool finished = false;
+        {
+            std::unique_lock lock(flight->mutex);
+            flight->changed.wait(lock, [&] {
+                return flight->result.has_value() || flight->out.size() > outSent || flight->err.size() > errSent;
+            });
+            outChunk = flight->out.substr(outSent);
+            errChunk = flight->err.substr(errSent);
+            finished = flight->result.has_value();
+        }
+        outSent += outChunk.size();
+        errSent += errChunk.size();
+        out << outChunk;
+        err << errChunk;
+
+        if (finished) {
+            out.flush();
+            err.flush();
+            std::lock_guard lock(flight->mutex);
+            return *flight->result;
+        }
+    }
+}
+
+SingleFlight::Stats SingleFlight::stats() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+size_t SingleFlight::inFlight() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_flights.size();
+}
+
+} // namespace crew
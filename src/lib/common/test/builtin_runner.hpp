@@ -0,0 +1,49 @@
+/**
+ * Running builtin command lines in tests
+ */
+#ifndef CREW_TEST_BUILTIN_RUNNER_HPP
+#define CREW_TEST_BUILTIN_RUNNER_HPP
+
+#include <common/interpreter.hpp>
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fmt/ranges.h>
+
+namespace crew {
+
+/** What a builtin command line returned and wrote */
+struct BuiltinRun {
+    Result<int> status;
+    std::string output;
+};
+
+/** Parse and run the command line `tokens` in `vm`, a line that does not parse fails the test */
+inline BuiltinRun runBuiltin(Vm& vm, std::vector<std::string> tokens)
+{
+    const std::string line = fmt::format("{}", fmt::join(tokens, " "));
+    auto parsed = vm.parseTokens(std::move(tokens));
+    if (!parsed.has_value()) {
+        ADD_FAILURE() << "no command matches " << line;
+        return {makeError("no command matches {}", line), {}};
+    }
+    std::ostringstream out;
+    auto status = vm.execute(*parsed, out);
+    return {std::move(status), out.str()};
+}
+
+/** Output of a command line expected to succeed, failing the test otherwise */
+inline std::string builtinOutput(Vm& vm, std::vector<std::string> tokens)
+{
+    const std::string line = fmt::format("{}", fmt::join(tokens, " "));
+    auto run = runBuiltin(vm, std::move(tokens));
+    EXPECT_TRUE(run.status.has_value() && *run.status == 0) << line << ": " << (run.status ? std::to_string(*run.status) : run.status.error().message);
+    return run.output;
+}
+
+} // namespace crew
+#endif
@@ -0,0 +1,66 @@
+#include <common/allocation_tracker.hpp>
+#include <common/interpreter.hpp>
+#include <common/profiler.hpp>
+
+#include "builtin_runner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+
+namespace crew {
+namespace {
+const AllocationTracker::Usage* find(const std::vector<AllocationTracker::Usage>& usage, const std::string& subsystem)
+{
+    auto it = std::find_if(usage.begin(), usage.end(), [&](const auto& u) { return u.subsystem == subsystem; });
+    return it == usage.end() ? nullptr : &*it;
+}
+} // namespace
+
+TEST(AllocationTracker, CountsPerRegion)
+{
+    AllocationTracker::setEnabled(true);
+    const auto before = AllocationTracker::snapshot();
+    {
+        Profiler::Region region("tracked");
+        for (int i = 0; i < 10; ++i) {
+            auto allocated = std::make_unique<char[]>(100);
+            ASSERT_NE(allocated, nullptr);
+        }
+    }
+    AllocationTracker::setEnabled(false);
+    {
+        Profiler::Region region("untracked");
+        auto allocated = std::make_unique<char[]>(100);
+        ASSERT_NE(allocated, nullptr);
+    }
+
+    const auto usage = AllocationTracker::snapshot().since(before);
+    const auto* tracked = find(usage, "tracked");
+    ASSERT_NE(tracked, nullptr);
+    EXPECT_EQ(tracked->allocations, 10u);
+    EXPECT_EQ(tracked->bytes, 1000u);
+    EXPECT_EQ(find(usage, "untracked"), nullptr);
+}
+
+TEST(AllocationTracker, Builtin)
+{
+    Vm vm;
+    ASSERT_TRUE(addStatsBuiltins(vm));
+    builtinOutput(vm, {"stats", "reset"});
+    builtinOutput(vm, {"stats", "on"});
+    {
+        Profiler::Region region("builtin");
+        auto allocated = std::make_unique<std::string>(64, 'x');
+        ASSERT_NE(allocated, nullptr);
+    }
+    builtinOutput(vm, {"stats", "off"});
+
+    const std::string table = builtinOutput(vm, {"stats"});
+    EXPECT_TRUE(table.starts_with("allocation tracking is off"));
+    EXPECT_NE(table.find("builtin"), std::string::npos);
+    EXPECT_FALSE(runBuiltin(vm, {"stats", "sideways"}).status);
+}
+
+} // namespace crew
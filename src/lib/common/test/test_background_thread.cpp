@@ -0,0 +1,50 @@
+#include <common/background_thread.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include <sys/wait.h>
+
+namespace crew {
+
+TEST(BackgroundThread, StopEndsAWaitingLoop)
+{
+    std::mutex mutex;
+    std::condition_variable_any changed;
+    std::atomic<bool> returned{};
+    BackgroundThread thread;
+    thread.start([&](std::stop_token stop) {
+        std::unique_lock lock(mutex);
+        changed.wait(lock, stop, [] { return false; });
+        returned = true;
+    });
+    EXPECT_TRUE(thread.stop());
+    EXPECT_TRUE(returned);
+    EXPECT_TRUE(thread.stop()); // already stopped
+}
+
+TEST(BackgroundThread, ForkedChildLeavesTheThreadAlone)
+{
+    BackgroundThread thread;
+    thread.start([](std::stop_token stop) {
+        while (!stop.stop_requested()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    const int pid = ::fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+        ::_exit(thread.stop() ? 1 : 0);
+    }
+    int status{};
+    ASSERT_EQ(::waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+    EXPECT_TRUE(thread.stop());
+}
+
+} // namespace crew
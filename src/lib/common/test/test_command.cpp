@@ -1,7 +1,17 @@
 #include <common/command.hpp>
+#include <common/command_spec.hpp>
+#include <common/pty_pool.hpp>
+#include <common/single_flight.hpp>
 
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
 using testing::ExitedWithCode;
 
 namespace crew {
@@ -13,6 +23,14 @@ TEST(Command, RunExecPty)
             "hello");
 }
 
+TEST(Command, RunExecPtyLogsFirst)
+{
+    // the line is queued for the logger's thread, which the process image goes away with
+    EXPECT_EXIT(Command("true").setVerbose(true).run(RunMode::ExecPty),
+            ExitedWithCode(0),
+            "LOG: true");
+}
+
 TEST(Command, RunBlock)
 {
     std::stringstream outStr;
@@ -36,4 +54,345 @@ TEST(Command, RunBlockPty)
     EXPECT_EQ(outStr.str(), "helloErr\r\nhelloOut\r\n");
     EXPECT_EQ(errStr.str(), "");
 }
+
+TEST(Command, RunBlockPtyReusesPty)
+{
+    // the first command changes the pty's settings, the second must see them reset
+    std::stringstream first;
+    EXPECT_EQ(Command("bash", "-c", "stty cols 100 -echo; stty size").setOut(first).run(RunMode::BlockPty), 0);
+    EXPECT_EQ(first.str(), "24 100\r\n");
+    EXPECT_EQ(PtyPool::shared().idle(), 1u);
+
+    std::stringstream second;
+    EXPECT_EQ(Command("bash", "-c", "test -t 1 && stty size && stty -a | grep -o ' echo '").setOut(second).run(RunMode::BlockPty), 0);
+    EXPECT_EQ(second.str(), "24 80\r\n echo \r\n");
+    EXPECT_EQ(PtyPool::shared().idle(), 1u);
+}
+
+TEST(Command, RunBlockPtyDoesNotReuseAPtyStillInUse)
+{
+    // a background process ignoring the hangup is ended with the command, one that left the
+    // session keeps its pty out of the pool
+    for (const char* leak : {"(trap '' HUP; sleep 0.3; echo LEAKED) & echo first",
+             "setsid sh -c 'sleep 0.3; echo LEAKED' & echo first"}) {
+        std::stringstream first;
+        EXPECT_EQ(Command("bash", "-c", leak).setOut(first).run(RunMode::BlockPty), 0);
+        EXPECT_EQ(first.str(), "first\r\n");
+
+        std::stringstream second;
+        EXPECT_EQ(Command("bash", "-c", "sleep 0.8; echo second").setOut(second).run(RunMode::BlockPty), 0);
+        EXPECT_EQ(second.str(), "second\r\n") << leak;
+    }
+}
+
+TEST(Command, SingleFlightCoalesces)
+{
+    const auto path = std::filesystem::temp_directory_path() / fmt::format("crew-single-flight-{}", ::getpid());
+    std::filesystem::remove(path);
+    const auto before = SingleFlight::shared().stats();
+
+    // the marker file counts how often the command really ran
+    const auto script = fmt::format("echo started; echo run >> {}; sleep 0.3; echo done; exit 4", path.string());
+    std::stringstream firstOut;
+    std::stringstream secondOut;
+    Result<int> firstResult;
+    Result<int> secondResult;
+    std::jthread first([&] {
+        firstResult = Command("bash", "-c", script).setOut(firstOut).setSingleFlight(true).onError(OnError::Return).tryRun();
+    });
+    while (SingleFlight::shared().inFlight() == 0) {
+        std::this_thread::yield();
+    }
+    std::stringstream errStr;
+    secondResult = Command("bash", "-c", script).setOut(secondOut).setErr(errStr).setSingleFlight(true).tryRun();
+    first.join();
+
+    EXPECT_EQ(firstResult, 4);
+    EXPECT_FALSE(secondResult); // OnError::Fatal applies to the shared exit code
+    EXPECT_EQ(firstOut.str(), "started\ndone\n");
+    EXPECT_EQ(secondOut.str(), "started\ndone\n");
+
+    const auto after = SingleFlight::shared().stats();
+    EXPECT_EQ(after.executed - before.executed, 1u);
+    EXPECT_EQ(after.coalesced - before.coalesced, 1u);
+    EXPECT_EQ(SingleFlight::shared().inFlight(), 0u);
+    std::stringstream runs;
+    runs << std::ifstream(path).rdbuf();
+    EXPECT_EQ(runs.str(), "run\n");
+    std::filesystem::remove(path);
+}
+
+TEST(Command, SingleFlightKeysOnOptions)
+{
+    auto key = [](const Command& command) { return SingleFlight::identity(command, RunMode::Block); };
+    const auto plain = key(Command("make"));
+    EXPECT_EQ(key(Command("make")), plain);
+    EXPECT_NE(key(Command("make").setTimeout(std::chrono::seconds(1))), plain);
+    EXPECT_NE(key(Command("make").setTimeout(std::chrono::seconds(1))), key(Command("make").setTimeout(std::chrono::seconds(2))));
+    EXPECT_NE(key(Command("make").setNewSession(true)), plain);
+    EXPECT_NE(key(Command("make").setCgroup(true)), plain);
+    EXPECT_NE(key(Command("make").setHighVolume(true)), plain);
+}
+
+TEST(Command, SingleFlightStopsReplayingLargeOutput)
+{
+    SingleFlight flights(16);
+    std::stringstream ignored;
+    std::mutex mutex;
+    std::condition_variable changed;
+    int stage = 0;
+    auto advance = [&](int to) {
+        std::lock_guard lock(mutex);
+        stage = to;
+        changed.notify_all();
+    };
+    auto await = [&](int until) {
+        std::unique_lock lock(mutex);
+        changed.wait(lock, [&] { return stage >= until; });
+    };
+
+    std::stringstream firstOut;
+    std::jthread first([&] {
+        auto result = flights.run("key", firstOut, ignored, [&](std::ostream& out, std::ostream&) {
+            out << "0123456789";
+            out.flush();
+            advance(1);
+            await(2);
+            out << "abcdefghij"; // past the limit
+            out.flush();
+            advance(3);
+            await(4);
+            return Result<int>(0);
+        });
+        EXPECT_EQ(result, 0);
+    });
+
+    // attached before the limit, so it receives all of the output
+    await(1);
+    std::stringstream followerOut;
+    std::jthread follower([&] {
+        auto result = flights.run("key", followerOut, ignored, [](std::ostream&, std::ostream&) { return Result<int>(1); });
+        EXPECT_EQ(result, 0);
+    });
+    while (flights.stats().coalesced == 0) {
+        std::this_thread::yield();
+    }
+    advance(2);
+    await(3);
+
+    // arriving past the limit, it executes afresh
+    std::stringstream lateOut;
+    auto late = flights.run("key", lateOut, ignored, [](std::ostream& out, std::ostream&) {
+        out << "late";
+        return Result<int>(2);
+    });
+    EXPECT_EQ(late, 2);
+    advance(4);
+    first.join();
+    follower.join();
+
+    EXPECT_EQ(firstOut.str(), "0123456789abcdefghij");
+    EXPECT_EQ(followerOut.str(), "0123456789abcdefghij");
+    EXPECT_EQ(lateOut.str(), "late");
+    EXPECT_EQ(flights.stats().executed, 2u);
+    EXPECT_EQ(flights.stats().coalesced, 1u);
+    EXPECT_EQ(flights.inFlight(), 0u);
+}
+
+TEST(Command, TryRunReturnsError)
+{
+    std::stringstream outStr;
+    std::stringstream errStr;
+    auto failed = Command("bash", "-c", "exit 3")
+                          .setOut(outStr)
+                          .setErr(errStr)
+                          .tryRun();
+    ASSERT_FALSE(failed.has_value());
+    EXPECT_NE(failed.error().message.find("exit status: 3"), std::string::npos);
+
+    auto returned = Command("bash", "-c", "exit 3")
+                            .setOut(outStr)
+                            .setErr(errStr)
+                            .onError(OnError::Return)
+                            .tryRun();
+    ASSERT_TRUE(returned.has_value());
+    EXPECT_EQ(*returned, 3);
+}
+
+namespace {
+/** Whether `pid` has exited, waiting up to a second for it to be torn down */
+bool exited(int pid)
+{
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+        std::string ignored;
+        char state{};
+        if (!(stat >> ignored >> ignored >> state) || state == 'Z') {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+} // namespace
+
+TEST(Command, RunsInOwnSessionOnRequest)
+{
+    // by default the child leads a process group in the caller's session
+    struct Ids {
+        int pid{};
+        int pgid{};
+        int sid{};
+    };
+    const auto ids = [](Command command) {
+        std::stringstream out;
+        EXPECT_EQ(command.setOut(out).run(), 0);
+        Ids ids;
+        out >> ids.pid >> ids.pgid >> ids.sid;
+        return ids;
+    };
+    const std::string script = "echo $$ $(cut -d' ' -f5,6 /proc/$$/stat)";
+    const Ids grouped = ids(Command("bash", "-c", script));
+    EXPECT_EQ(grouped.pgid, grouped.pid);
+    EXPECT_EQ(grouped.sid, ::getsid(0));
+    if (::isatty(STDIN_FILENO)) {
+        // the group had the terminal while it ran and gave it back
+        EXPECT_EQ(::tcgetpgrp(STDIN_FILENO), ::getpgrp());
+        EXPECT_EQ(Command("bash", "-c", "test $(cut -d' ' -f8 /proc/$$/stat) = $$").onError(OnError::Return).run(), 0);
+    }
+
+    const Ids session = ids(Command("bash", "-c", script).setNewSession(true));
+    EXPECT_EQ(session.sid, session.pid);
+}
+
+TEST(Command, TimeoutKillsTree)
+{
+    for (auto [mode, newSession] : {std::pair{RunMode::Block, false}, {RunMode::Block, true}, {RunMode::BlockPty, false}}) {
+        std::stringstream out;
+        const auto start = std::chrono::steady_clock::now();
+        auto result = Command("bash", "-c", "sleep 30 & echo $!; wait")
+                              .setOut(out)
+                              .setNewSession(newSession)
+                              .setTimeout(std::chrono::milliseconds(200))
+                              .tryRun(mode);
+        ASSERT_FALSE(result.has_value());
+        EXPECT_NE(result.error().message.find("timed out"), std::string::npos);
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+
+        int background{};
+        ASSERT_TRUE(out >> background);
+        EXPECT_TRUE(exited(background)); // the grandchild went down with the tree
+    }
+
+    // commands finishing in time are unaffected
+    EXPECT_EQ(Command("true").setTimeout(std::chrono::seconds(10)).tryRun(), 0);
+}
+
+TEST(Command, TimeoutOutlivesOutput)
+{
+    // the child closing its output is not the end of it
+    const auto start = std::chrono::steady_clock::now();
+    auto result = Command("bash", "-c", "echo hi; exec >/dev/null 2>&1; sleep 5")
+                          .setTimeout(std::chrono::milliseconds(300))
+                          .tryRun();
+    ASSERT_FALSE(result.has_value());
+    EXPECT_NE(result.error().message.find("timed out"), std::string::npos);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(3));
+}
+
+TEST(Command, CgroupTearsDownEscapedDescendants)
+{
+    if (!ProcessTree({.cgroup = true}).inCgroup()) {
+        GTEST_SKIP() << "no delegated cgroup v2 hierarchy";
+    }
+    std::stringstream out;
+    ASSERT_EQ(Command("bash", "-c", "setsid sleep 30 >/dev/null 2>&1 & echo $!").setCgroup(true).setOut(out).run(), 0);
+    int escaped{};
+    ASSERT_TRUE(out >> escaped);
+    EXPECT_TRUE(exited(escaped));
+
+    // the child itself is left to finish after closing its output
+    EXPECT_EQ(Command("bash", "-c", "exec >/dev/null 2>&1; sleep 0.2; exit 3").setCgroup(true).onError(OnError::Return).tryRun(), 3);
+}
+
+TEST(Command, StopTokenCancels)
+{
+    std::stop_source stop;
+    std::jthread canceller([&stop] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        stop.request_stop();
+    });
+    auto result = Command("sleep", "30").setStopToken(stop.get_token()).tryRun();
+    ASSERT_FALSE(result.has_value());
+    EXPECT_NE(result.error().message.find("cancelled"), std::string::npos);
+
+    // already stopped, the child is killed as soon as it starts
+    result = Command("sleep", "30").setStopToken(stop.get_token()).tryRun();
+    EXPECT_FALSE(result.has_value());
+}
+
+TEST(Command, InterruptAllKillsRunningTrees)
+{
+    std::jthread interrupter([] {
+        while (ProcessTree::interruptAll() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    auto result = Command("sleep", "30").tryRun();
+    ASSERT_FALSE(result.has_value());
+    EXPECT_NE(result.error().message.find("interrupted"), std::string::npos);
+}
+
+TEST(Command, RunBlockHighVolume)
+{
+    std::stringstream outStr;
+    auto cmd = Command("head", "-c", "8388608", "/dev/zero")
+                       .setOut(outStr)
+                       .setHighVolume(true);
+    EXPECT_EQ(cmd.run(RunMode::Block), 0);
+    EXPECT_EQ(outStr.str().size(), 8388608u);
+}
+
+TEST(Command, CommandSpec)
+{
+    using Echo = CommandSpec<"bash", Lit<"-c">, Param<"string">, Lit<"crew">, Param<"file">>;
+    static_assert(Echo::kNumParams == 2);
+    static_assert(Echo::kArgv[1] == "-c");
+    static_assert(Echo::kParamTypes[1] == "file");
+    static_assert(Echo::accepts<std::string, std::filesystem::path>());
+    static_assert(!Echo::accepts<std::string>());
+    static_assert(!Echo::accepts<std::filesystem::path, std::string>());
+
+    std::stringstream outStr;
+    auto cmd = Echo::make("echo $0 $1", std::filesystem::path("/tmp"))
+                       .setOut(outStr);
+    EXPECT_EQ(cmd.toString(), "bash -c echo $0 $1 crew /tmp");
+    EXPECT_EQ(cmd.run(RunMode::Block), 0);
+    EXPECT_EQ(outStr.str(), "crew /tmp\n");
+
+    Vm vm;
+    vm.addParam("string", [](const std::string& s) { return !s.empty(); });
+    EXPECT_FALSE(Echo::addTo(vm, "echo").has_value()); // no "file" param type
+    vm.addParam("file", [](const std::string&) { return true; });
+    EXPECT_TRUE(Echo::addTo(vm, "echo").has_value());
+    EXPECT_NE(vm.findCommandPtr("echo"), nullptr);
+}
+
+TEST(Command, RejectsNulInArguments)
+{
+    using namespace std::string_literals;
+    std::stringstream outStr;
+    auto rejected = Command("echo", "a\0b"s).setOut(outStr).onError(OnError::Return).tryRun();
+    ASSERT_FALSE(rejected.has_value());
+    EXPECT_NE(rejected.error().message.find("NUL byte"), std::string::npos);
+    EXPECT_EQ(outStr.str(), ""); // nothing ran
+
+    EXPECT_FALSE(Command("ec\0ho"s).tryRun().has_value());
+    EXPECT_FALSE(Command("echo").args("ok"s, "a\0b"s).tryRun().has_value());
+
+    using Echo = CommandSpec<"echo", Param<"string">>;
+    EXPECT_FALSE(Echo::make("a\0b"s).setOut(outStr).tryRun().has_value());
+    EXPECT_TRUE(Echo::make("ab"s).setOut(outStr).tryRun().has_value());
+    EXPECT_EQ(outStr.str(), "ab\n");
+}
 } // namespace crew
@@ -0,0 +1,80 @@
+#include <common/command.hpp>
+#include <common/compress.hpp>
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <sstream>
+
+namespace crew {
+namespace {
+std::string roundTrip(std::string_view input)
+{
+    std::string block = lzCompressBlock(input);
+    std::string out;
+    auto ok = lzDecompressBlock(block, input.size(), out);
+    EXPECT_TRUE(ok.has_value());
+    return out;
+}
+} // namespace
+
+TEST(Compress, BlockRoundTrip)
+{
+    EXPECT_EQ(roundTrip(""), "");
+    EXPECT_EQ(roundTrip("abc"), "abc");
+    EXPECT_EQ(roundTrip(std::string(1000, 'a')), std::string(1000, 'a'));
+
+    std::string log;
+    for (int i = 0; i < 500; ++i) {
+        log += "[" + std::to_string(i % 100) + "%] Building CXX object src/file" + std::to_string(i) + ".cpp.o\n";
+    }
+    EXPECT_LT(lzCompressBlock(log).size(), log.size() / 3);
+    EXPECT_EQ(roundTrip(log), log);
+
+    std::mt19937 rng(7);
+    std::string noise(kLzMaxBlockSize, '\0');
+    for (auto& c : noise) {
+        c = static_cast<char>(rng());
+    }
+    EXPECT_EQ(roundTrip(noise), noise);
+}
+
+TEST(Compress, CorruptBlock)
+{
+    std::string block = lzCompressBlock(std::string(1000, 'a'));
+    std::string out;
+    EXPECT_FALSE(lzDecompressBlock(block, 999, out).has_value());
+    EXPECT_FALSE(lzDecompressBlock(block.substr(0, block.size() - 1), 1000, out).has_value());
+}
+
+TEST(Compress, BufferAcrossBlocks)
+{
+    CompressedBuffer buffer;
+    std::string expected;
+    for (int i = 0; i < 20000; ++i) {
+        std::string line = "line " + std::to_string(i) + " of chatty output\n";
+        buffer.append(line);
+        expected += line;
+    }
+    EXPECT_EQ(buffer.size(), expected.size());
+    EXPECT_LT(buffer.compressedSize(), expected.size() / 2);
+    EXPECT_EQ(buffer.str().value(), expected);
+
+    buffer.seal();
+    std::stringstream replayed;
+    EXPECT_TRUE(buffer.replay(replayed).has_value());
+    EXPECT_EQ(replayed.str(), expected);
+}
+
+TEST(Compress, CaptureCommandOutput)
+{
+    CompressedCapture out;
+    auto cmd = Command("bash", "-c", "for i in $(seq 1 5000); do echo build step $i; done")
+                       .setOut(out);
+    EXPECT_EQ(cmd.run(RunMode::Block), 0);
+    auto contents = out.buffer().str();
+    ASSERT_TRUE(contents.has_value());
+    EXPECT_TRUE(contents->starts_with("build step 1\n"));
+    EXPECT_TRUE(contents->ends_with("build step 5000\n"));
+}
+} // namespace crew
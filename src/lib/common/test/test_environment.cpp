@@ -0,0 +1,50 @@
+#include <common/command.hpp>
+#include <common/environment.hpp>
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+namespace crew {
+TEST(Environment, Overlays)
+{
+    const Environment base = Environment().with("A", "1").with("B", "2");
+    const Environment derived = base.with("A", "3").without("B").with("C", "4");
+
+    EXPECT_EQ(base.get("A"), "1");
+    EXPECT_EQ(base.get("B"), "2");
+    EXPECT_EQ(derived.get("A"), "3");
+    EXPECT_FALSE(derived.get("B").has_value());
+    EXPECT_EQ(derived.get("C"), "4");
+    EXPECT_EQ(derived.size(), 2u);
+
+    Environment deep = base;
+    for (int i = 0; i < 50; ++i) {
+        deep = deep.with("K" + std::to_string(i), std::to_string(i));
+    }
+    EXPECT_EQ(deep.get("K0"), "0");
+    EXPECT_EQ(deep.get("K49"), "49");
+    EXPECT_EQ(deep.size(), 52u);
+}
+
+TEST(Environment, EnvpSharedByCopies)
+{
+    const Environment env = Environment().with("X", "y");
+    const Environment copy = env;
+    EXPECT_EQ(env.envp(), copy.envp());
+    EXPECT_STREQ(env.envp()[0], "X=y");
+    EXPECT_EQ(env.envp()[1], nullptr);
+}
+
+TEST(Environment, CommandUsesEnvironment)
+{
+    const Environment env = Environment::inherited().with("CREW_TEST_VAR", "snapshot");
+    std::stringstream outStr;
+    auto cmd = Command("bash", "-c", "echo $CREW_TEST_VAR $CREW_TEST_OVERRIDE")
+                       .setEnvironment(env)
+                       .setEnv("CREW_TEST_OVERRIDE", "override")
+                       .setOut(outStr);
+    EXPECT_EQ(cmd.run(RunMode::Block), 0);
+    EXPECT_EQ(outStr.str(), "snapshot override\n");
+}
+} // namespace crew
@@ -0,0 +1,122 @@
+#include <common/file_hash.hpp>
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+namespace {
+/** Write a file dated an hour ago, old enough to be cached */
+void writeSettled(const fs::path& path, const std::string& content)
+{
+    std::ofstream(path) << content;
+    fs::last_write_time(path, fs::file_time_type::clock::now() - std::chrono::hours(1));
+}
+} // namespace
+
+TEST(FileHash, Hash64)
+{
+    // reference XXH64 values
+    EXPECT_EQ(hash64(""), 0xEF46DB3751D8E999ULL);
+    EXPECT_EQ(hash64("abc"), 0x44BC2CF5AD770999ULL);
+
+    // every tail length takes a different path, each must depend on all bytes
+    std::string data(100, 'a');
+    for (size_t size = 0; size < data.size(); ++size) {
+        std::string changed = data.substr(0, size + 1);
+        changed.back() = 'b';
+        EXPECT_NE(hash64(data.substr(0, size + 1)), hash64(changed)) << size;
+    }
+}
+
+TEST(FileHash, CacheSkipsUnchangedFiles)
+{
+    const fs::path dir = fs::temp_directory_path() / fmt::format("crew-file-hash-{}", ::getpid());
+    fs::remove_all(dir);
+    fs::create_directories(dir / "tree");
+    std::vector<fs::path> paths;
+    for (int i = 0; i < 64; ++i) {
+        paths.push_back(dir / "tree" / fmt::format("f{}", i));
+        writeSettled(paths.back(), std::string(i * 100, static_cast<char>('a' + i % 26)));
+    }
+
+    {
+        FileHasher hasher(dir / "cache");
+        ASSERT_TRUE(hasher.load());
+        auto hashes = hasher.hashAll(paths);
+        for (size_t i = 0; i < paths.size(); ++i) {
+            ASSERT_TRUE(hashes[i]);
+            EXPECT_EQ(*hashes[i], hash64(std::string(i * 100, static_cast<char>('a' + i % 26))));
+        }
+        EXPECT_EQ(hasher.stats().misses, 64u);
+        EXPECT_EQ(hasher.cacheSize(), 64u);
+        ASSERT_TRUE(hasher.save());
+    }
+
+    // a new hasher only reads the file that changed
+    writeSettled(paths[3], "changed");
+    FileHasher hasher(dir / "cache");
+    ASSERT_TRUE(hasher.load());
+    auto tree = hasher.hashTree(dir / "tree");
+    ASSERT_TRUE(tree);
+    EXPECT_EQ(tree->size(), 64u);
+    EXPECT_EQ(tree->at(paths[3]), hash64("changed"));
+    EXPECT_EQ(hasher.stats().hits, 63u);
+    EXPECT_EQ(hasher.stats().misses, 1u);
+
+    // recently modified files may change again without their mtime changing
+    std::ofstream(paths[4]) << "fresh";
+    EXPECT_EQ(hasher.hash(paths[4]), hash64("fresh"));
+    EXPECT_EQ(hasher.hash(paths[4]), hash64("fresh"));
+    EXPECT_EQ(hasher.stats().misses, 3u);
+
+    EXPECT_FALSE(hasher.hash(dir / "missing"));
+    fs::remove_all(dir);
+}
+
+TEST(FileHash, LargeFilesHashLikeTheirContents)
+{
+    const fs::path path = fs::temp_directory_path() / fmt::format("crew-file-hash-large-{}", ::getpid());
+    std::string content;
+    for (size_t i = 0; content.size() < 3 * 256 * 1024 + 17; ++i) { // several reads, uneven tail
+        content += std::to_string(i * 7919);
+    }
+    std::ofstream(path) << content;
+    FileHasher hasher;
+    EXPECT_EQ(hasher.hash(path), hash64(content));
+    fs::remove(path);
+}
+
+TEST(FileHash, SaveDropsEntriesNotUsedSinceLoading)
+{
+    const fs::path dir = fs::temp_directory_path() / fmt::format("crew-file-hash-prune-{}", ::getpid());
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    writeSettled(dir / "a", "a");
+    writeSettled(dir / "b", "b");
+    {
+        FileHasher hasher(dir / "cache");
+        ASSERT_TRUE(hasher.hash(dir / "a"));
+        ASSERT_TRUE(hasher.hash(dir / "b"));
+        ASSERT_TRUE(hasher.save());
+    }
+
+    // the entry of the old contents of b is superseded
+    writeSettled(dir / "b", "bb");
+    {
+        FileHasher hasher(dir / "cache");
+        ASSERT_TRUE(hasher.load());
+        EXPECT_EQ(hasher.cacheSize(), 2u);
+        ASSERT_TRUE(hasher.hash(dir / "a"));
+        ASSERT_TRUE(hasher.hash(dir / "b"));
+        EXPECT_EQ(hasher.cacheSize(), 3u);
+        ASSERT_TRUE(hasher.save());
+    }
+    FileHasher hasher(dir / "cache");
+    ASSERT_TRUE(hasher.load());
+    EXPECT_EQ(hasher.cacheSize(), 2u);
+    fs::remove_all(dir);
+}
+} // namespace crew
@@ -0,0 +1,144 @@
+#include <common/file_ops.hpp>
+#include <common/interpreter.hpp>
+
+#include "builtin_runner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+namespace {
+/** Fresh directory removed at the end of the test */
+class TempDir {
+public:
+    TempDir() :
+        m_path(fs::temp_directory_path() / fmt::format("crew-file-ops-{}", ::getpid()))
+    {
+        fs::remove_all(m_path);
+        fs::create_directories(m_path);
+    }
+    ~TempDir() { fs::remove_all(m_path); }
+
+    const fs::path& path() const { return m_path; }
+
+private:
+    fs::path m_path;
+};
+
+void writeFile(const fs::path& path, const std::string& content)
+{
+    std::ofstream(path) << content;
+}
+
+std::string readFile(const fs::path& path)
+{
+    std::stringstream content;
+    content << std::ifstream(path).rdbuf();
+    return content.str();
+}
+} // namespace
+
+TEST(FileOps, CopyAndRemoveTree)
+{
+    TempDir tmp;
+    const fs::path src = tmp.path() / "src";
+    for (int dir = 0; dir < 4; ++dir) {
+        ASSERT_TRUE(makeDirectories(src / fmt::format("d{}", dir) / "nested"));
+        for (int file = 0; file < 8; ++file) {
+            writeFile(src / fmt::format("d{}", dir) / "nested" / fmt::format("f{}", file), fmt::format("{} {}", dir, file));
+        }
+    }
+    fs::create_symlink("d0", src / "link");
+
+    ASSERT_TRUE(copyTree(src, tmp.path() / "dst"));
+    EXPECT_EQ(readFile(tmp.path() / "dst/d3/nested/f7"), "3 7");
+    EXPECT_TRUE(fs::is_symlink(tmp.path() / "dst/link"));
+    EXPECT_EQ(fs::read_symlink(tmp.path() / "dst/link"), "d0");
+
+    auto removed = removeTree(tmp.path() / "dst");
+    ASSERT_TRUE(removed);
+    EXPECT_EQ(*removed, 4u * (2 + 8) + 2); // 4 * (d, nested, 8 files) + link + dst
+    EXPECT_FALSE(fs::exists(tmp.path() / "dst"));
+    EXPECT_EQ(removeTree(tmp.path() / "dst"), 0u);
+}
+
+TEST(FileOps, CopyRefusesItself)
+{
+    TempDir tmp;
+    ASSERT_TRUE(makeDirectories(tmp.path() / "d/sub"));
+    writeFile(tmp.path() / "a", "content");
+
+    EXPECT_FALSE(copyFile(tmp.path() / "a", tmp.path() / "a"));
+    EXPECT_FALSE(copyFile(tmp.path() / "a", tmp.path() / "d/../a"));
+    EXPECT_EQ(readFile(tmp.path() / "a"), "content");
+    fs::create_hard_link(tmp.path() / "a", tmp.path() / "hard");
+    EXPECT_FALSE(copyFile(tmp.path() / "a", tmp.path() / "hard"));
+    EXPECT_EQ(readFile(tmp.path() / "a"), "content");
+
+    EXPECT_FALSE(copyTree(tmp.path() / "d", tmp.path() / "d"));
+    EXPECT_FALSE(copyTree(tmp.path() / "d", tmp.path() / "d/sub/copy"));
+    EXPECT_FALSE(fs::exists(tmp.path() / "d/sub/copy"));
+    EXPECT_TRUE(copyTree(tmp.path() / "d", tmp.path() / "d2")); // a shared prefix is not a subtree
+}
+
+TEST(FileOps, RemoveTreeRefusesRootAndDots)
+{
+    TempDir tmp;
+    ASSERT_TRUE(makeDirectories(tmp.path() / "a/b"));
+    for (const fs::path& path : {fs::path("/"), fs::path("//"), tmp.path() / "a/..", tmp.path() / "a/b/../", tmp.path() / "a/.", fs::path("."), fs::path("..")}) {
+        EXPECT_FALSE(removeTree(path)) << path;
+    }
+    EXPECT_TRUE(fs::exists(tmp.path() / "a/b"));
+
+    // the root reached through a link is refused too
+    fs::create_directory_symlink("/", tmp.path() / "root");
+    EXPECT_FALSE(removeTree(tmp.path() / "root" / ""));
+}
+
+TEST(FileOps, Builtins)
+{
+    TempDir tmp;
+    Vm vm;
+    ASSERT_TRUE(addFileBuiltins(vm));
+    const std::string root = tmp.path().string();
+
+    EXPECT_EQ(runBuiltin(vm, {"mkdir", "-p", root + "/a/b"}).status, 0);
+    EXPECT_FALSE(runBuiltin(vm, {"mkdir", root + "/a/b"}).status);
+    writeFile(tmp.path() / "a/b/file", "content");
+
+    // copying into an existing directory keeps the name, directories need -r
+    EXPECT_EQ(runBuiltin(vm, {"cp", root + "/a/b/file", root + "/a"}).status, 0);
+    EXPECT_EQ(readFile(tmp.path() / "a/file"), "content");
+    EXPECT_FALSE(runBuiltin(vm, {"cp", root + "/a/b", root + "/c"}).status);
+    EXPECT_EQ(runBuiltin(vm, {"cp", "-r", root + "/a/b", root + "/c"}).status, 0);
+    EXPECT_FALSE(runBuiltin(vm, {"cp", root + "/a/file", root + "/a/file"}).status);
+    EXPECT_EQ(readFile(tmp.path() / "a/file"), "content");
+    EXPECT_FALSE(runBuiltin(vm, {"cp", "-r", root + "/c", root + "/c"}).status); // would copy to c/c
+    EXPECT_EQ(readFile(tmp.path() / "c/file"), "content");
+
+    EXPECT_EQ(runBuiltin(vm, {"ln", "-s", root + "/c/file", root + "/link"}).status, 0);
+    EXPECT_EQ(fs::read_symlink(tmp.path() / "link"), tmp.path() / "c/file");
+    EXPECT_FALSE(runBuiltin(vm, {"ln", "-si", root + "/a/file", root + "/link"}).status);
+    EXPECT_EQ(runBuiltin(vm, {"ln", "-sf", root + "/a/file", root + "/link"}).status, 0);
+    EXPECT_EQ(fs::read_symlink(tmp.path() / "link"), tmp.path() / "a/file");
+    EXPECT_EQ(runBuiltin(vm, {"ln", "-s", root + "/c", root + "/a"}).status, 0); // placed inside the directory
+    EXPECT_TRUE(fs::is_symlink(tmp.path() / "a/c"));
+
+    EXPECT_FALSE(runBuiltin(vm, {"rm", root + "/c"}).status);
+    EXPECT_EQ(runBuiltin(vm, {"rm", "-r", root + "/c", root + "/link"}).status, 0);
+    EXPECT_FALSE(fs::exists(tmp.path() / "c"));
+    EXPECT_TRUE(fs::exists(tmp.path() / "a/file")); // the link was removed, not its target
+    EXPECT_FALSE(runBuiltin(vm, {"rm", root + "/missing"}).status);
+    EXPECT_EQ(runBuiltin(vm, {"rm", "-f", root + "/missing"}).status, 0);
+    EXPECT_FALSE(runBuiltin(vm, {"rm", "-x", root + "/a"}).status);
+
+    // an empty variable in "$dir/" must not reach the root
+    EXPECT_FALSE(runBuiltin(vm, {"rm", "-rf", "/"}).status);
+    EXPECT_FALSE(runBuiltin(vm, {"rm", "-rf", root + "/a/."}).status);
+    EXPECT_TRUE(fs::exists(tmp.path() / "a/file"));
+}
+} // namespace crew
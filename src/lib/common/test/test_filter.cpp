@@ -0,0 +1,108 @@
+#include <common/command.hpp>
+#include <common/filter.hpp>
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+namespace crew {
+TEST(Filter, GrepAcrossChunks)
+{
+    std::stringstream out;
+    FilterPipeline pipeline(out);
+    pipeline.grep("err");
+    pipeline << "ok 1\nan e";
+    pipeline << "rror here\nok 2\nerr";
+    pipeline << "or last";
+    pipeline.finish();
+    EXPECT_EQ(out.str(), "an error here\nerror last");
+}
+
+TEST(Filter, GrepInverted)
+{
+    std::stringstream out;
+    FilterPipeline pipeline(out);
+    pipeline.grepInverted("skip");
+    pipeline << "a\nskip b\nc\nd skip\ne\n";
+    pipeline.finish();
+    EXPECT_EQ(out.str(), "a\nc\ne\n");
+}
+
+TEST(Filter, HeadTail)
+{
+    std::stringstream headOut;
+    FilterPipeline head(headOut);
+    head.head(2);
+    head << "1\n2\n3\n4\n";
+    head.finish();
+    EXPECT_EQ(headOut.str(), "1\n2\n");
+
+    std::stringstream tailOut;
+    FilterPipeline tail(tailOut);
+    tail.tail(2);
+    tail << "1\n2\n3";
+    tail << "\n4\n5";
+    tail.finish();
+    EXPECT_EQ(tailOut.str(), "4\n5");
+}
+
+TEST(Filter, ChainedCount)
+{
+    std::stringstream out;
+    FilterPipeline pipeline(out);
+    pipeline.grep("x").countLines();
+    pipeline << "x\ny\nx\nzx";
+    pipeline.finish();
+    EXPECT_EQ(out.str(), "3\n");
+}
+
+TEST(Filter, CommandOutput)
+{
+    std::stringstream out;
+    FilterPipeline pipeline(out);
+    pipeline.grep("5").tail(2);
+    auto cmd = Command("bash", "-c", "for i in $(seq 1 100); do echo line$i; done")
+                       .setOut(pipeline);
+    EXPECT_EQ(cmd.run(RunMode::Block), 0);
+    pipeline.finish();
+    EXPECT_EQ(out.str(), "line85\nline95\n");
+}
+
+TEST(Filter, ProgressCompaction)
+{
+    EXPECT_EQ(ProgressStage::compact("10%\r50%\r100%\ndone\n"), "100%\ndone\n");
+    EXPECT_EQ(ProgressStage::compact("abcdef\rXY\n"), "XYcdef\n");
+    EXPECT_EQ(ProgressStage::compact("abcdef\rXY\x1b[K\n"), "XY\n");
+    EXPECT_EQ(ProgressStage::compact("line\r\n"), "line\n");
+    EXPECT_EQ(ProgressStage::compact("\x1b[32mok\x1b[0m\x1b[2K\rfinal"), "final");
+
+    std::stringstream out;
+    FilterPipeline pipeline(out);
+    pipeline.compactProgress();
+    pipeline << "[1/3] a\r[2/3";
+    pipeline << "] b\r\x1b";
+    pipeline << "[K[3/3] c\nend\n";
+    pipeline.finish();
+    EXPECT_EQ(out.str(), "[3/3] c\nend\n");
+}
+
+TEST(Filter, ProgressCompactionKeepsUtf8)
+{
+    EXPECT_EQ(ProgressStage::compact("h\u00e9llo\rH\n"), "H\u00e9llo\n");
+    EXPECT_EQ(ProgressStage::compact("\u65e5\u672c\u8a9e\rX\n"), "X\u672c\u8a9e\n");
+    EXPECT_EQ(ProgressStage::compact("a\u00e9\bx\n"), "ax\n");
+    EXPECT_EQ(ProgressStage::compact("\u00fcber\x1b[2Dxx\n"), "\u00fcbxx\n");
+    EXPECT_EQ(ProgressStage::compact("\x1b[3G\u00e9\rab\n"), "ab\u00e9\n");
+    EXPECT_EQ(ProgressStage::compact("a\u00f1b\x1b[2D\x1b[K\n"), "a\n");
+    EXPECT_EQ(ProgressStage::compact("\u00e0\u00e8\u00ec\x1b[2D\x1b[1K\n"), "  \u00ec\n");
+
+    // a code point split between chunks
+    std::stringstream out;
+    FilterPipeline pipeline(out);
+    pipeline.compactProgress();
+    pipeline << "h\xc3";
+    pipeline << "\xa9llo\rH\n";
+    pipeline.finish();
+    EXPECT_EQ(out.str(), "H\u00e9llo\n");
+}
+} // namespace crew
@@ -0,0 +1,151 @@
+#include <common/line_buffer.hpp>
+
+#include <gtest/gtest.h>
+
+namespace crew {
+TEST(LineBuffer, EditMidLine)
+{
+    LineBuffer line;
+    line.insert("make all");
+    line.moveHome();
+    line.moveRight();
+    line.moveRight();
+    line.moveRight();
+    line.moveRight();
+    line.insert(" -j8");
+    EXPECT_EQ(line.str(), "make -j8 all");
+    EXPECT_EQ(line.cursor(), 8u);
+    EXPECT_EQ(line.cursorColumn(), 8u);
+
+    EXPECT_TRUE(line.eraseBefore());
+    EXPECT_TRUE(line.eraseAfter());
+    EXPECT_EQ(line.str(), "make -jall");
+    EXPECT_EQ(line.beforeCursor(), "make -j");
+    EXPECT_EQ(line.afterCursor(), "all");
+
+    line.moveEnd();
+    EXPECT_FALSE(line.eraseAfter());
+    EXPECT_FALSE(line.moveRight());
+    line.moveHome();
+    EXPECT_FALSE(line.eraseBefore());
+    EXPECT_FALSE(line.moveLeft());
+
+    line.clear();
+    EXPECT_TRUE(line.empty());
+    EXPECT_EQ(line.columns(), 0u);
+}
+
+TEST(LineBuffer, Utf8Columns)
+{
+    LineBuffer line;
+    line.insert("a\xc3\xa9z"); // "aéz"
+    EXPECT_EQ(line.size(), 4u);
+    EXPECT_EQ(line.columns(), 3u);
+
+    line.moveLeft(); // before z
+    line.moveLeft(); // before é, skipping its continuation byte
+    EXPECT_EQ(line.cursor(), 1u);
+    EXPECT_EQ(line.cursorColumn(), 1u);
+
+    EXPECT_TRUE(line.eraseAfter());
+    EXPECT_EQ(line.str(), "az");
+    EXPECT_EQ(line.columns(), 2u);
+}
+
+TEST(LineBuffer, SliceAcrossGap)
+{
+    LineBuffer line;
+    line.insert("0123456789");
+    line.moveTo(4);
+    EXPECT_EQ(line.slice(2, 5), "23456");
+    EXPECT_EQ(line.slice(6, 100), "6789");
+    EXPECT_EQ(line.slice(0, 0), "");
+    EXPECT_EQ(line.slice(10, 3), "");
+
+    line.insert("\xc3\xa9");
+    EXPECT_EQ(line.slice(3, 3), "3\xc3\xa9"
+                                "4");
+}
+
+TEST(LineBuffer, LongLine)
+{
+    LineBuffer line;
+    std::string expected;
+    for (int i = 0; i < 10000; ++i) {
+        line.insert("arg ");
+        expected.append("arg ");
+    }
+    line.moveTo(20000);
+    for (int i = 0; i < 1000; ++i) {
+        line.insert("x");
+    }
+    expected.insert(20000, std::string(1000, 'x'));
+    EXPECT_EQ(line.str(), expected);
+    EXPECT_EQ(line.cursorColumn(), 21000u);
+    EXPECT_EQ(line.columns(), expected.size());
+}
+
+TEST(LineBuffer, UndoCoalescesTyping)
+{
+    LineBuffer line;
+    for (char c : std::string_view("make all")) {
+        line.insert({&c, 1});
+    }
+    EXPECT_TRUE(line.undo()); // the second word
+    EXPECT_EQ(line.str(), "make ");
+    EXPECT_TRUE(line.undo());
+    EXPECT_EQ(line.str(), "");
+    EXPECT_FALSE(line.undo());
+
+    EXPECT_TRUE(line.redo());
+    EXPECT_TRUE(line.redo());
+    EXPECT_EQ(line.str(), "make all");
+    EXPECT_EQ(line.cursor(), 8u);
+    EXPECT_FALSE(line.redo());
+}
+
+TEST(LineBuffer, UndoErases)
+{
+    LineBuffer line;
+    line.insert("abcdef");
+    line.moveTo(4);
+    line.eraseBefore();
+    line.eraseBefore(); // "abef", one backspace run
+    line.eraseAfter();
+    line.eraseAfter(); // "ab", one delete run
+    EXPECT_EQ(line.str(), "ab");
+
+    EXPECT_TRUE(line.undo());
+    EXPECT_EQ(line.str(), "abef");
+    EXPECT_TRUE(line.undo());
+    EXPECT_EQ(line.str(), "abcdef");
+    EXPECT_EQ(line.cursor(), 4u);
+
+    // a new edit discards what could be redone
+    line.insert("X");
+    EXPECT_FALSE(line.redo());
+
+    line.clear();
+    EXPECT_TRUE(line.empty());
+    EXPECT_TRUE(line.undo());
+    EXPECT_EQ(line.str(), "abcdXef");
+
+    line.reset();
+    EXPECT_FALSE(line.undo());
+}
+
+TEST(LineBuffer, UndoIsBounded)
+{
+    LineBuffer line;
+    for (size_t i = 0; i < LineBuffer::kMaxUndo + 10; ++i) {
+        line.insert("x");
+        line.breakUndoGroup();
+    }
+    size_t undone = 0;
+    while (line.undo()) {
+        ++undone;
+    }
+    EXPECT_EQ(undone, LineBuffer::kMaxUndo);
+    EXPECT_EQ(line.size(), 10u);
+}
+} // namespace crew
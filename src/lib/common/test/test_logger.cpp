@@ -0,0 +1,75 @@
+#include <common/logger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace crew {
+
+TEST(Logger, FormatsFields)
+{
+    std::ostringstream sink;
+    Logger logger({.sink = &sink});
+    logger.log(LogLevel::Info, "LOG: make all", {{"cwd", "/tmp/build dir"}, {"environment", 12}});
+    logger.log(LogLevel::Warning, "slow", {{"quote", "say \"hi\""}, {"empty", ""}});
+    logger.flush();
+
+    EXPECT_EQ(sink.str(),
+            "LOG: make all cwd=\"/tmp/build dir\" environment=12\n"
+            "warning: slow quote=\"say \\\"hi\\\"\" empty=\"\"\n");
+}
+
+TEST(Logger, FiltersLevels)
+{
+    std::ostringstream sink;
+    Logger logger({.sink = &sink});
+    logger.setLevel(LogLevel::Warning);
+    EXPECT_FALSE(logger.enabled(LogLevel::Info));
+    logger.log(LogLevel::Debug, "debug");
+    logger.log(LogLevel::Info, "info");
+    logger.log(LogLevel::Error, "failed");
+    logger.flush();
+
+    EXPECT_EQ(sink.str(), "error: failed\n");
+}
+
+TEST(Logger, KeepsEachThreadsOrder)
+{
+    constexpr int kThreads = 4;
+    constexpr int kLines = 5000;
+
+    std::ostringstream sink;
+    {
+        // small buffers, so threads regularly wait for the flusher
+        Logger logger({.sink = &sink, .bufferSize = 256});
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < kThreads; ++t) {
+            threads.emplace_back([&logger, t] {
+                for (int i = 0; i < kLines; ++i) {
+                    logger.log(LogLevel::Info, "line", {{"thread", t}, {"seq", i}});
+                }
+            });
+        }
+        threads.clear();
+        logger.log(LogLevel::Info, std::string(1000, 'x')); // longer than a buffer
+    } // destruction writes out the rest
+
+    std::map<int, int> next;
+    std::istringstream lines(sink.str());
+    int count = 0;
+    for (std::string line; std::getline(lines, line); ++count) {
+        if (line == std::string(1000, 'x')) {
+            continue;
+        }
+        int thread = -1;
+        int seq = -1;
+        ASSERT_EQ(std::sscanf(line.c_str(), "line thread=%d seq=%d", &thread, &seq), 2) << line;
+        EXPECT_EQ(seq, next[thread]++);
+    }
+    EXPECT_EQ(count, kThreads * kLines + 1);
+}
+
+} // namespace crew
@@ -0,0 +1,121 @@
+#include <common/process_backend.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace crew {
+namespace {
+size_t countLines(const std::string& text)
+{
+    return static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+}
+} // namespace
+
+TEST(SimulatedBackend, RunsPrograms)
+{
+    SimulatedBackend backend;
+    backend.addProgram("cc", {.spawnLatency = std::chrono::milliseconds(2), .outputBytes = 800, .errorBytes = 80, .lineLength = 40, .exitCode = 3});
+
+    std::ostringstream out;
+    std::ostringstream err;
+    auto result = Command("cc", "-c", "main.c").setBackend(&backend).setOut(out).setErr(err).onError(OnError::Return).tryRun();
+    ASSERT_TRUE(result);
+    EXPECT_EQ(*result, 3);
+    EXPECT_EQ(countLines(out.str()), 20u);
+    EXPECT_EQ(out.str().size(), 800u);
+    EXPECT_TRUE(out.str().starts_with("cc output line 1"));
+    EXPECT_EQ(err.str().size(), 80u);
+
+    // a pty carries both streams
+    std::ostringstream pty;
+    ASSERT_TRUE(Command("cc").setBackend(&backend).setOut(pty).setErr(err).onError(OnError::Return).tryRun(RunMode::BlockPty));
+    EXPECT_EQ(pty.str().size(), 880u);
+
+    std::ostringstream missing;
+    result = Command("ld").setBackend(&backend).setErr(missing).onError(OnError::Return).tryRun();
+    ASSERT_TRUE(result);
+    EXPECT_EQ(*result, 127);
+    EXPECT_EQ(missing.str(), "ld: command not found\n");
+
+    const auto stats = backend.stats();
+    EXPECT_EQ(stats.children, 2u);
+    EXPECT_EQ(stats.bytes, 1760u);
+    EXPECT_EQ(stats.virtualTime, std::chrono::milliseconds(4));
+}
+
+TEST(SimulatedBackend, LoadsSpecWithDeterministicJitter)
+{
+    SimulatedBackend backend;
+    ASSERT_TRUE(backend.load(nlohmann::json::parse(R"({
+        "programs": { "make": { "output_bytes": 10000, "bytes_per_second": 1e6, "jitter": 0.5 } },
+        "default": { "exit_code": 1 }
+    })")));
+
+    auto outputOf = [&](const std::string& target) {
+        std::ostringstream out;
+        EXPECT_TRUE(Command("make", target).setBackend(&backend).setOut(out).tryRun());
+        return out.str();
+    };
+    const std::string first = outputOf("all");
+    EXPECT_EQ(outputOf("all"), first);
+    EXPECT_GE(first.size(), 5000u);
+    EXPECT_LE(first.size(), 15000u + 80u);
+
+    auto result = Command("true").setBackend(&backend).onError(OnError::Return).tryRun();
+    ASSERT_TRUE(result);
+    EXPECT_EQ(*result, 1);
+
+    EXPECT_FALSE(backend.load(nlohmann::json::parse(R"({ "programs": { "cc": { "output_bytes": "lots" } } })")));
+}
+
+TEST(VirtualClock, WakesSleepersInTimeOrder)
+{
+    using std::chrono::milliseconds;
+    VirtualClock clock;
+    std::mutex mutex;
+    std::vector<milliseconds> woken;
+    {
+        auto starting = clock.participate();
+        std::vector<std::jthread> threads;
+        for (milliseconds sleep : {milliseconds(30), milliseconds(10), milliseconds(20)}) {
+            threads.emplace_back([&, sleep, participant = clock.participate()] {
+                clock.sleepFor(sleep);
+                std::lock_guard lock(mutex);
+                woken.push_back(std::chrono::duration_cast<milliseconds>(clock.now()));
+            });
+        }
+        starting.leave();
+    }
+    EXPECT_EQ(woken, (std::vector<milliseconds>{milliseconds(10), milliseconds(20), milliseconds(30)}));
+    EXPECT_EQ(clock.now(), milliseconds(30));
+}
+
+TEST(SimulatedBackend, ChildrenOverlapInVirtualTime)
+{
+    SimulatedBackend backend;
+    backend.addProgram("cc", {.spawnLatency = std::chrono::milliseconds(5)});
+    {
+        auto starting = backend.clock().participate();
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, participant = backend.clock().participate()] {
+                for (int i = 0; i < 2; ++i) {
+                    EXPECT_TRUE(Command("cc").setBackend(&backend).tryRun());
+                }
+            });
+        }
+        starting.leave();
+    }
+    const auto stats = backend.stats();
+    EXPECT_EQ(stats.children, 8u);
+    EXPECT_EQ(stats.virtualTime, std::chrono::milliseconds(40));
+    EXPECT_EQ(stats.elapsed, std::chrono::milliseconds(10));
+    EXPECT_EQ(stats.maxConcurrent, 4u);
+}
+
+} // namespace crew
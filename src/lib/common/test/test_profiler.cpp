@@ -0,0 +1,78 @@
+#include <common/interpreter.hpp>
+#include <common/profiler.hpp>
+
+#include "builtin_runner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sstream>
+
+namespace crew {
+namespace {
+/** Burn CPU time until the profiler has taken `count` samples */
+[[gnu::noinline]] void spin(const Profiler& profiler, size_t count)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    volatile uint64_t sink = 0;
+    while (profiler.samples() < count && std::chrono::steady_clock::now() < deadline) {
+        for (int i = 0; i < 100'000; ++i) {
+            sink = sink + i;
+        }
+    }
+}
+} // namespace
+
+TEST(Profiler, SamplesRegions)
+{
+    auto& profiler = Profiler::shared();
+    ASSERT_TRUE(profiler.start({.frequency = 1000}));
+    {
+        Profiler::Region region("spinning");
+        spin(profiler, 20);
+    }
+    profiler.stop();
+    EXPECT_FALSE(profiler.running());
+    EXPECT_GE(profiler.samples(), 20u);
+
+    // every line is a stack followed by its count
+    std::istringstream folded(profiler.folded());
+    size_t total = 0;
+    size_t inRegion = 0;
+    size_t walked = 0;
+    for (std::string line; std::getline(folded, line);) {
+        const auto space = line.rfind(' ');
+        ASSERT_NE(space, std::string::npos) << line;
+        const size_t count = std::stoul(line.substr(space + 1));
+        total += count;
+        if (line.starts_with("spinning;")) {
+            inRegion += count;
+        }
+        // the caller of spin() was found through its frame record
+        if (line.find("Profiler_SamplesRegions_Test::TestBody();") != std::string::npos) {
+            walked += count;
+        }
+    }
+    EXPECT_EQ(total, profiler.samples());
+    EXPECT_GT(inRegion, 0u);
+    EXPECT_GT(walked, 0u);
+
+    profiler.clear();
+    EXPECT_EQ(profiler.samples(), 0u);
+    EXPECT_TRUE(profiler.folded().empty());
+}
+
+TEST(Profiler, Builtin)
+{
+    Vm vm;
+    ASSERT_TRUE(addProfilerBuiltins(vm));
+    EXPECT_EQ(builtinOutput(vm, {"profile", "start", "500"}), "profiling at 500 Hz\n");
+    EXPECT_FALSE(runBuiltin(vm, {"profile", "start"}).status); // already running
+    spin(Profiler::shared(), 5);
+    EXPECT_FALSE(builtinOutput(vm, {"profile", "stop"}).empty());
+    EXPECT_TRUE(builtinOutput(vm, {"profile", "status"}).starts_with("profiler stopped"));
+    EXPECT_FALSE(runBuiltin(vm, {"profile", "start", "fast"}).status);
+    Profiler::shared().clear();
+}
+
+} // namespace crew
@@ -0,0 +1,77 @@
+#include <common/record_file.hpp>
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+namespace {
+struct Record {
+    uint64_t key{};
+    double value{};
+};
+
+constexpr RecordFormat kFormat{{'T', 'E', 'S', 'T'}, 1};
+} // namespace
+
+TEST(RecordFile, RoundTrips)
+{
+    const fs::path dir = fs::temp_directory_path() / fmt::format("crew-record-file-{}", ::getpid());
+    const fs::path path = dir / "nested" / "records";
+    fs::remove_all(dir);
+
+    auto missing = readRecords<Record>(path, kFormat);
+    ASSERT_TRUE(missing);
+    EXPECT_TRUE(missing->empty());
+
+    const std::vector<Record> written{{1, 0.5}, {2, 1.5}};
+    ASSERT_TRUE(writeRecords<Record>(path, kFormat, written));
+    auto read = readRecords<Record>(path, kFormat);
+    ASSERT_TRUE(read);
+    ASSERT_EQ(read->size(), 2u);
+    EXPECT_EQ((*read)[1].key, 2u);
+    EXPECT_EQ((*read)[1].value, 1.5);
+
+    // another version starts over
+    auto other = readRecords<Record>(path, RecordFormat{kFormat.magic, 2});
+    ASSERT_TRUE(other);
+    EXPECT_TRUE(other->empty());
+    fs::remove_all(dir);
+}
+
+TEST(RecordFile, ConcurrentWritersDoNotShareTemporaries)
+{
+    const fs::path dir = fs::temp_directory_path() / fmt::format("crew-record-file-writers-{}", ::getpid());
+    const fs::path path = dir / "records";
+    fs::remove_all(dir);
+
+    {
+        std::vector<std::jthread> writers;
+        for (uint64_t writer = 0; writer < 8; ++writer) {
+            writers.emplace_back([&, writer] {
+                const std::vector<Record> records(1000, Record{writer, 0.0});
+                for (int i = 0; i < 20; ++i) {
+                    EXPECT_TRUE(writeRecords<Record>(path, kFormat, records));
+                }
+            });
+        }
+    }
+
+    // the last rename wins whole, no write was mixed into another
+    auto read = readRecords<Record>(path, kFormat);
+    ASSERT_TRUE(read);
+    ASSERT_EQ(read->size(), 1000u);
+    for (const Record& record : *read) {
+        EXPECT_EQ(record.key, read->front().key);
+    }
+    EXPECT_EQ(std::distance(fs::directory_iterator(dir), fs::directory_iterator()), 1); // no temporaries left
+    fs::remove_all(dir);
+}
+} // namespace crew
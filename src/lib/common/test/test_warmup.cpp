@@ -0,0 +1,92 @@
+#include <common/warmup.hpp>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace crew {
+namespace {
+/** Wait for the background thread to get through `count` requests */
+bool waitForSpeculations(const Warmup& warmup, uint64_t count)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (warmup.stats().speculations + warmup.stats().cancelled < count) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+} // namespace
+
+TEST(Warmup, Speculates)
+{
+    Warmup warmup;
+    warmup.speculate({"sh", "-c", "/tmp", "/nonexistent"});
+    ASSERT_TRUE(waitForSpeculations(warmup, 1));
+
+    const auto stats = warmup.stats();
+    EXPECT_EQ(stats.speculations, 1u);
+    EXPECT_EQ(stats.advised, 1u);
+    EXPECT_EQ(stats.statted, 2u); // the flag is skipped
+
+    auto sh = warmup.resolve("sh");
+    ASSERT_TRUE(sh.has_value());
+    EXPECT_EQ(sh->filename(), "sh");
+    EXPECT_TRUE(sh->is_absolute());
+    EXPECT_FALSE(warmup.resolve("crew-no-such-program").has_value());
+
+    // the program file is only read ahead once per interval
+    warmup.speculate({"sh", "-x"});
+    ASSERT_TRUE(waitForSpeculations(warmup, 2));
+    EXPECT_EQ(warmup.stats().advised, 1u);
+}
+
+TEST(Warmup, ReadsAheadAgainAfterInterval)
+{
+    Warmup warmup(std::chrono::seconds(0));
+    warmup.speculate({"sh"});
+    ASSERT_TRUE(waitForSpeculations(warmup, 1));
+    warmup.speculate({"sh"});
+    ASSERT_TRUE(waitForSpeculations(warmup, 2));
+    EXPECT_EQ(warmup.stats().advised, 2u);
+}
+
+TEST(Warmup, ResolvesAgainWhenPathChanges)
+{
+    const auto dir = std::filesystem::temp_directory_path() / ("crew-warmup-" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+    const auto program = dir / "crew-warmup-program";
+    std::ofstream(program) << "#!/bin/sh\n";
+    std::filesystem::permissions(program, std::filesystem::perms::owner_all);
+
+    Warmup warmup;
+    EXPECT_FALSE(warmup.resolve(program.filename()).has_value());
+    const std::string path = std::getenv("PATH");
+    ::setenv("PATH", (dir.string() + ":" + path).c_str(), 1);
+    EXPECT_EQ(warmup.resolve(program.filename()), program);
+    ::setenv("PATH", path.c_str(), 1);
+    EXPECT_FALSE(warmup.resolve(program.filename()).has_value());
+    std::filesystem::remove_all(dir);
+}
+
+TEST(Warmup, NewerRequestsSupersede)
+{
+    Warmup warmup;
+    // enough paths per request that the thread is still statting when the next arrives
+    std::vector<std::string> tokens{"sh"};
+    tokens.resize(1000, "/nonexistent");
+    for (int i = 0; i < 100; ++i) {
+        warmup.speculate(tokens);
+    }
+    warmup.cancel();
+    // every request is accounted for, whether it finished first or was superseded
+    ASSERT_TRUE(waitForSpeculations(warmup, 100));
+    EXPECT_GT(warmup.stats().cancelled, 0u);
+}
+} // namespace crew
@@ -0,0 +1,206 @@
+#include <common/worker.hpp>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sstream>
+
+namespace crew {
+TEST(Worker, CommandJsonRoundTrip)
+{
+    auto cmd = Command("bash", "-c", "echo $X")
+                       .setEnv("X", "y")
+                       .setCurrentDir("/tmp");
+    auto parsed = commandFromJson(commandToJson(cmd));
+    ASSERT_TRUE(parsed.has_value());
+    EXPECT_EQ(parsed->toString(), "bash -c echo $X");
+    EXPECT_EQ(parsed->currentDir(), std::filesystem::path("/tmp"));
+    EXPECT_EQ(parsed->envOverrides(), cmd.envOverrides());
+    EXPECT_EQ(commandFromJson(commandToJson(Command("true").setTimeout(std::chrono::seconds(3))))->timeout(), std::chrono::seconds(3));
+
+    const auto options = commandFromJson(commandToJson(Command("true")
+                                                               .setEnvironment(Environment().with("X", "snapshot"))
+                                                               .setHighVolume(true)
+                                                               .setNewSession(true)
+                                                               .setCgroup(true)
+                                                               .setVerbose(true)
+                                                               .setDry(true)));
+    ASSERT_TRUE(options.has_value());
+    ASSERT_TRUE(options->environment().has_value());
+    EXPECT_EQ(options->environment()->get("X"), "snapshot");
+    EXPECT_EQ(options->environment()->size(), 1u);
+    EXPECT_TRUE(options->highVolume() && options->newSession() && options->cgroup() && options->verbose() && options->dryRun());
+    EXPECT_FALSE(commandFromJson(commandToJson(Command("true")))->environment().has_value());
+
+    EXPECT_FALSE(commandFromJson(nlohmann::json{{"argv", nlohmann::json::array()}}).has_value());
+    EXPECT_FALSE(commandFromJson(nlohmann::json{{"argv", {1, 2}}}).has_value());
+}
+
+TEST(Worker, PoolRunsCommands)
+{
+    auto pool = WorkerPool::start(2);
+    ASSERT_TRUE(pool.has_value());
+
+    std::vector<std::stringstream> outs(6);
+    std::stringstream errStr;
+    std::vector<WorkerPool::JobId> jobs;
+    for (size_t i = 0; i < outs.size(); ++i) {
+        jobs.push_back(*(*pool)->submit(Command("bash", "-c", "echo out$0; echo err 1>&2; exit $0", std::to_string(i))
+                                               .setOut(outs[i])
+                                               .setErr(errStr)));
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        auto result = (*pool)->wait(jobs[i]);
+        ASSERT_TRUE(result.has_value());
+        EXPECT_EQ(*result, static_cast<int>(i));
+        EXPECT_EQ(outs[i].str(), "out" + std::to_string(i) + "\n");
+    }
+    EXPECT_EQ(errStr.str().size(), std::string("err\n").size() * outs.size());
+    EXPECT_FALSE((*pool)->wait(jobs[0]).has_value()); // already collected
+}
+
+TEST(Worker, PoolKeepsTheEnvironment)
+{
+    auto pool = WorkerPool::start(1);
+    ASSERT_TRUE(pool.has_value());
+
+    std::stringstream out;
+    const auto environment = Environment::inherited().with("CREW_SNAPSHOT", "from the submitter");
+    auto job = (*pool)->submit(Command("sh", "-c", "echo $CREW_SNAPSHOT").setEnvironment(environment).setOut(out));
+    ASSERT_TRUE(job.has_value());
+    EXPECT_EQ((*pool)->wait(*job), 0);
+    EXPECT_EQ(out.str(), "from the submitter\n");
+
+    // what cannot be carried to the worker is refused rather than dropped
+    std::stop_source stop;
+    EXPECT_FALSE((*pool)->submit(Command("true").setStopToken(stop.get_token())));
+}
+
+TEST(Worker, PrefersWorkersThatUsedLessCpu)
+{
+    auto pool = WorkerPool::start(2);
+    ASSERT_TRUE(pool.has_value());
+    const auto workerOf = [&](const std::string& script) {
+        std::stringstream out;
+        EXPECT_EQ((*pool)->wait(*(*pool)->submit(Command("bash", "-c", script + "; echo $PPID").setOut(out))), 0);
+        int pid{};
+        out >> pid;
+        return pid;
+    };
+
+    const int busy = workerOf("i=0; while [ $i -lt 100000 ]; do i=$((i + 1)); done");
+    const int idle = workerOf("true");
+    EXPECT_NE(idle, busy);
+    EXPECT_EQ(workerOf("true"), idle);
+}
+
+TEST(Worker, DetachedJobsAreForgotten)
+{
+    auto pool = WorkerPool::start(1);
+    ASSERT_TRUE(pool.has_value());
+    const auto detached = *(*pool)->submit(Command("true"));
+    (*pool)->detach(detached);
+    EXPECT_EQ((*pool)->wait(*(*pool)->submit(Command("true"))), 0);
+    EXPECT_EQ((*pool)->jobs(), 0u);
+    EXPECT_FALSE((*pool)->wait(detached).has_value());
+}
+
+TEST(Worker, FailFastCancelsRunningAndQueued)
+{
+    auto pool = WorkerPool::start(2);
+    ASSERT_TRUE(pool.has_value());
+    (*pool)->setFailFast(true);
+
+    const auto start = std::chrono::steady_clock::now();
+    auto slow = *(*pool)->submit(Command("bash", "-c", "sleep 30 & sleep 30"));
+    auto failing = *(*pool)->submit(Command("bash", "-c", "sleep 0.2; exit 3"));
+    auto queued = *(*pool)->submit(Command("true"));
+
+    EXPECT_EQ((*pool)->wait(failing), 3);
+    auto slowResult = (*pool)->wait(slow);
+    ASSERT_FALSE(slowResult.has_value());
+    EXPECT_NE(slowResult.error().message.find("interrupted"), std::string::npos);
+    EXPECT_FALSE((*pool)->wait(queued).has_value());
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+TEST(Worker, HistoryOrdersLongestFirst)
+{
+    RuntimeHistory history;
+    const auto shortJob = Command("echo", "short");
+    const auto longJob = Command("echo", "long");
+    history.record(RuntimeHistory::key(shortJob), RuntimeHistory::Seconds(0.01));
+    history.record(RuntimeHistory::key(longJob), RuntimeHistory::Seconds(5));
+    EXPECT_EQ(RuntimeHistory::key(Command("/bin/echo", "long")), RuntimeHistory::key(longJob));
+    EXPECT_NE(RuntimeHistory::key(Command("echo", "long").setCurrentDir("/")), RuntimeHistory::key(longJob));
+
+    auto pool = WorkerPool::start(1);
+    ASSERT_TRUE(pool.has_value());
+    (*pool)->setHistory(&history);
+    std::stringstream progress;
+    (*pool)->setProgress(&progress);
+
+    // the first job occupies the only worker, the others queue behind it
+    std::stringstream out;
+    auto first = *(*pool)->submit(Command("bash", "-c", "sleep 0.1; echo first").setOut(out));
+    auto second = *(*pool)->submit(Command(shortJob).setOut(out));
+    auto third = *(*pool)->submit(Command(longJob).setOut(out));
+    auto estimate = (*pool)->estimatedRemaining();
+    ASSERT_TRUE(estimate.has_value());
+    EXPECT_GT(estimate->count(), 5.0);
+
+    for (auto id : {first, second, third}) {
+        EXPECT_EQ((*pool)->wait(id), 0);
+    }
+    EXPECT_EQ(out.str(), "first\nlong\nshort\n");
+    EXPECT_EQ(history.size(), 3u);
+    EXPECT_LT(history.expected(RuntimeHistory::key(longJob))->count(), 5.0); // moved towards the new run
+    EXPECT_NE(progress.str().find("[3 done, 0 left]"), std::string::npos);
+}
+
+TEST(Worker, HistoryPersists)
+{
+    const auto path = std::filesystem::temp_directory_path() / fmt::format("crew-history-{}", ::getpid());
+    const auto key = RuntimeHistory::key(Command("make", "all"));
+    {
+        RuntimeHistory history(path);
+        history.record(key, RuntimeHistory::Seconds(2));
+        history.record(key, RuntimeHistory::Seconds(4));
+        ASSERT_TRUE(history.save());
+    }
+    RuntimeHistory history(path);
+    ASSERT_TRUE(history.load());
+    ASSERT_TRUE(history.expected(key).has_value());
+    EXPECT_DOUBLE_EQ(history.expected(key)->count(), 2 + RuntimeHistory::kSmoothing * 2);
+    std::filesystem::remove(path);
+}
+
+TEST(Worker, HistoryDropsLeastRecentlyRun)
+{
+    const auto path = std::filesystem::temp_directory_path() / fmt::format("crew-history-cap-{}", ::getpid());
+    const auto limit = RuntimeHistory::kMaxEntries;
+    {
+        RuntimeHistory history(path);
+        for (RuntimeHistory::Key key = 0; key < limit; ++key) {
+            history.record(key, RuntimeHistory::Seconds(1));
+        }
+        ASSERT_TRUE(history.save());
+    }
+    {
+        // a later session runs one old and one new command, which pushes another out
+        RuntimeHistory history(path);
+        ASSERT_TRUE(history.load());
+        history.record(0, RuntimeHistory::Seconds(1));
+        history.record(limit, RuntimeHistory::Seconds(1));
+        EXPECT_EQ(history.size(), limit + 1);
+        ASSERT_TRUE(history.save());
+    }
+    RuntimeHistory history(path);
+    ASSERT_TRUE(history.load());
+    EXPECT_EQ(history.size(), limit);
+    EXPECT_TRUE(history.expected(0).has_value());
+    EXPECT_TRUE(history.expected(limit).has_value());
+    std::filesystem::remove(path);
+}
+} // namespace crew
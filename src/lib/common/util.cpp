@@ -1,4 +0,0 @@
-#include <common/util.hpp>
-
-namespace crew {
-} // namespace crew
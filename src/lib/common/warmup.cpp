@@ -0,0 +1,167 @@
+#include <common/util.hpp>
+#include <common/warmup.hpp>
+
+#include <cstdlib>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace crew {
+namespace {
+/** The directories execvp searches */
+std::string searchDirs()
+{
+    const char* path = std::getenv("PATH");
+    return path != nullptr ? path : "/usr/bin:/bin";
+}
+
+/** Search `dirs` for an executable `name`, as execvp would */
+std::optional<fs::path> searchPath(const std::string& name, std::string_view dirs)
+{
+    if (name.find('/') != std::string::npos) {
+        return ::access(name.c_str(), X_OK) == 0 ? std::optional(fs::absolute(name)) : std::nullopt;
+    }
+    while (!dirs.empty()) {
+        const size_t end = std::min(dirs.find(':'), dirs.size());
+        fs::path candidate = fs::path(dirs.substr(0, end).empty() ? "." : dirs.substr(0, end)) / name;
+        if (::access(candidate.c_str(), X_OK) == 0) {
+            return fs::absolute(candidate);
+        }
+        dirs.remove_prefix(std::min(end + 1, dirs.size()));
+    }
+    return std::nullopt;
+}
+
+/** Ask the kernel to start reading a file into the page cache */
+void readAhead(const fs::path& path)
+{
+    UniqueFd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.get() != -1) {
+        ::posix_fadvise(fd.get(), 0, 0, POSIX_FADV_WILLNEED);
+    }
+}
+} // namespace
+
+Warmup::Warmup(std::chrono::steady_clock::duration readAheadInterval) :
+    m_readAheadInterval(readAheadInterval)
+{
+    m_thread.start([this](std::stop_token stop) { run(stop); });
+}
+
+Warmup::~Warmup()
+{
+    m_thread.stop();
+}
+
+void Warmup::speculate(std::vector<std::string> tokens)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_request.has_value()) {
+            ++m_stats.cancelled; // never started
+        }
+        m_request = std::move(tokens);
+        ++m_generation;
+    }
+    m_changed.notify_all();
+}
+
+void Warmup::cancel()
+{
+    std::lock_guard lock(m_mutex);
+    if (m_request.has_value()) {
+        ++m_stats.cancelled;
+        m_request.reset();
+    }
+    ++m_generation;
+}
+
+std::optional<fs::path> Warmup::resolve(const std::string& name)
+{
+    const std::string dirs = searchDirs();
+    {
+        std::lock_guard lock(m_mutex);
+        if (dirs != m_resolvedPath) {
+            m_resolved.clear();
+            m_resolvedPath = dirs;
+        } else if (auto it = m_resolved.find(name); it != m_resolved.end()) {
+            return it->second;
+        }
+    }
+    auto found = searchPath(name, dirs);
+    std::lock_guard lock(m_mutex);
+    if (dirs == m_resolvedPath) {
+        m_resolved.try_emplace(name, found);
+    }
+    return found;
+}
+
+Warmup::Stats Warmup::stats() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+bool Warmup::superseded(uint64_t generation) const
+{
+    std::lock_guard lock(m_mutex);
+    return generation != m_generation;
+}
+
+void Warmup::run(std::stop_token stop)
+{
+    while (true) {
+        std::vector<std::string> tokens;
+        uint64_t generation{};
+        {
+            std::unique_lock lock(m_mutex);
+            if (!m_changed.wait(lock, stop, [this] { return m_request.has_value(); })) {
+                return; // stop requested
+            }
+            tokens = std::move(*m_request);
+            m_request.reset();
+            generation = m_generation;
+        }
+        if (tokens.empty() || tokens.front().empty()) {
+            continue;
+        }
+
+        // cheapest and most likely useful first, checking for a newer request in between
+        const auto program = resolve(tokens.front());
+        if (program.has_value() && !superseded(generation)) {
+            const auto now = std::chrono::steady_clock::now();
+            std::unique_lock lock(m_mutex);
+            auto [advised, inserted] = m_advised.try_emplace(*program, now);
+            if (inserted || now - advised->second >= m_readAheadInterval) {
+                advised->second = now;
+                lock.unlock();
+                readAhead(*program);
+                lock.lock();
+                ++m_stats.advised;
+            }
+        }
+
+        bool complete = true;
+        for (auto it = std::next(tokens.begin()); it != tokens.end(); ++it) {
+            if (superseded(generation) || stop.stop_requested()) {
+                complete = false;
+                break;
+            }
+            if (it->empty() || it->front() == '-') {
+                continue; // a flag, not a path
+            }
+            std::error_code ec;
+            [[maybe_unused]] const auto status = fs::status(*it, ec); // only the cached lookup matters
+            std::lock_guard lock(m_mutex);
+            ++m_stats.statted;
+        }
+
+        std::lock_guard lock(m_mutex);
+        ++(complete ? m_stats.speculations : m_stats.cancelled);
+    }
+}
+
+} // namespace crew
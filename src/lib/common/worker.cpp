@@ -0,0 +1,632 @@
+#include <common/process_tree.hpp>
+#include <common/worker.hpp>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <streambuf>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using nlohmann::json;
+
+namespace crew {
+namespace {
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL; // a dead peer is reported as EPIPE rather than SIGPIPE
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+/**
+ * Messages are framed as [u32 header size][u32 payload size][json header][payload],
+ * output travels in the raw payload so it need not be valid UTF-8
+ */
+struct Frame {
+    json header;
+    std::string payload;
+};
+
+Result<> writeAll(int fd, std::string_view bytes)
+{
+    while (!bytes.empty()) {
+        ssize_t count = ::send(fd, bytes.data(), bytes.size(), kSendFlags);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return makeError("send() failed: {}", std::strerror(errno));
+        }
+        bytes.remove_prefix(count);
+    }
+    return {};
+}
+
+/** Fill `dest`, returns false if the peer closed the connection before sending anything */
+Result<bool> readAll(int fd, char* dest, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t count = ::read(fd, dest + done, size - done);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return makeError("read() failed: {}", std::strerror(errno));
+        }
+        if (count == 0) {
+            if (done == 0) {
+                return false;
+            }
+            return makeError("connection closed mid message");
+        }
+        done += count;
+    }
+    return true;
+}
+
+Result<> sendFrame(int fd, const json& header, std::string_view payload = {})
+{
+    const std::string text = header.dump();
+    const uint32_t sizes[2] = {static_cast<uint32_t>(text.size()), static_cast<uint32_t>(payload.size())};
+
+    std::string message;
+    message.reserve(sizeof(sizes) + text.size() + payload.size());
+    message.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    message.append(text);
+    message.append(payload);
+    return writeAll(fd, message);
+}
+
+/** Read the next frame, nullopt if the peer disconnected cleanly */
+Result<std::optional<Frame>> readFrame(int fd)
+{
+    uint32_t sizes[2]{};
+    auto started = readAll(fd, reinterpret_cast<char*>(sizes), sizeof(sizes));
+    if (!started) {
+        return std::unexpected(started.error());
+    }
+    if (!*started) {
+        return std::nullopt;
+    }
+
+    std::string text(sizes[0], '\0');
+    Frame frame{};
+    frame.payload.resize(sizes[1]);
+    for (auto* part : {&text, &frame.payload}) {
+        if (part->empty()) {
+            continue;
+        }
+        auto read = readAll(fd, part->data(), part->size());
+        if (!read) {
+            return std::unexpected(read.error());
+        }
+        if (!*read) {
+            return makeError("connection closed mid message");
+        }
+    }
+
+    frame.header = json::parse(text, nullptr, /*allow_exceptions*/ false);
+    if (frame.header.is_discarded() || !frame.header.is_object()) {
+        return makeError("malformed message header");
+    }
+    return frame;
+}
+
+/** CPU time used so far by the commands this worker ran */
+int64_t commandsCpuMs()
+{
+    rusage usage{};
+    if (::getrusage(RUSAGE_CHILDREN, &usage) == -1) {
+        return 0;
+    }
+    const auto ms = [](const timeval& t) { return int64_t{t.tv_sec} * 1000 + t.tv_usec / 1000; };
+    return ms(usage.ru_utime) + ms(usage.ru_stime);
+}
+
+void setCloseOnExec(int fd, bool enable)
+{
+    int flags = ::fcntl(fd, F_GETFD);
+    if (flags != -1) {
+        ::fcntl(fd, F_SETFD, enable ? (flags | FD_CLOEXEC) : (flags & ~FD_CLOEXEC));
+    }
+}
+
+/** Unbuffered stream sending everything written to it as output frames of one job */
+class FrameStream : public std::ostream {
+public:
+    FrameStream(int fd, uint64_t id, const char* stream) :
+        std::ostream(nullptr), m_buffer(fd, id, stream)
+    {
+        rdbuf(&m_buffer);
+    }
+
+private:
+    class Buffer : public std::streambuf {
+    public:
+        Buffer(int fd, uint64_t id, const char* stream) :
+            m_fd(fd), m_header{{"type", "out"}, {"id", id}, {"stream", stream}} {}
+
+    protected:
+        std::streamsize xsputn(const char* s, std::streamsize n) override
+        {
+            if (!sendFrame(m_fd, m_header, std::string_view(s, static_cast<size_t>(n)))) {
+                return 0;
+            }
+            return n;
+        }
+
+        int_type overflow(int_type c) override
+        {
+            if (traits_type::eq_int_type(c, traits_type::eof())) {
+                return traits_type::not_eof(c);
+            }
+            char ch = traits_type::to_char_type(c);
+            return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+        }
+
+    private:
+        int m_fd{};
+        json m_header;
+    };
+
+    Buffer m_buffer;
+};
+} // namespace
+
+json commandToJson(const Command& command)
+{
+    json result;
+    const auto argv = command.argv();
+    result["argv"] = std::vector<std::string>(argv.begin(), argv.end());
+    result["cwd"] = command.currentDir().has_value() ? json(command.currentDir()->string()) : json(nullptr);
+    result["environment"] = nullptr;
+    if (command.environment().has_value()) {
+        result["environment"] = json::array();
+        for (char* const* entry = command.environment()->envp(); *entry != nullptr; ++entry) {
+            result["environment"].push_back(*entry);
+        }
+    }
+    result["env"] = json::object();
+    for (const auto& [k, v] : command.envOverrides()) {
+        result["env"][k] = v;
+    }
+    if (command.timeout().has_value()) {
+        result["timeout_ms"] = command.timeout()->count();
+    }
+    result["verbose"] = command.verbose();
+    result["dry_run"] = command.dryRun();
+    result["high_volume"] = command.highVolume();
+    result["single_flight"] = command.singleFlight();
+    result["new_session"] = command.newSession();
+    result["cgroup"] = command.cgroup();
+    return result;
+}
+
+Result<Command> commandFromJson(const json& j)
+{
+    try {
+        const auto& argv = j.at("argv");
+        if (!argv.is_array() || argv.empty()) {
+            return makeError("command has no argv");
+        }
+
+        std::string buffer;
+        for (const auto& arg : argv) {
+            const auto& s = arg.get_ref<const std::string&>();
+            if (s.find('\0') != std::string::npos) {
+                return makeError("argument contains a null byte");
+            }
+            buffer.append(s);
+            buffer.push_back('\0');
+        }
+
+        auto command = Command::fromArgv(std::move(buffer), argv.size());
+        if (j.contains("cwd") && !j["cwd"].is_null()) {
+            command.setCurrentDir(j["cwd"].get<std::string>());
+        }
+        if (j.contains("environment") && !j["environment"].is_null()) {
+            const auto entries = j["environment"].get<std::vector<std::string>>();
+            std::vector<const char*> envp;
+            for (const auto& entry : entries) {
+                envp.push_back(entry.c_str());
+            }
+            envp.push_back(nullptr);
+            command.setEnvironment(Environment::fromEnvp(envp.data()));
+        }
+        if (j.contains("env")) {
+            for (const auto& [k, v] : j["env"].items()) {
+                command.setEnv(k, v.get<std::string>());
+            }
+        }
+        if (j.contains("timeout_ms")) {
+            command.setTimeout(std::chrono::milliseconds(j["timeout_ms"].get<int64_t>()));
+        }
+        command.setVerbose(j.value("verbose", false))
+                .setDry(j.value("dry_run", false))
+                .setHighVolume(j.value("high_volume", false))
+                .setSingleFlight(j.value("single_flight", false))
+                .setNewSession(j.value("new_session", false))
+                .setCgroup(j.value("cgroup", false));
+        return command;
+    } catch (const json::exception& e) {
+        return makeError("malformed command: {}", e.what());
+    }
+}
+
+int serveWorker(int fd)
+{
+    // commands we spawn must not hold our connection open
+    setCloseOnExec(fd, true);
+
+    // the pool cancels the running command with SIGINT, as does Ctrl-C reaching the
+    // worker through the terminal, rather than terminating the worker
+    struct sigaction action {};
+    action.sa_handler = [](int) { ProcessTree::interruptAll(); };
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, nullptr);
+
+    if (!sendFrame(fd, {{"type", "hello"}})) {
+        return 1;
+    }
+
+    while (true) {
+        auto frame = readFrame(fd);
+        if (!frame) {
+            std::cerr << "crew-worker: " << frame.error().message << std::endl;
+            return 1;
+        }
+        if (!frame->has_value()) { // pool disconnected
+            return 0;
+        }
+
+        const json& header = (*frame)->header;
+        if (header.value("type", "") != "run") {
+            continue;
+        }
+        const uint64_t id = header.value("id", uint64_t{});
+
+        json done{{"type", "exit"}, {"id", id}};
+        if (auto command = commandFromJson(header.value("command", json::object())); !command) {
+            done["error"] = command.error().message;
+        } else {
+            FrameStream out(fd, id, "out");
+            FrameStream err(fd, id, "err");
+            // cancelling the job kills its process group, so its descendants go down too
+            auto result = command->setOut(out)
+                                  .setErr(err)
+                                  .onError(OnError::Return)
+                                  .tryRun();
+            if (result) {
+                done["code"] = *result;
+            } else {
+                done["error"] = result.error().message;
+            }
+        }
+        done["cpu_ms"] = commandsCpuMs();
+
+        if (!sendFrame(fd, done)) {
+            return 1;
+        }
+    }
+}
+
+Result<std::unique_ptr<WorkerPool>> WorkerPool::start(size_t count, std::optional<std::filesystem::path> workerExe)
+{
+    std::unique_ptr<WorkerPool> pool(new WorkerPool());
+    for (size_t i = 0; i < count; ++i) {
+        int fds[2]{};
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+            return makeError("socketpair() failed: {}", std::strerror(errno));
+        }
+        setCloseOnExec(fds[0], true);
+        setCloseOnExec(fds[1], true);
+
+        // built before forking, the child of a multithreaded process must not allocate
+        const std::string exe = workerExe.has_value() ? workerExe->string() : std::string();
+        const std::string fd = std::to_string(fds[1]);
+
+        int pid = ::fork();
+        if (pid == -1) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            return makeError("fork() failed: {}", std::strerror(errno));
+        }
+        if (pid == 0) { // child
+            ::close(fds[0]);
+            for (const auto& w : pool->m_workers) {
+                ::close(w.fd);
+            }
+            if (workerExe.has_value()) {
+                setCloseOnExec(fds[1], false);
+                ::execl(exe.c_str(), exe.c_str(), "--fd", fd.c_str(), static_cast<char*>(nullptr));
+                ::_exit(127);
+            }
+            ::_exit(serveWorker(fds[1]));
+        }
+
+        ::close(fds[1]);
+        pool->m_workers.push_back(Worker{.pid = pid, .fd = fds[0]});
+    }
+    return pool;
+}
+
+WorkerPool::~WorkerPool()
+{
+    for (auto& w : m_workers) {
+        if (w.alive) {
+            ::close(w.fd);
+        }
+    }
+    for (auto& w : m_workers) {
+        while (::waitpid(w.pid, nullptr, 0) == -1 && errno == EINTR) {
+        }
+    }
+}
+
+Result<WorkerPool::JobId> WorkerPool::submit(Command command)
+{
+    if (command.backend() != nullptr) {
+        return makeError("cannot run \"{}\" on a worker: its backend lives in this process", command.toString());
+    }
+    if (command.stopToken().stop_possible()) {
+        return makeError("cannot run \"{}\" on a worker: use WorkerPool::cancel() rather than a stop token", command.toString());
+    }
+
+    JobId id = m_nextId++;
+    Job& job = m_jobs.emplace(id, Job{.command = std::move(command)}).first->second;
+
+    auto position = m_queue.end();
+    if (m_history != nullptr) {
+        job.key = RuntimeHistory::key(job.command);
+        job.expected = m_history->expected(job.key);
+        // longest expected first, jobs never seen before may be long so they go first
+        const auto longest = job.expected.value_or(RuntimeHistory::Seconds::max());
+        position = std::find_if(m_queue.begin(), m_queue.end(), [&](JobId queued) {
+            return m_jobs.at(queued).expected.value_or(RuntimeHistory::Seconds::max()) < longest;
+        });
+    }
+    m_queue.insert(position, id);
+    dispatch();
+    return id;
+}
+
+Result<int> WorkerPool::wait(JobId id)
+{
+    auto it = m_jobs.find(id);
+    if (it == m_jobs.end()) {
+        return makeError("unknown job {}", id);
+    }
+
+    while (!it->second.result.has_value()) {
+        if (auto pumped = pump(); !pumped) {
+            return std::unexpected(pumped.error());
+        }
+    }
+
+    Result<int> result = std::move(*it->second.result);
+    m_jobs.erase(it);
+    return result;
+}
+
+void WorkerPool::detach(JobId id)
+{
+    if (auto it = m_jobs.find(id); it != m_jobs.end()) {
+        it->second.detached = true;
+        eraseDetached();
+    }
+}
+
+void WorkerPool::eraseDetached()
+{
+    std::erase_if(m_jobs, [](const auto& entry) { return entry.second.detached && entry.second.result.has_value(); });
+}
+
+void WorkerPool::dispatch()
+{
+    while (!m_queue.empty()) {
+        std::optional<size_t> best;
+        bool anyAlive = false;
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            const auto& w = m_workers[i];
+            anyAlive = anyAlive || w.alive;
+            if (w.alive && !w.running.has_value() && (!best || w.cpuMs < m_workers[*best].cpuMs)) {
+                best = i;
+            }
+        }
+
+        if (!anyAlive) { // nothing will ever run the queued jobs
+            for (JobId id : m_queue) {
+                m_jobs.at(id).result = makeError("no live workers");
+            }
+            m_queue.clear();
+            return;
+        }
+        if (!best.has_value()) {
+            return;
+        }
+
+        const JobId id = m_queue.front();
+        Job& job = m_jobs.at(id);
+        json message{{"type", "run"}, {"id", id}, {"command", commandToJson(job.command)}};
+        if (auto sent = sendFrame(m_workers[*best].fd, message); !sent) {
+            workerFailed(*best, sent.error().message);
+            continue;
+        }
+        m_queue.pop_front();
+        m_workers[*best].running = id;
+        job.worker = *best;
+        job.started = std::chrono::steady_clock::now();
+    }
+}
+
+Result<> WorkerPool::pump()
+{
+    std::vector<pollfd> fds;
+    std::vector<size_t> index;
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        if (m_workers[i].alive) {
+            fds.push_back(pollfd{m_workers[i].fd, POLLIN, 0});
+            index.push_back(i);
+        }
+    }
+    if (fds.empty()) {
+        return makeError("no live workers");
+    }
+
+    while (::poll(fds.data(), fds.size(), -1) == -1) {
+        if (errno != EINTR) {
+            return makeError("poll() failed: {}", std::strerror(errno));
+        }
+    }
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+        Worker& worker = m_workers[index[i]];
+        if (fds[i].revents == 0 || !worker.alive) { // may have failed while handling another worker
+            continue;
+        }
+
+        auto frame = readFrame(worker.fd);
+        if (!frame) {
+            workerFailed(index[i], frame.error().message);
+            continue;
+        }
+        if (!frame->has_value()) {
+            workerFailed(index[i], "worker exited");
+            continue;
+        }
+
+        const json& header = (*frame)->header;
+        const std::string type = header.value("type", "");
+        worker.cpuMs = header.value("cpu_ms", worker.cpuMs);
+
+        if (type == "out") {
+            auto job = m_jobs.find(header.value("id", JobId{}));
+            if (job != m_jobs.end()) {
+                auto& dest = header.value("stream", "") == "err" ? job->second.command.errStream()
+                                                                 : job->second.command.outStream();
+                dest << (*frame)->payload;
+            }
+        } else if (type == "exit") {
+            auto job = m_jobs.find(header.value("id", JobId{}));
+            if (job != m_jobs.end()) {
+                job->second.command.outStream().flush();
+                job->second.command.errStream().flush();
+                if (header.contains("code")) {
+                    job->second.result = header["code"].get<int>();
+                } else {
+                    job->second.result = makeError("{}", header.value("error", "worker failed to run command"));
+                }
+            }
+            worker.running.reset();
+            if (job != m_jobs.end()) {
+                jobFinished(job->second);
+            }
+        }
+    }
+
+    dispatch();
+    eraseDetached();
+    return {};
+}
+
+void WorkerPool::cancel()
+{
+    for (JobId id : m_queue) {
+        m_jobs.at(id).result = makeError("cancelled before it started");
+    }
+    m_queue.clear();
+    eraseDetached();
+    for (const auto& worker : m_workers) {
+        if (worker.alive && worker.running.has_value()) {
+            ::kill(worker.pid, SIGINT);
+        }
+    }
+}
+
+void WorkerPool::workerFailed(size_t index, const std::string& reason)
+{
+    Worker& worker = m_workers[index];
+    worker.alive = false;
+    ::close(worker.fd);
+    if (worker.running.has_value()) {
+        m_jobs.at(*worker.running).result = makeError("worker {} failed: {}", worker.pid, reason);
+        worker.running.reset();
+    }
+    dispatch();
+}
+
+void WorkerPool::jobFinished(Job& job)
+{
+    ++m_finished;
+    if (m_failFast && (!job.result->has_value() || **job.result != 0)) {
+        cancel();
+    }
+    if (m_history != nullptr && job.result->has_value()) {
+        m_history->record(job.key, std::chrono::steady_clock::now() - job.started);
+    }
+
+    if (m_progress != nullptr) {
+        size_t left = m_queue.size();
+        for (const auto& w : m_workers) {
+            left += w.running.has_value() ? 1 : 0;
+        }
+        *m_progress << fmt::format("[{} done, {} left", m_finished, left);
+        if (auto remaining = estimatedRemaining(); remaining && left > 0) {
+            *m_progress << fmt::format(", about {:.1f}s remaining", remaining->count());
+        }
+        *m_progress << "]" << std::endl;
+    }
+}
+
+std::optional<RuntimeHistory::Seconds> WorkerPool::estimatedRemaining() const
+{
+    using Seconds = RuntimeHistory::Seconds;
+    const auto now = std::chrono::steady_clock::now();
+
+    // jobs without history count as the average of the jobs with
+    Seconds known{};
+    size_t numKnown = 0;
+    for (const auto& [id, job] : m_jobs) {
+        if (!job.result.has_value() && job.expected.has_value()) {
+            known += *job.expected;
+            ++numKnown;
+        }
+    }
+    if (numKnown == 0) {
+        return std::nullopt;
+    }
+    const Seconds average = known / static_cast<double>(numKnown);
+
+    // when each live worker becomes free, then hand out the queue in order
+    std::vector<Seconds> freeAt;
+    for (const auto& w : m_workers) {
+        if (!w.alive) {
+            continue;
+        }
+        Seconds busy{};
+        if (w.running.has_value()) {
+            const Job& job = m_jobs.at(*w.running);
+            busy = std::max(job.expected.value_or(average) - Seconds(now - job.started), Seconds{});
+        }
+        freeAt.push_back(busy);
+    }
+    if (freeAt.empty()) {
+        return std::nullopt;
+    }
+    for (JobId id : m_queue) {
+        auto earliest = std::min_element(freeAt.begin(), freeAt.end());
+        *earliest += m_jobs.at(id).expected.value_or(average);
+    }
+    return *std::max_element(freeAt.begin(), freeAt.end());
+}
+
+} // namespace crew
@@ -0,0 +1,267 @@
+#include <terminal/encoder.hpp>
+
+#include <algorithm>
+#include <utility>
+
+#include <fmt/format.h>
+
+#include <wchar.h>
+
+namespace crew {
+namespace {
+/** CSI sequence with a count parameter, omitted when it is 1 (the default) */
+std::string csiCount(int n, char final)
+{
+    return n == 1 ? fmt::format("\x1b[{}", final) : fmt::format("\x1b[{}{}", n, final);
+}
+
+/** Absolute cursor position, omitting default parameters */
+std::string cursorPosition(int row, int col)
+{
+    if (col == 0) {
+        return row == 0 ? "\x1b[H" : fmt::format("\x1b[{}H", row + 1);
+    }
+    return fmt::format("\x1b[{};{}H", row + 1, col + 1);
+}
+
+const std::string& shortest(const std::string& a, const std::string& b)
+{
+    return b.size() < a.size() ? b : a;
+}
+
+/**
+ * Screen columns taken by printable UTF-8 `text`, nullopt if the width of a character is
+ * not known, in which case neither is the cursor position after it
+ */
+std::optional<int> displayWidth(std::string_view text)
+{
+    int width = 0;
+    for (size_t i = 0; i < text.size();) {
+        const auto lead = static_cast<unsigned char>(text[i]);
+        if (lead < 0x80) {
+            ++width;
+            ++i;
+            continue;
+        }
+        const size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+        if (length == 1 || i + length > text.size()) {
+            return std::nullopt; // not UTF-8, the terminal may show anything
+        }
+        char32_t codePoint = lead & (0x7F >> length);
+        for (size_t k = 1; k < length; ++k) {
+            codePoint = (codePoint << 6) | (static_cast<unsigned char>(text[i + k]) & 0x3F);
+        }
+        if (const int columns = ::wcwidth(static_cast<wchar_t>(codePoint)); columns >= 0) {
+            width += columns;
+        } else if (codePoint < 0x300 || (codePoint >= 0x2010 && codePoint <= 0x2027)) {
+            ++width; // latin letters and punctuation such as ‘’ are narrow, whatever the locale
+        } else {
+            return std::nullopt;
+        }
+        i += length;
+    }
+    return width;
+}
+} // namespace
+
+TerminalEncoder::TerminalEncoder(Position size)
+{
+    reset(size);
+}
+
+void TerminalEncoder::reset(Position size)
+{
+    m_size = size;
+    m_row.reset();
+    m_col.reset();
+    m_scrollTop = 0;
+    m_scrollBottom = std::max(size.y - 1, 0);
+    m_style.reset();
+    m_cursorVisible.reset();
+    m_rowExtent.assign(std::max(size.y, 0), std::nullopt);
+}
+
+void TerminalEncoder::setScrollRegion(int top, int bottom)
+{
+    m_out.append(fmt::format("\x1b[{};{}r", top + 1, bottom + 1));
+    m_scrollTop = top;
+    m_scrollBottom = bottom;
+    m_row = 0; // DECSTBM homes the cursor
+    m_col = 0;
+}
+
+void TerminalEncoder::resetScrollRegion()
+{
+    m_out.append("\x1b[r");
+    m_scrollTop = 0;
+    m_scrollBottom = std::max(m_size.y - 1, 0);
+    m_row = 0;
+    m_col = 0;
+}
+
+std::optional<std::string> TerminalEncoder::relativeMove(int row, int col) const
+{
+    const int r = *m_row;
+    const int c = *m_col;
+    const bool inRegion = r >= m_scrollTop && r <= m_scrollBottom;
+
+    std::string vertical;
+    if (row > r) {
+        // LF and CUD both stop at the bottom margin when starting inside the region
+        const int limit = inRegion ? m_scrollBottom : m_size.y - 1;
+        if (row > limit) {
+            return std::nullopt;
+        }
+        vertical = shortest(std::string(row - r, '\n'), csiCount(row - r, 'B'));
+    } else if (row < r) {
+        if (inRegion && row < m_scrollTop) {
+            return std::nullopt;
+        }
+        vertical = csiCount(r - row, 'A');
+    }
+
+    // raw mode disables output post processing, so LF does not return the carriage
+    std::string horizontal;
+    if (col != c) {
+        const std::string absolute = fmt::format("\x1b[{}G", col + 1);
+        if (col == 0) {
+            horizontal = "\r";
+        } else if (col > c) {
+            horizontal = shortest(csiCount(col - c, 'C'), absolute);
+        } else {
+            horizontal = shortest(shortest(std::string(c - col, '\b'), csiCount(c - col, 'D')), absolute);
+            horizontal = shortest(horizontal, "\r" + csiCount(col, 'C'));
+        }
+    }
+    return vertical + horizontal;
+}
+
+void TerminalEncoder::moveTo(int row, int col)
+{
+    if (m_row == row && m_col == col) {
+        return;
+    }
+
+    std::string absolute = cursorPosition(row, col);
+    if (m_row.has_value() && m_col.has_value()) {
+        if (auto relative = relativeMove(row, col); relative && relative->size() < absolute.size()) {
+            absolute = std::move(*relative);
+        }
+    }
+    m_out.append(absolute);
+    m_row = row;
+    m_col = col;
+}
+
+void TerminalEncoder::write(std::string_view text)
+{
+    size_t i = 0;
+    while (i < text.size()) {
+        const char ch = text[i];
+        size_t run = 1;
+        while (i + run < text.size() && text[i + run] == ch) {
+            ++run;
+        }
+
+        m_out.push_back(ch);
+        if (run > 1) {
+            // REP repeats the preceding graphic character, only safe for single byte ones
+            const std::string rep = fmt::format("\x1b[{}b", run - 1);
+            if (m_repeatSupported && ch >= 0x20 && ch < 0x7F && rep.size() < run - 1) {
+                m_out.append(rep);
+            } else {
+                m_out.append(run - 1, ch);
+            }
+        }
+        i += run;
+    }
+
+    if (!m_row.has_value() || !m_col.has_value()) {
+        return;
+    }
+    const auto width = displayWidth(text);
+    if (!width.has_value()) {
+        m_rowExtent.at(*m_row).reset();
+        m_row.reset();
+        m_col.reset();
+        return;
+    }
+    const int end = *m_col + *width;
+    if (auto& extent = m_rowExtent.at(*m_row); extent.has_value()) {
+        extent = std::max(*extent, end);
+    }
+    if (end >= m_size.x) { // pending wrap, the next position depends on the terminal
+        m_row.reset();
+        m_col.reset();
+    } else {
+        m_col = end;
+    }
+}
+
+void TerminalEncoder::clearToEndOfLine()
+{
+    if (m_row.has_value() && m_col.has_value()) {
+        auto& extent = m_rowExtent.at(*m_row);
+        if (extent.has_value() && *extent <= *m_col) {
+            return; // already blank
+        }
+        extent = *m_col;
+    }
+    m_out.append("\x1b[K");
+}
+
+void TerminalEncoder::newLine()
+{
+    m_out.append(m_col == 0 ? "\n" : "\r\n");
+    m_col = 0;
+    if (!m_row.has_value()) {
+        return;
+    }
+    if (*m_row == m_scrollBottom) {
+        scrollUp();
+    } else if (*m_row < m_size.y - 1) {
+        ++*m_row;
+    }
+}
+
+void TerminalEncoder::scrollUp()
+{
+    auto top = m_rowExtent.begin() + m_scrollTop;
+    auto bottom = m_rowExtent.begin() + m_scrollBottom;
+    std::rotate(top, top + 1, bottom + 1);
+    *bottom = 0; // the terminal inserts a blank row
+}
+
+void TerminalEncoder::setStyle(std::string_view sgr)
+{
+    if (m_style == sgr) {
+        return;
+    }
+    m_out.append(sgr.empty() ? std::string("\x1b[m") : fmt::format("\x1b[0;{}m", sgr));
+    m_style = std::string(sgr);
+}
+
+void TerminalEncoder::setCursorVisible(bool visible)
+{
+    if (m_cursorVisible == visible) {
+        return;
+    }
+    m_out.append(visible ? "\x1b[?25h" : "\x1b[?25l");
+    m_cursorVisible = visible;
+}
+
+void TerminalEncoder::raw(std::string_view bytes)
+{
+    m_out.append(bytes);
+    m_row.reset();
+    m_col.reset();
+    m_style.reset();
+    std::fill(m_rowExtent.begin(), m_rowExtent.end(), std::nullopt);
+}
+
+std::string TerminalEncoder::take()
+{
+    return std::exchange(m_out, {});
+}
+
+} // namespace crew
@@ -0,0 +1,80 @@
+/**
+ * Terminal output encoder emitting the shortest escape sequences for each change
+ */
+#ifndef CREW_TERMINAL_ENCODER_HPP
+#define CREW_TERMINAL_ENCODER_HPP
+
+#include <terminal/terminal.hpp>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace crew {
+
+/**
+ * Tracks what the terminal's cursor position, SGR attributes, cursor visibility and
+ * line contents are, so that each operation emits only what is needed: relative moves,
+ * CR/LF or backspaces when shorter than absolute positioning, REP for runs of a
+ * repeated character where supported, and no redundant SGR or erase sequences.
+ *
+ * Rows and columns are 0 based, columns count the cells characters take on screen.
+ * After text of unknown width the next move is absolute. Output accumulates until take()
+ * is called.
+ */
+class TerminalEncoder {
+public:
+    explicit TerminalEncoder(Position size = {});
+
+    /** Forget everything known about the terminal, e.g. after a resize or foreign output */
+    void reset(Position size);
+
+    /** Set the scroll region to rows [top, bottom], homing the cursor */
+    void setScrollRegion(int top, int bottom);
+    /** Remove the scroll region */
+    void resetScrollRegion();
+
+    void moveTo(int row, int col);
+    /** Write printable UTF-8 text at the cursor, which must fit in the current row */
+    void write(std::string_view text);
+    /** Erase from the cursor to the end of the row, skipped if that part is already blank */
+    void clearToEndOfLine();
+    /** Move to the start of the next row, scrolling if at the bottom of the scroll region */
+    void newLine();
+
+    /** Set SGR attributes (e.g. "1;31"), an empty string resets them */
+    void setStyle(std::string_view sgr);
+    void setCursorVisible(bool visible);
+
+    /** Append bytes the encoder does not interpret, invalidating the tracked cursor */
+    void raw(std::string_view bytes);
+
+    /** Whether REP (CSI n b) may be used, off by default as not every terminal supports it */
+    void setRepeatSupported(bool supported) { m_repeatSupported = supported; }
+
+    /** Return and clear the accumulated output */
+    std::string take();
+
+private:
+    /** Sequence moving the cursor from the tracked position to (row, col), if there is one */
+    std::optional<std::string> relativeMove(int row, int col) const;
+    void scrollUp();
+
+    Position m_size{};
+    std::optional<int> m_row; // unknown while nullopt
+    std::optional<int> m_col;
+    int m_scrollTop{};
+    int m_scrollBottom{};
+    std::optional<std::string> m_style; // unknown while nullopt
+    std::optional<bool> m_cursorVisible;
+    bool m_repeatSupported{};
+
+    // columns at or beyond which each row is known to be blank, nullopt if unknown
+    std::vector<std::optional<int>> m_rowExtent;
+
+    std::string m_out;
+};
+
+} // namespace crew
+#endif
@@ -4,6 +4,8 @@
 #ifndef CREW_TERMINAL_TERMINAL_HPP
 #define CREW_TERMINAL_TERMINAL_HPP
 
+#include <common/util.hpp>
+
 #include <iostream>
 #include <optional>
 #include <string>
@@ -58,7 +60,7 @@ enum class EditorKey : int {
 };
 
 /** Read a key from standard input, stdin must be raw */
-int readKey();
+Result<int> readKey();
 
 /** Get current cursor position, stdin must be raw */
 std::optional<Position> getCursorPos();
@@ -1,6 +1,7 @@
 #include <terminal/terminal.hpp>
 
 #include <array>
+#include <cstring>
 
 #include <unistd.h>
 
@@ -34,6 +35,8 @@ std::vector<std::string> toRows(const std::string content, int32_t width)
             rowWidth += 4;
         } else if (*it == '\n') {
             pushRow();
+        } else if (*it == '\r') {
+            // zero width, overwrites are resolved at ingestion by ProgressStage
         } else {
             next.push_back(*it);
             rowWidth += 1;
@@ -46,13 +49,13 @@ std::vector<std::string> toRows(const std::string content, int32_t width)
     return result;
 }
 
-int readKey()
+Result<int> readKey()
 {
     int nread{};
     char c{};
     while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN) {
-            die("read");
+        if (nread == -1 && errno != EAGAIN && errno != EINTR) {
+            return makeError("read: {}", std::strerror(errno));
         }
     }
 
@@ -0,0 +1,59 @@
+#include <terminal/encoder.hpp>
+
+#include <gtest/gtest.h>
+
+namespace crew {
+
+TEST(TerminalEncoder, RepeatIsOptIn)
+{
+    TerminalEncoder encoder({80, 24});
+    encoder.moveTo(0, 0);
+    encoder.write("----------");
+    EXPECT_EQ(encoder.take(), "\x1b[H----------");
+
+    encoder.setRepeatSupported(true);
+    encoder.moveTo(1, 0);
+    encoder.write("----------");
+    EXPECT_EQ(encoder.take(), "\n\r-\x1b[9b");
+}
+
+TEST(TerminalEncoder, MovesRelativelyWhenShorter)
+{
+    TerminalEncoder encoder({80, 24});
+    encoder.moveTo(2, 10);
+    EXPECT_EQ(encoder.take(), "\x1b[3;11H");
+    encoder.moveTo(2, 8);
+    EXPECT_EQ(encoder.take(), "\b\b");
+    encoder.moveTo(3, 0);
+    EXPECT_EQ(encoder.take(), "\n\r");
+    encoder.moveTo(3, 0);
+    EXPECT_EQ(encoder.take(), "");
+}
+
+TEST(TerminalEncoder, TracksDisplayColumns)
+{
+    TerminalEncoder encoder({80, 24});
+    encoder.moveTo(0, 0);
+    encoder.write("‘x’"); // 7 bytes, 3 columns
+    encoder.moveTo(0, 5);
+    EXPECT_EQ(encoder.take(), "\x1b[H‘x’\x1b[2C");
+
+    // after text of unknown width only an absolute move is safe
+    encoder.write("\xff");
+    encoder.moveTo(0, 5);
+    EXPECT_EQ(encoder.take(), "\xff\x1b[1;6H");
+}
+
+TEST(TerminalEncoder, SkipsRedundantErases)
+{
+    TerminalEncoder encoder({80, 24});
+    encoder.moveTo(0, 0);
+    encoder.write("abc");
+    encoder.clearToEndOfLine();
+    encoder.clearToEndOfLine();
+    encoder.moveTo(0, 5);
+    encoder.clearToEndOfLine(); // beyond what was written
+    EXPECT_EQ(encoder.take(), "\x1b[Habc\x1b[K\x1b[2C");
+}
+
+} // namespace crew